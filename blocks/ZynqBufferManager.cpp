@@ -4,6 +4,8 @@
 #include "ZynqDMASupport.hpp"
 #include <Pothos/Util/OrderedQueue.hpp>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <iostream>
 
 template <pzdud_dir_t dir>
@@ -12,8 +14,9 @@ class ZynqDMABufferManager :
     public std::enable_shared_from_this<ZynqDMABufferManager<dir>>
 {
 public:
-    ZynqDMABufferManager(std::shared_ptr<pzdud_t> engine):
-        _engine(engine)
+    ZynqDMABufferManager(std::shared_ptr<pzdud_t> engine, const int allocFlags):
+        _engine(engine),
+        _allocFlags(allocFlags)
     {
         return;
     }
@@ -30,9 +33,12 @@ public:
     void init(const Pothos::BufferManagerArgs &args)
     {
         _readyBuffs = Pothos::Util::OrderedQueue<Pothos::ManagedBuffer>(args.numBuffers);
+        _releaseHandles.reserve(args.numBuffers);
+        _releaseLengths.reserve(args.numBuffers);
 
-        int ret = pzdud_alloc(_engine.get(), args.numBuffers, args.bufferSize);
-        if (ret != PZDUD_OK) throw Pothos::Exception("ZynqBufferManager::pzdud_alloc()", std::to_string(ret));
+        int ret = pzdud_alloc_ex(_engine.get(), args.numBuffers, args.bufferSize, _allocFlags);
+        if (ret == PZDUD_ERROR_BUSY) throw Pothos::Exception("ZynqBufferManager::pzdud_alloc_ex()", "subscribers of the previous owner still map the ring");
+        if (ret != PZDUD_OK) throw Pothos::Exception("ZynqBufferManager::pzdud_alloc_ex()", std::to_string(ret));
 
         ret = pzdud_init(_engine.get(), false/*no initial release*/);
         if (ret != PZDUD_OK) throw Pothos::Exception("ZynqBufferManager::pzdud_init()", std::to_string(ret));
@@ -71,7 +77,7 @@ public:
         //this manager in an output port upstream of dma sink
         if (dir == PZDUD_MM2S)
         {
-            pzdud_release(_engine.get(), buff.getSlabIndex(), numBytes);
+            this->deferRelease(buff.getSlabIndex(), numBytes);
         }
     }
 
@@ -87,19 +93,51 @@ public:
         //this manager in the output port on the dma source
         if (dir == PZDUD_S2MM)
         {
-            pzdud_release(_engine.get(), buff.getSlabIndex(), 0/*unused*/);
+            this->deferRelease(buff.getSlabIndex(), 0/*unused*/);
         }
     }
 
+    //! Release all deferred buffers to the engine with a single doorbell,
+    //! an empty flush still hands back the buffers held back by subscribers
+    void flush(void)
+    {
+        std::lock_guard<std::mutex> lock(_releaseMutex);
+        PzdudRing<dir> ring(_engine.get());
+        ring.releaseMany(_releaseHandles.data(), _releaseLengths.data(), _releaseHandles.size());
+        _releaseHandles.clear();
+        _releaseLengths.clear();
+    }
+
 private:
+    //pop may be called from the upstream block's thread,
+    //so the deferred list is protected for flush from work()
+    void deferRelease(const size_t handle, const size_t length)
+    {
+        std::lock_guard<std::mutex> lock(_releaseMutex);
+        _releaseHandles.push_back(handle);
+        _releaseLengths.push_back(length);
+    }
+
     Pothos::Util::OrderedQueue<Pothos::ManagedBuffer> _readyBuffs;
     std::shared_ptr<pzdud_t> _engine;
+    const int _allocFlags;
+    std::mutex _releaseMutex;
+    std::vector<size_t> _releaseHandles;
+    std::vector<size_t> _releaseLengths;
 };
 
 
-Pothos::BufferManager::Sptr makeZynqDMABufferManager(std::shared_ptr<pzdud_t> engine, const pzdud_dir_t dir)
+Pothos::BufferManager::Sptr makeZynqDMABufferManager(std::shared_ptr<pzdud_t> engine, const pzdud_dir_t dir, const int allocFlags)
 {
-    if (dir == PZDUD_S2MM) return Pothos::BufferManager::Sptr(new ZynqDMABufferManager<PZDUD_S2MM>(engine));
-    if (dir == PZDUD_MM2S) return Pothos::BufferManager::Sptr(new ZynqDMABufferManager<PZDUD_MM2S>(engine));
+    if (dir == PZDUD_S2MM) return Pothos::BufferManager::Sptr(new ZynqDMABufferManager<PZDUD_S2MM>(engine, allocFlags));
+    if (dir == PZDUD_MM2S) return Pothos::BufferManager::Sptr(new ZynqDMABufferManager<PZDUD_MM2S>(engine, allocFlags));
     return Pothos::BufferManager::Sptr();
 }
+
+void flushZynqDMABufferManager(const Pothos::BufferManager::Sptr &manager)
+{
+    auto s2mm = std::dynamic_pointer_cast<ZynqDMABufferManager<PZDUD_S2MM>>(manager);
+    if (s2mm) s2mm->flush();
+    auto mm2s = std::dynamic_pointer_cast<ZynqDMABufferManager<PZDUD_MM2S>>(manager);
+    if (mm2s) mm2s->flush();
+}
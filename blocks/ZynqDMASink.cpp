@@ -16,7 +16,75 @@
  * |param index[Engine Index] The index of an AXI DMA on the system
  * |default 0
  *
+ * |param waitMode[Wait Mode] The policy used to wait on DMA completions.
+ * Busy-polling trades CPU time for lower wake-up latency.
+ * <ul>
+ * <li>"IRQ" - sleep on the completion interrupt</li>
+ * <li>"HYBRID" - busy-poll for the spin time, then sleep on the interrupt</li>
+ * <li>"POLL" - busy-poll for the entire timeout</li>
+ * </ul>
+ * |default "IRQ"
+ * |option [Interrupt] "IRQ"
+ * |option [Hybrid] "HYBRID"
+ * |option [Poll] "POLL"
+ * |preview valid
+ *
+ * |param spinTime[Spin Time] The busy-poll time in hybrid mode.
+ * |units us
+ * |default 10
+ * |preview valid
+ *
+ * |param waitBatch[Wait Batch] The number of DMA completions to wait for.
+ * Larger batches wake the block once per batch rather than once per buffer,
+ * which saves system calls at high rates. When the stream pauses,
+ * a partial batch is handed off after the work timeout.
+ * |units buffers
+ * |default 1
+ * |preview valid
+ *
+ * |param writeCombine[Write Combine] Map the DMA buffers write-combining.
+ * Upstream stores into the buffers are merged rather than serialized,
+ * and a store barrier is issued before buffers are handed to the engine.
+ * The setting takes effect when the buffers are allocated on activation.
+ * |default false
+ * |option [Uncached] false
+ * |option [Write Combine] true
+ * |preview valid
+ *
+ * |param moderation[IRQ Moderation] The interrupt moderation of the DMA channel.
+ * Moderation lowers the interrupt rate at high rates on small buffers,
+ * at the cost of completion latency; see the getIrqRate() and
+ * getIrqLatency() calls for the observed trade-off.
+ * <ul>
+ * <li>"OFF" - one interrupt per completed buffer</li>
+ * <li>"ADAPTIVE" - tune the coalesce count and delay from the completion rate</li>
+ * <li>"MANUAL" - use the coalesce count and delay below</li>
+ * <li>"POLL" - mask the interrupt under load and poll in the kernel until the ring drains</li>
+ * </ul>
+ * |default "OFF"
+ * |option [Off] "OFF"
+ * |option [Adaptive] "ADAPTIVE"
+ * |option [Manual] "MANUAL"
+ * |option [Poll] "POLL"
+ * |preview valid
+ *
+ * |param coalesce[IRQ Coalesce] Completed buffers per interrupt in manual mode.
+ * |units buffers
+ * |default 1
+ * |preview when(enum=moderation, "MANUAL")
+ *
+ * |param delay[IRQ Delay] The interrupt delay timer in manual mode.
+ * The engine interrupts after this idle time with completions pending.
+ * Zero disables the delay timer.
+ * |units us
+ * |default 0
+ * |preview when(enum=moderation, "MANUAL")
+ *
  * |factory /zynq/dma_sink(index)
+ * |setter setWaitPolicy(waitMode, spinTime)
+ * |setter setWaitBatch(waitBatch)
+ * |setter setModeration(moderation, coalesce, delay)
+ * |setter setWriteCombine(writeCombine)
  **********************************************************************/
 class ZyncDMASink : public Pothos::Block
 {
@@ -27,17 +95,72 @@ public:
     }
 
     ZyncDMASink(const size_t index):
-        _engine(std::shared_ptr<pzdud_t>(pzdud_create(index, PZDUD_MM2S), &pzdud_destroy))
+        _engine(std::shared_ptr<pzdud_t>(pzdud_create(index, PZDUD_MM2S), &pzdud_destroy)),
+        _waitBatch(1),
+        _allocFlags(0)
     {
         if (not _engine) throw Pothos::Exception("ZyncDMASink::pzdud_create()");
         this->setupInput(0, "", "ZyncDMASink"+std::to_string(index));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, setWaitPolicy));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, setWaitBatch));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, setModeration));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, getIrqRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, getIrqLatency));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, getRingRestarts));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASink, setWriteCombine));
+    }
+
+    void setWaitPolicy(const std::string &mode, const long spinTime)
+    {
+        pzdud_set_wait_policy(_engine.get(), parseZynqDMAWaitMode(mode), spinTime);
+    }
+
+    void setWaitBatch(const size_t waitBatch)
+    {
+        _waitBatch = waitBatch;
+    }
+
+    void setModeration(const std::string &mode, const size_t coalesce, const size_t delay)
+    {
+        const int ret = pzdud_set_moderation(_engine.get(), parseZynqDMAModerMode(mode), coalesce, delay);
+        if (ret != PZDUD_OK) throw Pothos::Exception("ZyncDMASink::pzdud_set_moderation()", std::to_string(ret));
+    }
+
+    //! The observed interrupts per second
+    unsigned long getIrqRate(void)
+    {
+        pzdud_moder_stats_t stats;
+        if (pzdud_get_moderation_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.irq_rate;
+    }
+
+    //! The estimated mean time from a completion to its interrupt in microseconds
+    unsigned long getIrqLatency(void)
+    {
+        pzdud_moder_stats_t stats;
+        if (pzdud_get_moderation_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.latency_us;
+    }
+
+    //! The in-place restarts of the ring after DMA errors since the module was loaded
+    unsigned long long getRingRestarts(void)
+    {
+        pzdud_stats_t stats;
+        if (pzdud_get_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.restarts;
+    }
+
+    void setWriteCombine(const bool writeCombine)
+    {
+        _allocFlags = writeCombine?PZDUD_ALLOC_WRITECOMBINE:0;
     }
 
     Pothos::BufferManager::Sptr getInputBufferManager(const std::string &, const std::string &domain)
     {
         if (domain.empty())
         {
-            return makeZynqDMABufferManager(_engine, PZDUD_MM2S);
+            _manager = makeZynqDMABufferManager(_engine, PZDUD_MM2S, _allocFlags);
+            return _manager;
         }
         throw Pothos::PortDomainError();
     }
@@ -46,27 +169,33 @@ public:
     {
         auto inPort = this->input(0);
 
+        //hand buffers released by the manager to the engine
+        flushZynqDMABufferManager(_manager);
+
         //check if a buffer is available
         if (inPort->elements() == 0) return;
 
-        //wait for completion on the head buffer
+        //wait for completion on a batch of buffers from the head,
+        //the following calls find the rest of the batch already complete
         const long timeout_us = this->workInfo().maxTimeoutNs/1000;
-        const int ret = pzdud_wait(_engine.get(), timeout_us);
-        if (ret == PZDUD_ERROR_TIMEOUT)
+        PzdudRing<PZDUD_MM2S> ring(_engine.get());
+        size_t numReady = 0;
+        const int ret = ring.wait(_waitBatch, timeout_us, numReady);
+        if (ret == PZDUD_ERROR_TIMEOUT and numReady == 0)
         {
             //got a timeout, yield so we can get called again
             return this->yield();
         }
 
         //some other kind of error from wait occurred:
-        else if (ret != PZDUD_OK)
+        else if (ret != PZDUD_OK and ret != PZDUD_ERROR_TIMEOUT)
         {
             throw Pothos::Exception("ZyncDMASink::pzdud_wait()", std::to_string(ret));
         }
 
         //acquire the head buffer and release its handle
         size_t length = 0; //length not used for MM2S
-        const int handle = pzdud_acquire(_engine.get(), &length);
+        const int handle = ring.acquire(length);
         if (handle < 0) throw Pothos::Exception("ZyncDMASink::pzdud_acquire()", std::to_string(handle));
         //the handle could be out of order, so we dont check its value
         //we assume that out of order buffers means that we waited on
@@ -78,6 +207,9 @@ public:
 
 private:
     std::shared_ptr<pzdud_t> _engine;
+    size_t _waitBatch;
+    int _allocFlags;
+    Pothos::BufferManager::Sptr _manager;
 };
 
 static Pothos::BlockRegistry registerZyncDMASink(
@@ -16,7 +16,86 @@
  * |param index[Engine Index] The index of an AXI DMA on the system
  * |default 0
  *
+ * |param waitMode[Wait Mode] The policy used to wait on DMA completions.
+ * Busy-polling trades CPU time for lower wake-up latency.
+ * <ul>
+ * <li>"IRQ" - sleep on the completion interrupt</li>
+ * <li>"HYBRID" - busy-poll for the spin time, then sleep on the interrupt</li>
+ * <li>"POLL" - busy-poll for the entire timeout</li>
+ * </ul>
+ * |default "IRQ"
+ * |option [Interrupt] "IRQ"
+ * |option [Hybrid] "HYBRID"
+ * |option [Poll] "POLL"
+ * |preview valid
+ *
+ * |param spinTime[Spin Time] The busy-poll time in hybrid mode.
+ * |units us
+ * |default 10
+ * |preview valid
+ *
+ * |param waitBatch[Wait Batch] The number of DMA completions to wait for.
+ * Larger batches wake the block once per batch rather than once per buffer,
+ * which saves system calls at high rates. When the stream pauses,
+ * a partial batch is handed off after the work timeout.
+ * |units buffers
+ * |default 1
+ * |preview valid
+ *
+ * |param cacheable[Cacheable] Map the DMA buffers with the CPU cache enabled.
+ * Cache maintenance is performed when buffers are acquired and released,
+ * so that downstream blocks read the received samples at full cache speed.
+ * The setting takes effect when the buffers are allocated on activation.
+ * |default false
+ * |option [Uncached] false
+ * |option [Cacheable] true
+ * |preview valid
+ *
+ * |param moderation[IRQ Moderation] The interrupt moderation of the DMA channel.
+ * Moderation lowers the interrupt rate at high rates on small buffers,
+ * at the cost of completion latency; see the getIrqRate() and
+ * getIrqLatency() calls for the observed trade-off.
+ * <ul>
+ * <li>"OFF" - one interrupt per completed buffer</li>
+ * <li>"ADAPTIVE" - tune the coalesce count and delay from the completion rate</li>
+ * <li>"MANUAL" - use the coalesce count and delay below</li>
+ * <li>"POLL" - mask the interrupt under load and poll in the kernel until the ring drains</li>
+ * </ul>
+ * |default "OFF"
+ * |option [Off] "OFF"
+ * |option [Adaptive] "ADAPTIVE"
+ * |option [Manual] "MANUAL"
+ * |option [Poll] "POLL"
+ * |preview valid
+ *
+ * |param coalesce[IRQ Coalesce] Completed buffers per interrupt in manual mode.
+ * |units buffers
+ * |default 1
+ * |preview when(enum=moderation, "MANUAL")
+ *
+ * |param delay[IRQ Delay] The interrupt delay timer in manual mode.
+ * The engine interrupts after this idle time with completions pending.
+ * Zero disables the delay timer.
+ * |units us
+ * |default 0
+ * |preview when(enum=moderation, "MANUAL")
+ *
+ * |param timeLabel[Time Label] Label each produced buffer with its completion time.
+ * The "rxTime" label holds the CLOCK_MONOTONIC time in nanoseconds
+ * at which the kernel observed the DMA completion,
+ * so that it excludes the scheduling delay before the block runs.
+ * A buffer acquired before the kernel observed its completion has no label.
+ * |default false
+ * |option [Off] false
+ * |option [On] true
+ * |preview valid
+ *
  * |factory /zynq/dma_source(index)
+ * |setter setWaitPolicy(waitMode, spinTime)
+ * |setter setWaitBatch(waitBatch)
+ * |setter setModeration(moderation, coalesce, delay)
+ * |setter setCacheable(cacheable)
+ * |setter setTimeLabel(timeLabel)
  **********************************************************************/
 class ZyncDMASource : public Pothos::Block
 {
@@ -27,17 +106,79 @@ public:
     }
 
     ZyncDMASource(const size_t index):
-        _engine(std::shared_ptr<pzdud_t>(pzdud_create(index, PZDUD_S2MM), &pzdud_destroy))
+        _engine(std::shared_ptr<pzdud_t>(pzdud_create(index, PZDUD_S2MM), &pzdud_destroy)),
+        _waitBatch(1),
+        _allocFlags(0),
+        _timeLabel(false)
     {
         if (not _engine) throw Pothos::Exception("ZyncDMASource::pzdud_create()");
         this->setupOutput(0, "", "ZyncDMASource"+std::to_string(index));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, setWaitPolicy));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, setWaitBatch));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, setModeration));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, getIrqRate));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, getIrqLatency));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, getRingRestarts));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, setCacheable));
+        this->registerCall(this, POTHOS_FCN_TUPLE(ZyncDMASource, setTimeLabel));
+    }
+
+    void setWaitPolicy(const std::string &mode, const long spinTime)
+    {
+        pzdud_set_wait_policy(_engine.get(), parseZynqDMAWaitMode(mode), spinTime);
+    }
+
+    void setWaitBatch(const size_t waitBatch)
+    {
+        _waitBatch = waitBatch;
+    }
+
+    void setModeration(const std::string &mode, const size_t coalesce, const size_t delay)
+    {
+        const int ret = pzdud_set_moderation(_engine.get(), parseZynqDMAModerMode(mode), coalesce, delay);
+        if (ret != PZDUD_OK) throw Pothos::Exception("ZyncDMASource::pzdud_set_moderation()", std::to_string(ret));
+    }
+
+    //! The observed interrupts per second
+    unsigned long getIrqRate(void)
+    {
+        pzdud_moder_stats_t stats;
+        if (pzdud_get_moderation_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.irq_rate;
+    }
+
+    //! The estimated mean time from a completion to its interrupt in microseconds
+    unsigned long getIrqLatency(void)
+    {
+        pzdud_moder_stats_t stats;
+        if (pzdud_get_moderation_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.latency_us;
+    }
+
+    //! The in-place restarts of the ring after DMA errors since the module was loaded
+    unsigned long long getRingRestarts(void)
+    {
+        pzdud_stats_t stats;
+        if (pzdud_get_stats(_engine.get(), &stats) != PZDUD_OK) return 0;
+        return stats.restarts;
+    }
+
+    void setCacheable(const bool cacheable)
+    {
+        _allocFlags = cacheable?PZDUD_ALLOC_CACHEABLE:0;
+    }
+
+    void setTimeLabel(const bool timeLabel)
+    {
+        _timeLabel = timeLabel;
     }
 
     Pothos::BufferManager::Sptr getOutputBufferManager(const std::string &, const std::string &domain)
     {
         if (domain.empty())
         {
-            return makeZynqDMABufferManager(_engine, PZDUD_S2MM);
+            _manager = makeZynqDMABufferManager(_engine, PZDUD_S2MM, _allocFlags);
+            return _manager;
         }
         throw Pothos::PortDomainError();
     }
@@ -46,39 +187,57 @@ public:
     {
         auto outPort = this->output(0);
 
+        //hand buffers released by the manager to the engine
+        flushZynqDMABufferManager(_manager);
+
         //check if a buffer is available
         if (outPort->elements() == 0) return;
 
-        //wait for completion on the head buffer
+        //wait for completion on a batch of buffers from the head,
+        //the following calls find the rest of the batch already complete
         const long timeout_us = this->workInfo().maxTimeoutNs/1000;
-        const int ret = pzdud_wait(_engine.get(), timeout_us);
-        if (ret == PZDUD_ERROR_TIMEOUT)
+        PzdudRing<PZDUD_S2MM> ring(_engine.get());
+        size_t numReady = 0;
+        const int ret = ring.wait(_waitBatch, timeout_us, numReady);
+        if (ret == PZDUD_ERROR_TIMEOUT and numReady == 0)
         {
             //got a timeout, yield so we can get called again
             return this->yield();
         }
 
         //some other kind of error from wait occurred:
-        else if (ret != PZDUD_OK)
+        else if (ret != PZDUD_OK and ret != PZDUD_ERROR_TIMEOUT)
         {
             throw Pothos::Exception("ZyncDMASource::pzdud_wait()", std::to_string(ret));
         }
 
         //acquire the head buffer and release its handle
         size_t length = 0;
-        const int handle = pzdud_acquire(_engine.get(), &length);
+        long long timeNs = 0;
+        bool kernelTime = false;
+        const int handle = _timeLabel?ring.acquire(length, timeNs, kernelTime):ring.acquire(length);
         if (handle < 0) throw Pothos::Exception("ZyncDMASource::pzdud_acquire()", std::to_string(handle));
         if (size_t(handle) != outPort->buffer().getManagedBuffer().getSlabIndex())
         {
             throw Pothos::Exception("ZyncDMASource::pzdud_acquire()", "out of order handle");
         }
 
-        //produce the buffer to the output port
+        //the descriptor in error comes back empty when the kernel restarts the ring:
+        //drop the buffer, and the manager hands it back to the engine
+        if (length == 0) return outPort->popBuffer(outPort->buffer().length);
+
+        //produce the buffer to the output port,
+        //the time of the acquire call would only be an upper bound
+        if (kernelTime) outPort->postLabel(Pothos::Label("rxTime", timeNs, 0));
         outPort->produce(length);
     }
 
 private:
     std::shared_ptr<pzdud_t> _engine;
+    size_t _waitBatch;
+    int _allocFlags;
+    bool _timeLabel;
+    Pothos::BufferManager::Sptr _manager;
 };
 
 static Pothos::BlockRegistry registerZyncDMASource(
@@ -4,7 +4,31 @@
 #pragma once
 #include <Pothos/Framework.hpp>
 #include "pothos_zynq_dma_driver.h"
+#include "pothos_zynq_dma_ring.hpp"
 #include <memory>
+#include <string>
 
-//! Factory for Zynq DMA buffer manager
-Pothos::BufferManager::Sptr makeZynqDMABufferManager(std::shared_ptr<pzdud_t> engine, const pzdud_dir_t dir);
+//! Factory for Zynq DMA buffer manager (flags are passed to pzdud_alloc_ex)
+Pothos::BufferManager::Sptr makeZynqDMABufferManager(std::shared_ptr<pzdud_t> engine, const pzdud_dir_t dir, const int allocFlags = 0);
+
+//! Release the buffers deferred by push/pop of a Zynq DMA buffer manager
+void flushZynqDMABufferManager(const Pothos::BufferManager::Sptr &manager);
+
+//! Convert a wait mode parameter string into the driver constant
+inline pzdud_wait_mode_t parseZynqDMAWaitMode(const std::string &mode)
+{
+    if (mode == "IRQ") return PZDUD_WAIT_IRQ;
+    if (mode == "HYBRID") return PZDUD_WAIT_HYBRID;
+    if (mode == "POLL") return PZDUD_WAIT_POLL;
+    throw Pothos::InvalidArgumentException("parseZynqDMAWaitMode("+mode+")", "unknown wait mode");
+}
+
+//! Convert an interrupt moderation parameter string into the driver constant
+inline pzdud_moder_mode_t parseZynqDMAModerMode(const std::string &mode)
+{
+    if (mode == "OFF") return PZDUD_MODER_OFF;
+    if (mode == "ADAPTIVE") return PZDUD_MODER_ADAPTIVE;
+    if (mode == "MANUAL") return PZDUD_MODER_MANUAL;
+    if (mode == "POLL") return PZDUD_MODER_POLL;
+    throw Pothos::InvalidArgumentException("parseZynqDMAModerMode("+mode+")", "unknown moderation mode");
+}
@@ -18,6 +18,9 @@
 #define PZDUD_ERROR_ALLOC -5 //!< error allocating DMA buffers
 #define PZDUD_ERROR_CLAIMED -6 //!< all buffers claimed by the user
 #define PZDUD_ERROR_COMPLETE -7 //!< no completed buffer transactions
+#define PZDUD_ERROR_CONFIG -8 //!< configuration rejected or not available
+#define PZDUD_ERROR_REMOVED -9 //!< the engine was removed from the device tree
+#define PZDUD_ERROR_BUSY -10 //!< the memory is still exported, subscribed, or in flight
 
 //! Direction constants to specify memory to/from stream
 typedef enum pzdud_dir
@@ -26,6 +29,116 @@ typedef enum pzdud_dir
     PZDUD_MM2S,
 } pzdud_dir_t;
 
+/*!
+ * Allocation flag for buffers mapped cacheable into userspace.
+ * Cache maintenance is performed automatically on acquire and release,
+ * CPU access to the buffer contents then runs at normal memory speed.
+ * This is mainly useful for the S2MM direction where data is read back.
+ */
+#define PZDUD_ALLOC_CACHEABLE (1 << 0)
+
+/*!
+ * Allocation flag for buffers mapped write-combining into userspace.
+ * Stores into the buffers are merged in the CPU's write buffer
+ * rather than being serialized, and a store barrier is issued
+ * before the buffers are handed to the engine on release.
+ * This is mainly useful for the MM2S direction where data is written.
+ */
+#define PZDUD_ALLOC_WRITECOMBINE (1 << 1)
+
+/*!
+ * Allocation flag for the SG table and all buffers in one slab.
+ * The ring is a single contiguous region mapped with one mmap,
+ * and each handle is a fixed offset into the slab.
+ * This reduces ring setup time and TLB pressure for large rings.
+ * The slab flag cannot be combined with PZDUD_ALLOC_CACHEABLE.
+ */
+#define PZDUD_ALLOC_SLAB (1 << 2)
+
+/*!
+ * Allocation flag for a kernel-managed SG table with fill and completion queues.
+ * Releases are written to a fill queue in shared memory and handed to the
+ * kernel with one system call per batch, which checks and loads them;
+ * completions are read from a completion queue that the interrupt handler
+ * fills. Userspace never touches the SG table or the tail register,
+ * and handles come back in the order that they were released.
+ * The queue flag cannot be combined with PZDUD_ALLOC_SLAB,
+ * and the ring cannot be persistent or subscribed, or send user memory.
+ */
+#define PZDUD_ALLOC_QUEUES (1 << 3)
+
+//! Wait policy constants for pzdud_wait()
+typedef enum pzdud_wait_mode
+{
+    PZDUD_WAIT_IRQ, //!< sleep on the completion interrupt (default)
+    PZDUD_WAIT_HYBRID, //!< busy-poll for a bounded time, then sleep
+    PZDUD_WAIT_POLL, //!< busy-poll for the entire timeout
+} pzdud_wait_mode_t;
+
+//! Outcome counters for calls to pzdud_wait()
+typedef struct pzdud_wait_stats
+{
+    unsigned long long ready; //!< completed on the initial check
+    unsigned long long spins; //!< completed while busy-polling
+    unsigned long long sleeps; //!< slept on the completion interrupt
+    unsigned long long timeouts; //!< returned with a timeout
+} pzdud_wait_stats_t;
+
+//! Interrupt moderation modes for pzdud_set_moderation()
+typedef enum pzdud_moder_mode
+{
+    PZDUD_MODER_OFF, //!< one interrupt per completion (default)
+    PZDUD_MODER_ADAPTIVE, //!< the kernel tunes coalesce and delay from the completion rate
+    PZDUD_MODER_MANUAL, //!< fixed coalesce count and delay timer
+    PZDUD_MODER_POLL, //!< mask the interrupt under load and poll in the kernel until the ring drains
+} pzdud_moder_mode_t;
+
+//! Interrupt moderation state from the kernel, updated about every millisecond
+typedef struct pzdud_moder_stats
+{
+    size_t coalesce; //!< the current completions per interrupt
+    size_t delay_us; //!< the current delay timer in microseconds (0 = disabled)
+    unsigned long irq_rate; //!< interrupts per second
+    unsigned long completion_rate; //!< completions per second
+    unsigned long latency_us; //!< estimated mean time from a completion to its interrupt
+    unsigned long poll_count; //!< kernel polling passes with the interrupt masked
+    unsigned long poll_entries; //!< switches from interrupts to polling
+    unsigned long long irq_mode_us; //!< time spent with the interrupt unmasked
+    unsigned long long poll_mode_us; //!< time spent with the interrupt masked and polling
+} pzdud_moder_stats_t;
+
+//! Channel statistics from the kernel, accumulated from module load
+typedef struct pzdud_stats
+{
+    unsigned long long bytes; //!< bytes transferred by completed descriptors
+    unsigned long long completions; //!< descriptors completed
+    unsigned long long irq_count; //!< interrupts handled
+    unsigned long long wait_calls; //!< kernel wait calls
+    unsigned long long wait_timeouts; //!< kernel wait calls which timed out
+    size_t occupancy_max; //!< high-water mark of completions not yet acquired
+    unsigned int errors; //!< sticky DMASR error bits
+    unsigned long long idle_us; //!< microseconds since the last completion (0 before the first)
+    unsigned long long pool_bytes; //!< bytes held from the engine's reserved-memory pool (0 without a pool)
+    unsigned long long error_irqs; //!< DMA error interrupts (the cause is in errors)
+    unsigned long long restarts; //!< in-place restarts of the ring after a DMA error on either channel
+} pzdud_stats_t;
+
+//! Lag policies for pzdud_subscribe()
+typedef enum pzdud_lag_policy
+{
+    PZDUD_LAG_BLOCK, //!< the owner holds back its releases until the subscriber releases
+    PZDUD_LAG_DROP, //!< the owner releases freely, the subscriber skips what it missed
+} pzdud_lag_policy_t;
+
+//! Subscriber counters, see pzdud_sub_get_stats()
+typedef struct pzdud_sub_stats
+{
+    unsigned long delivered; //!< buffers acquired since the subscription
+    unsigned long dropped; //!< completions skipped because the owner released them first
+    unsigned long overruns; //!< buffers the owner released while the subscriber held them
+    size_t lag; //!< completions not yet released by the subscriber
+} pzdud_sub_stats_t;
+
 //! opaque struct for dma driver instance
 struct pzdud;
 typedef struct pzdud pzdud_t;
@@ -34,7 +147,7 @@ typedef struct pzdud pzdud_t;
  * Create a new user DMA instance.
  * The instance represents a single DMA channel
  * given the engine index and the channel direction.
- * \param engine_no the index of an AXI DMA in the device tree
+ * \param engine_no the index of an AXI DMA: the N of /dev/pothos_zynq_dmaN
  * \param direction the direction to/from stream
  * \return the user dma instance structure or NULL on error
  */
@@ -61,21 +174,66 @@ static inline int pzdud_reset(pzdud_t *self);
 /*!
  * Allocate buffers and setup the scatter/gather table.
  * Call pzdud_alloc before initializing the engine.
+ * The allocation is refused while subscribers still map the ring
+ * of the previous owner of the channel, see pzdud_subscribe().
  * \param self the user dma instance structure
  * \param num_buffs the number of buffers in the table
  * \param buff_size the size of the buffers in bytes
- * \return the error code or 0 for success
+ * \return the error code or 0 for success, PZDUD_ERROR_BUSY when refused
  */
 static inline int pzdud_alloc(pzdud_t *self, const size_t num_buffs, const size_t buff_size);
 
+/*!
+ * Allocate buffers and setup the scatter/gather table with flags.
+ * This is pzdud_alloc() with additional allocation options.
+ * \param self the user dma instance structure
+ * \param num_buffs the number of buffers in the table
+ * \param buff_size the size of the buffers in bytes
+ * \param flags a bitwise OR of PZDUD_ALLOC_* flags or 0
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_alloc_ex(pzdud_t *self, const size_t num_buffs, const size_t buff_size, const int flags);
+
 /*!
  * Free buffers allocated by pzdud_alloc.
  * Only call pzdud_free when the engine is halted.
+ * The free is refused while a dma-buf export is open or a subscriber
+ * maps the ring, and the allocation stays mapped and usable.
+ * Once the kernel accepts the free, new subscribers are refused
+ * until the ring is reset, so the free cannot be refused afterwards.
  * \param self the user dma instance structure
- * \return the error code or 0 for success
+ * \return the error code or 0 for success, PZDUD_ERROR_BUSY when refused
  */
 static inline int pzdud_free(pzdud_t *self);
 
+/*!
+ * Keep the ring running after the instance is destroyed or the process exits.
+ * The kernel keeps the buffers, the SG table, and the completion tracking,
+ * and a later instance on the same engine and direction calls pzdud_attach()
+ * to continue from the same ring. The engine keeps completing the buffers
+ * handed to it in the meantime, so the stream has no gap as long as the ring
+ * covers the restart. Registered user memory is never kept: closing with
+ * a region registered frees the ring like a ring which is not persistent.
+ * pzdud_free() ends the persistence.
+ * \param self the user dma instance structure
+ * \param enable true to keep the ring, false to free it on close again
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_persist(pzdud_t *self, const bool enable);
+
+/*!
+ * Attach to the ring of a persistent channel, instead of pzdud_alloc() and pzdud_init().
+ * The head and tail of the ring are recovered from the status and control pages.
+ * The buffers held by the previous process come back to the head in order:
+ * S2MM buffers are acquired again with their samples, and the buffers
+ * the previous process released out of order are acquired with a zero length.
+ * The acquire count is published after each acquire, so a buffer may be
+ * acquired twice across a crash, but no completed buffer is lost.
+ * \param self the user dma instance structure
+ * \return the error code or 0 for success, PZDUD_ERROR_CONFIG without a persistent ring
+ */
+static inline int pzdud_attach(pzdud_t *self);
+
 /*!
  * Get the address of a buffer for the given handle.
  * This is a virtual userspace address that can be read/written.
@@ -116,10 +274,115 @@ static inline int pzdud_halt(pzdud_t *self);
  * \param self the user dma instance structure
  * \param timeout_us the timeout in microseconds
  *
- * \return the error code for timeout or 0 for success
+ * \return the error code for timeout or 0 for success,
+ * and the other error codes of pzdud_wait_n()
  */
 static inline int pzdud_wait(pzdud_t *self, const long timeout_us);
 
+/*!
+ * Wait for a batch of DMA buffers to become available.
+ * This is pzdud_wait() with a minimum number of completed buffers,
+ * so that a caller at high rates wakes once per batch rather than per buffer.
+ * The number of completed buffers is reported even on timeout,
+ * so the caller may choose to acquire a partial batch.
+ * \param self the user dma instance structure
+ * \param min_num the number of completed buffers to wait for
+ * (clipped to the number of buffers that are not claimed)
+ * \param timeout_us the timeout in microseconds
+ * \param [out] num_ready the number of completed buffers past the head (optional)
+ *
+ * \return the error code for timeout, PZDUD_ERROR_REMOVED when the engine
+ * was removed from the device tree, PZDUD_ERROR_CONFIG when the kernel
+ * rejected the wait, or 0 for success
+ */
+static inline int pzdud_wait_n(pzdud_t *self, size_t min_num, const long timeout_us, size_t *num_ready);
+
+/*!
+ * Configure the policy used by pzdud_wait().
+ * Busy-polling trades CPU time for wake-up latency:
+ * PZDUD_WAIT_IRQ always sleeps on the completion interrupt,
+ * PZDUD_WAIT_HYBRID polls for up to spin_us before sleeping,
+ * PZDUD_WAIT_POLL polls for the entire timeout and never sleeps.
+ * \param self the user dma instance structure
+ * \param mode the wait mode
+ * \param spin_us the busy-poll time in microseconds (hybrid mode),
+ * where a negative time is taken as zero
+ */
+static inline void pzdud_set_wait_policy(pzdud_t *self, const pzdud_wait_mode_t mode, const long spin_us);
+
+/*!
+ * Get the outcome counters for all calls to pzdud_wait().
+ * \param self the user dma instance structure
+ * \param [out] stats the wait statistics
+ */
+static inline void pzdud_get_wait_stats(pzdud_t *self, pzdud_wait_stats_t *stats);
+
+/*!
+ * Get the file descriptor of the channel for poll(), select(), or epoll.
+ * This allows one thread to wait on many channels in an external event loop.
+ * The descriptor is readable (POLLIN) when S2MM buffers are available to acquire,
+ * and writable (POLLOUT) when MM2S buffers are available to acquire.
+ * POLLERR indicates a DMA error which halted the channel (see pzdud_restarts()
+ * for the errors that the kernel recovered from), or a channel that cannot be polled:
+ * polling requires an interrupt and a ring of at least two buffers.
+ * Readiness is level-triggered: acquire the available buffers before polling again.
+ * \param self the user dma instance structure
+ * \return the file descriptor (owned by the instance)
+ */
+static inline int pzdud_fd(pzdud_t *self);
+
+/*!
+ * Configure the interrupt moderation for the channel.
+ * By default, the engine interrupts on every completion,
+ * which can saturate a core at high rates on small buffers.
+ * With moderation, the engine interrupts once per coalesce completions,
+ * or when the delay timer expires with completions pending,
+ * trading completion latency for a lower interrupt rate.
+ * With poll moderation, the kernel masks the interrupt after a completion
+ * and polls for completions from the interrupt thread until the ring drains,
+ * so a busy channel takes about one interrupt per burst.
+ * The setting takes effect immediately and is restored by pzdud_init().
+ * \param self the user dma instance structure
+ * \param mode the moderation mode
+ * \param coalesce the completions per interrupt (manual mode, 1 to 255)
+ * \param delay_us the delay timer in microseconds (manual mode, 0 to disable)
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_set_moderation(pzdud_t *self, const pzdud_moder_mode_t mode, const size_t coalesce, const size_t delay_us);
+
+/*!
+ * Get the interrupt moderation state and the observed rates.
+ * Return PZDUD_ERROR_CONFIG when the channel has no status page.
+ * \param self the user dma instance structure
+ * \param [out] stats the moderation statistics
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_get_moderation_stats(pzdud_t *self, pzdud_moder_stats_t *stats);
+
+/*!
+ * Get the channel statistics from the kernel module.
+ * The counters are shared by every user of the channel since the
+ * module was loaded, and are also shown in debugfs under pothos_zynq_dma/.
+ * Unlike pzdud_get_wait_stats(), this makes a system call.
+ * \param self the user dma instance structure
+ * \param [out] stats the channel statistics
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_get_stats(pzdud_t *self, pzdud_stats_t *stats);
+
+/*!
+ * Get the number of ring restarts since the last call (or pzdud_init()).
+ * On a DMA error, the kernel resets the engine and restarts both channels
+ * in place: the descriptor in error (and the rest of its MM2S packet) is
+ * acquired with a zero length, and the other buffers keep their place.
+ * A packet in flight on the other channel of the engine may be cut short.
+ * The error cause is in the errors of pzdud_get_stats().
+ * This reads the status page and does not make a system call.
+ * \param self the user dma instance structure
+ * \return the number of restarts (0 without a status page)
+ */
+static inline size_t pzdud_restarts(pzdud_t *self);
+
 /*!
  * Acquire a DMA buffer from the engine.
  * The length value has the number of bytes filled by the transfer.
@@ -133,6 +396,41 @@ static inline int pzdud_wait(pzdud_t *self, const long timeout_us);
  */
 static inline int pzdud_acquire(pzdud_t *self, size_t *length);
 
+/*!
+ * Acquire a DMA buffer from the engine with its completion time.
+ * The time is CLOCK_MONOTONIC in nanoseconds, recorded by the kernel
+ * when its interrupt handler counted the descriptor as completed,
+ * so that it excludes the scheduling delay before this call.
+ * When the buffer is acquired before the kernel counted it
+ * (by busy-polling ahead of the interrupt), the time of this call
+ * is reported instead, which is then the closer bound,
+ * and kernel_time tells the two apart.
+ *
+ * \param self the user dma instance structure
+ * \param [out] length the buffer length in bytes
+ * \param [out] time_ns the completion time in nanoseconds
+ * \param [out] kernel_time true when the time was recorded by the kernel
+ * \return the handle or negative error code
+ */
+static inline int pzdud_acquire_ts(pzdud_t *self, size_t *length, long long *time_ns, bool *kernel_time);
+
+/*!
+ * Acquire all completed DMA buffers from the engine in one batch.
+ * The completion state is determined from a single read of the
+ * channel's current descriptor register rather than per-buffer checks.
+ * Return PZDUD_ERROR_COMPLETE when there are no completed transactions.
+ * Return PZDUD_ERROR_CLAIMED when the user has acquired all buffers.
+ * Otherwise return the number of handles written to the arrays,
+ * in the same order that pzdud_acquire() would have returned them.
+ *
+ * \param self the user dma instance structure
+ * \param [out] handles an array of at least max_num handles
+ * \param [out] lengths an array of at least max_num lengths in bytes
+ * \param max_num the maximum number of buffers to acquire
+ * \return the number of buffers acquired or negative error code
+ */
+static inline int pzdud_acquire_many(pzdud_t *self, size_t *handles, size_t *lengths, const size_t max_num);
+
 /*!
  * Release a DMA buffer back the engine.
  * Returns immediately, no errors.
@@ -142,10 +440,175 @@ static inline int pzdud_acquire(pzdud_t *self, size_t *length);
  */
 static inline void pzdud_release(pzdud_t *self, size_t handle, size_t length);
 
+/*!
+ * Release a list of DMA buffers back the engine.
+ * The descriptors for all handles are updated first,
+ * and then the tail descriptor register is written once.
+ * With PZDUD_ALLOC_QUEUES, the handles go to the fill queue
+ * and the kernel is kicked once for the list instead.
+ * Returns immediately, no errors.
+ * With subscribers under PZDUD_LAG_BLOCK, the buffers which a subscriber
+ * has not released yet are handed to the engine by a later release;
+ * a release of zero handles retries them.
+ * \param self the user dma instance structure
+ * \param handles an array of handle values from acquire results
+ * \param lengths an array of lengths in bytes to submit (MM2S only, may be NULL for S2MM)
+ * \param num the number of handles in the array
+ */
+static inline void pzdud_release_many(pzdud_t *self, const size_t *handles, const size_t *lengths, const size_t num);
+
+/*!
+ * Register application memory for zero-copy transfers.
+ * The kernel pins the pages of the range and maps them for the channel,
+ * so that pzdud_submit_umem() can transfer directly out of the memory
+ * without a copy into a DMA buffer. The memory can come from anywhere
+ * in the process: the heap, hugepages, or a mapped file.
+ * The pages stay pinned until unregistered or the channel is closed.
+ * \param self the user dma instance structure
+ * \param addr the start of the memory
+ * \param bytes the length of the memory in bytes
+ * \return a region handle or negative error code
+ */
+static inline int pzdud_umem_register(pzdud_t *self, void *addr, const size_t bytes);
+
+/*!
+ * Unregister memory from pzdud_umem_register().
+ * The kernel refuses while a submitted descriptor which the engine
+ * has not completed points into the memory, and the region stays registered.
+ * \param self the user dma instance structure
+ * \param region the region handle from registration
+ * \return the error code or 0 for success, PZDUD_ERROR_BUSY with transfers in flight
+ */
+static inline int pzdud_umem_unregister(pzdud_t *self, const int region);
+
+/*!
+ * Submit a transfer out of registered memory to the engine (MM2S only).
+ * The transfer is a single packet which takes one descriptor
+ * per physically contiguous segment of the range, starting at the head.
+ * The descriptors come back from pzdud_acquire() in order once sent,
+ * and the memory may be modified again once the last one is acquired.
+ * Without the data realignment engine, the offset must be aligned
+ * to the stream width of the engine. The call acquires and releases,
+ * so it must not run concurrently with either on another thread.
+ * Return PZDUD_ERROR_CLAIMED or PZDUD_ERROR_COMPLETE when there are
+ * not enough descriptors available to acquire for the transfer,
+ * and PZDUD_ERROR_CONFIG for a ring with PZDUD_ALLOC_QUEUES.
+ *
+ * \param self the user dma instance structure
+ * \param region the region handle from registration
+ * \param offset the offset of the transfer into the region in bytes
+ * \param length the length of the transfer in bytes
+ * \return the number of descriptors used or negative error code
+ */
+static inline int pzdud_submit_umem(pzdud_t *self, const int region, const size_t offset, const size_t length);
+
+/*!
+ * Export a DMA buffer as a dma-buf file descriptor.
+ * Other drivers import the file descriptor to consume or produce
+ * the buffer contents in place, and the dma-buf sync ioctl performs
+ * the cache maintenance for cacheable buffers.
+ * The buffers stay allocated while any export remains open,
+ * and pzdud_free() fails until the exports are closed.
+ * A buffer from PZDUD_ALLOC_SLAB may not start on a page: its export
+ * can be imported but not mapped with mmap(), export the slab instead.
+ * \param self the user dma instance structure
+ * \param handle the handle of the DMA buffer
+ * \return the file descriptor or negative error code
+ */
+static inline int pzdud_dmabuf_export(pzdud_t *self, const size_t handle);
+
+/*!
+ * Export the entire slab as a dma-buf file descriptor.
+ * This requires the allocation flag PZDUD_ALLOC_SLAB.
+ * Each handle is at the offset of its buffer in the slab,
+ * and the SG table is at the start of the slab.
+ * \param self the user dma instance structure
+ * \return the file descriptor or negative error code
+ */
+static inline int pzdud_dmabuf_export_slab(pzdud_t *self);
+
+/*!
+ * Import a dma-buf from another driver as a registered region.
+ * The region is used with pzdud_submit_umem() to transmit the buffer,
+ * and each submit waits for the exclusive fence of the buffer
+ * so that the engine reads what the producer finished writing.
+ * \param self the user dma instance structure
+ * \param fd the dma-buf file descriptor (the caller keeps ownership)
+ * \return a region handle or negative error code
+ */
+static inline int pzdud_dmabuf_import(pzdud_t *self, const int fd);
+
+/*!
+ * Subscribe read-only to the S2MM ring of another process.
+ * Only one process owns a channel, but other processes can read the
+ * same completions in place: the subscriber maps the owner's buffers
+ * read-only and acquires the completions in the same order as the owner.
+ * Under PZDUD_LAG_BLOCK, the owner holds back its releases of the buffers
+ * the subscriber has not released yet, and the engine stalls when the
+ * subscriber falls a ring behind. Under PZDUD_LAG_DROP, the owner never
+ * waits, and the subscriber skips the completions that it missed.
+ * The owner must have initialized the ring with pzdud_init(), and cannot
+ * initialize it again while it has subscribers. A ring whose owner exits
+ * is halted and stays allocated until the last subscriber is destroyed:
+ * the subscribers can acquire what was completed, then pzdud_sub_wait()
+ * returns PZDUD_ERROR_REMOVED, and the next owner cannot allocate until then.
+ * Use pzdud_destroy() on the subscriber; the other calls are for the owner.
+ * \param engine_no the index of an AXI DMA: the N of /dev/pothos_zynq_dmaN
+ * \param policy what the owner does when the subscriber lags behind
+ * \return the subscriber instance or NULL on error
+ */
+static inline pzdud_t *pzdud_subscribe(const size_t engine_no, const pzdud_lag_policy_t policy);
+
+/*!
+ * Wait for a completion that the subscriber has not acquired yet.
+ * The wait sleeps on the completion interrupt like pzdud_wait(),
+ * with the same microsecond timeout.
+ * \param self the subscriber instance
+ * \param timeout_us the timeout in microseconds
+ * \return the error code for timeout, PZDUD_ERROR_REMOVED when the engine
+ * was removed from the device tree or the owner exited,
+ * PZDUD_ERROR_CONFIG when the kernel rejected the wait, or 0 for success
+ */
+static inline int pzdud_sub_wait(pzdud_t *self, const long timeout_us);
+
+/*!
+ * Acquire the next completion as a subscriber.
+ * The handle and its buffer are the same as the owner's, read-only,
+ * and the length is the one the kernel counted for the completion.
+ * Completions that the owner already handed back to the engine
+ * are skipped and counted as dropped.
+ * Return PZDUD_ERROR_COMPLETE when there are no new completions.
+ * \param self the subscriber instance
+ * \param [out] length the buffer length in bytes
+ * \return the handle or negative error code
+ */
+static inline int pzdud_sub_acquire(pzdud_t *self, size_t *length);
+
+/*!
+ * Release the oldest buffer acquired by the subscriber.
+ * Under PZDUD_LAG_BLOCK, this lets the owner hand the buffer back to the engine.
+ * Under PZDUD_LAG_DROP, the owner may have done so already while the buffer was
+ * held, and the engine may have overwritten the contents that were read:
+ * the release reports this as an overrun.
+ * \param self the subscriber instance
+ * \return 1 when the buffer was overrun, 0 when not, or negative error code
+ */
+static inline int pzdud_sub_release(pzdud_t *self);
+
+/*!
+ * Get the counters of the subscriber.
+ * The same counters are shown in debugfs for the owner's channel.
+ * \param self the subscriber instance
+ * \param [out] stats the subscriber statistics
+ * \return the error code or 0 for success
+ */
+static inline int pzdud_sub_get_stats(pzdud_t *self, pzdud_sub_stats_t *stats);
+
 /*!
  * Write a user application field to the SG table.
  * These values will be output in the control stream.
  * This call only applies to the MM2S direction.
+ * With PZDUD_ALLOC_QUEUES, they go out with the next release of the handle.
  * \param self the user dma instance structure
  * \param handle the handle for a specific SG entry
  * \param which which application field 0 to 4
@@ -157,6 +620,7 @@ static inline void pzdud_set_app_field(pzdud_t *self, size_t handle, size_t whic
  * Read a user application field from the SG table.
  * These values will be input from the status stream.
  * This call only applies to the S2MM direction.
+ * With PZDUD_ALLOC_QUEUES, they are the ones of the handle's last completion.
  * \param self the user dma instance structure
  * \param handle the handle for a specific SG entry
  * \param which which application field 0 to 4
@@ -176,6 +640,8 @@ static inline uint32_t pzdud_get_app_field(pzdud_t *self, size_t handle, size_t
 #include <unistd.h> //close
 #include <stdlib.h>
 #include <string.h>
+#include <time.h> //clock_gettime
+#include <errno.h>
 
 /***********************************************************************
  * Definition for instance data
@@ -200,12 +666,57 @@ struct pzdud
     size_t buff_size;
     pothos_zynq_dma_alloc_t allocs;
 
-    //! buffer tracking
-    size_t head_index;
-    size_t tail_index;
-    size_t num_acquired;
+    //! buffer tracking as a single-producer/single-consumer ring:
+    //! the head is owned by the thread calling wait/acquire,
+    //! the tail is owned by the thread calling release,
+    //! and the counts hand off buffer ownership between them
+    size_t head_index; //!< next descriptor to acquire
+    size_t tail_index; //!< next descriptor to submit to the engine
+    size_t head_count; //!< total buffers acquired (written by acquire thread)
+    size_t tail_count; //!< total buffers submitted (written by release thread)
 
     xilinx_dma_desc_t *sgtable;
+
+    //! mapped completion status page (NULL when unavailable)
+    const pothos_zynq_dma_status_t *status;
+
+    //! mapped control page for poll() (NULL when unavailable)
+    pothos_zynq_dma_ctrl_t *ctrl;
+    uint32_t restarts_seen; //!< the restarts on the status page at the last pzdud_restarts()
+
+    //! mapped completion timestamps by handle (NULL when unavailable)
+    const pothos_zynq_dma_time_t *times;
+
+    //! mapped completed lengths by handle, after the timestamps (NULL when unavailable)
+    const uint32_t *lengths;
+
+    //! subscribers to an S2MM ring: the owner reads every cursor, and a subscriber
+    //! writes its own; a subscriber's head and tail are its acquire and release counts
+    const char *cursors; //!< mapped subscriber buffer for the owner (NULL when unavailable)
+    size_t cursor_stride; //!< bytes between the cursors of consecutive slots
+    bool subscriber; //!< the instance is from pzdud_subscribe()
+    size_t sub_slot; //!< the slot of the subscriber
+    pothos_zynq_dma_cursor_t *cursor; //!< mapped cursor of the subscriber
+    size_t sub_stale; //!< held buffers that were overrun when the subscriber skipped ahead
+
+    //! wait policy
+    pzdud_wait_mode_t wait_mode;
+    long spin_us;
+    pzdud_wait_stats_t wait_stats;
+
+    //! interrupt moderation
+    pothos_zynq_dma_moder_t moder;
+
+    //! registered user memory by handle (segs is NULL when the slot is free)
+    pothos_zynq_dma_umem_t umems[POTHOS_ZYNQ_DMA_UMEM_MAX];
+    bool umem_submitted; //!< descriptors may point outside of the DMA buffers
+
+    //! kernel-managed SG table (fillq is NULL otherwise): the head index is the
+    //! completion queue position, the tail index is the fill queue position
+    pothos_zynq_dma_queue_t *fillq; //!< mapped fill queue
+    pothos_zynq_dma_queue_t *compq; //!< mapped completion queue
+    size_t fill_pending; //!< fill entries written after the tail and not published
+    uint32_t *queue_app; //!< the app fields of each handle, 5 per handle
 };
 
 /***********************************************************************
@@ -213,20 +724,599 @@ struct pzdud
  **********************************************************************/
 static inline void __pzdud_write32(void *addr, uint32_t val)
 {
+    #ifdef PZDUD_MMIO_WRITE_HOOK
+    PZDUD_MMIO_WRITE_HOOK(addr, val);
+    #endif
     volatile uint32_t *p = (volatile uint32_t *)(addr);
     *p = val;
 }
 
-static inline uint32_t __pzdud_read32(void *addr)
-{
-    volatile uint32_t *p = (volatile uint32_t *)(addr);
-    return *p;
-}
+static inline int __pzdud_ioctl(int fd, unsigned long request, void *arg)
+{
+    #ifdef PZDUD_IOCTL_HOOK
+    return PZDUD_IOCTL_HOOK(fd, request, arg);
+    #else
+    return ioctl(fd, request, arg);
+    #endif
+}
+
+static inline uint32_t __pzdud_read32(void *addr)
+{
+    volatile uint32_t *p = (volatile uint32_t *)(addr);
+    return *p;
+}
+
+static inline size_t __pzdud_virt_to_phys(void *virt, const pothos_zynq_dma_buff_t *buff)
+{
+    size_t offset = (size_t)virt - (size_t)buff->uaddr;
+    return offset + buff->paddr;
+}
+
+static inline void *__pzdud_phys_to_virt(const size_t paddr, const pothos_zynq_dma_buff_t *buff)
+{
+    return ((char *)buff->uaddr) + (paddr - buff->paddr);
+}
+
+static inline size_t __pzdud_phys_to_index(pzdud_t *self, const size_t paddr)
+{
+    return (paddr - self->allocs.sgbuff.paddr)/sizeof(xilinx_dma_desc_t);
+}
+
+static inline long long __pzdud_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+static inline long long __pzdud_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+static inline size_t __pzdud_load_acquire(const size_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void __pzdud_store_release(size_t *p, const size_t val)
+{
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+//! The number of completions past the head from the status page (acquire thread only).
+//! The page may lag behind descriptors that were already acquired by checking their status.
+static inline size_t __pzdud_num_ready(pzdud_t *self)
+{
+    if (self->status == NULL) return 0;
+    const uint32_t completed = __atomic_load_n(&self->status->completed, __ATOMIC_ACQUIRE);
+    const int32_t num = (int32_t)(completed - (uint32_t)self->head_count);
+    return (num > 0)?(size_t)num:0;
+}
+
+//! Publish the acquired count to the control page for poll()
+static inline void __pzdud_publish_head(pzdud_t *self)
+{
+    if (self->ctrl == NULL) return;
+    __atomic_store_n(&self->ctrl->acquired, (uint32_t)self->head_count, __ATOMIC_RELAXED);
+}
+
+//! Publish the submitted count to the control page for the next user of a persistent ring
+static inline void __pzdud_publish_tail(pzdud_t *self, const size_t tail_count)
+{
+    if (self->ctrl == NULL) return;
+    __atomic_store_n(&self->ctrl->released, (uint32_t)tail_count, __ATOMIC_RELAXED);
+}
+
+//! The cursor of a subscriber slot, as mapped by the owner
+static inline const pothos_zynq_dma_cursor_t *__pzdud_cursor(pzdud_t *self, const size_t slot)
+{
+    return (const pothos_zynq_dma_cursor_t *)(self->cursors + slot*self->cursor_stride);
+}
+
+//! Limit a range of releases to the completions that every blocking subscriber released (release thread only)
+static inline size_t __pzdud_sub_limit(pzdud_t *self, size_t num)
+{
+    if (self->status == NULL || self->cursors == NULL) return num;
+    uint32_t mask = __atomic_load_n(&self->status->sub_block_mask, __ATOMIC_ACQUIRE);
+    while (mask != 0 && num != 0)
+    {
+        const pothos_zynq_dma_cursor_t *cursor = __pzdud_cursor(self, (size_t)__builtin_ctz(mask));
+        const int32_t avail = (int32_t)(__atomic_load_n(&cursor->released, __ATOMIC_ACQUIRE) - (uint32_t)self->tail_count);
+        if (avail <= 0) num = 0;
+        else if ((size_t)avail < num) num = (size_t)avail;
+        mask &= mask - 1;
+    }
+    return num;
+}
+
+//! The entry of a fill or completion queue at a position
+static inline pothos_zynq_dma_queue_entry_t *__pzdud_queue_entry(pothos_zynq_dma_queue_t *queue, const size_t index)
+{
+    return (pothos_zynq_dma_queue_entry_t *)(queue + 1) + index;
+}
+
+//! The completion time of the head descriptor, when the status page counts it (acquire thread only)
+static inline bool __pzdud_head_time(pzdud_t *self, long long *time_ns)
+{
+    if (self->times == NULL || __pzdud_num_ready(self) == 0) return false;
+    const size_t handle = (self->compq != NULL)?__pzdud_queue_entry(self->compq, self->head_index)->handle:self->head_index;
+    *time_ns = (long long)self->times[handle];
+    return true;
+}
+
+//! Count the completed buffers from the head (status page first, then the descriptors)
+static inline size_t __pzdud_num_done(pzdud_t *self, const size_t max_num)
+{
+    size_t num = __pzdud_num_ready(self);
+    if (num >= max_num) return max_num;
+    if (self->compq != NULL) return num;
+    size_t index = self->head_index + num;
+    if (index >= self->num_buffs) index -= self->num_buffs;
+    while (num < max_num && (self->sgtable[index].status & (1 << 31)) != 0)
+    {
+        num++;
+        if (++index == self->num_buffs) index = 0;
+    }
+    return num;
+}
+
+static inline bool __pzdud_spin(pzdud_t *self, const size_t min_num, const long spin_us)
+{
+    const long long exit_us = __pzdud_time_us() + spin_us;
+    do
+    {
+        if (__pzdud_num_done(self, min_num) == min_num) return true;
+    }
+    while (__pzdud_time_us() < exit_us);
+    return __pzdud_num_done(self, min_num) == min_num;
+}
+
+//! The number of buffers owned by the user (acquire thread only)
+static inline size_t __pzdud_num_claimed(pzdud_t *self)
+{
+    return self->head_count - __pzdud_load_acquire(&self->tail_count);
+}
+
+//! Cache maintenance over a range of handles (cacheable buffers only)
+static inline void __pzdud_sync(pzdud_t *self, const unsigned long cmd, const size_t handle, const size_t num)
+{
+    if ((self->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) == 0) return;
+    pothos_zynq_dma_sync_t sync_args;
+    sync_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    sync_args.handle = handle;
+    sync_args.num_buffs = num;
+    if (__pzdud_ioctl(self->fd, cmd, (void *)&sync_args) != 0) perror("pzdud::ioctl(sync)");
+}
+
+//! Order buffer and descriptor stores before the engine hand-off
+static inline void __pzdud_release_fence(pzdud_t *self)
+{
+    if ((self->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE) == 0)
+    {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return;
+    }
+
+    //write-combined stores must drain to memory before the doorbell,
+    //which takes a full store barrier rather than an inner-shareable one
+    #if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__ ("dsb st" ::: "memory");
+    #elif defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("sfence" ::: "memory");
+    #else
+    __sync_synchronize();
+    #endif
+}
+
+//! Write a fill entry after the tail, the kick hands it to the kernel (release thread only)
+static inline void __pzdud_queue_fill(pzdud_t *self, size_t handle, size_t length)
+{
+    size_t index = self->tail_index + self->fill_pending++;
+    if (index >= self->num_buffs) index -= self->num_buffs;
+    pothos_zynq_dma_queue_entry_t *entry = __pzdud_queue_entry(self->fillq, index);
+    entry->handle = (uint32_t)handle;
+    entry->length = (self->direction == PZDUD_S2MM)?0:(uint32_t)length;
+    entry->status = 0;
+    if (handle < self->num_buffs) memcpy(entry->app, self->queue_app + handle*5, sizeof(entry->app));
+}
+
+//! Publish the fill entries and kick the kernel once for the batch (release thread only)
+static inline void __pzdud_queue_kick(pzdud_t *self)
+{
+    //a release of zero handles retries the entries that the kernel has not loaded
+    const size_t num = self->fill_pending;
+    if (num == 0 && __atomic_load_n(&self->fillq->consumer, __ATOMIC_ACQUIRE) != (uint32_t)self->tail_count)
+    {
+        if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_KICK, NULL) < 0) perror("pzdud::ioctl(kick)");
+    }
+    if (num == 0) return;
+    self->fill_pending = 0;
+    self->tail_index = (self->tail_index + num) % self->num_buffs;
+
+    //buffer contents and entries are ordered before the producer count,
+    //the kernel syncs cacheable buffers as it loads them
+    __pzdud_release_fence(self);
+    const size_t tail_count = self->tail_count + num;
+    __atomic_store_n(&self->fillq->producer, (uint32_t)tail_count, __ATOMIC_RELEASE);
+    __pzdud_publish_tail(self, tail_count);
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_KICK, NULL) < 0) perror("pzdud::ioctl(kick)");
+    __pzdud_store_release(&self->tail_count, tail_count);
+}
+
+//! Take completion entries from the head of the completion queue (acquire thread only)
+static inline void __pzdud_queue_acquire(pzdud_t *self, size_t *handles, size_t *lengths, const size_t num)
+{
+    size_t index = self->head_index;
+    for (size_t i = 0; i < num; i++)
+    {
+        const pothos_zynq_dma_queue_entry_t *entry = __pzdud_queue_entry(self->compq, index);
+        handles[i] = entry->handle;
+        lengths[i] = (self->direction == PZDUD_S2MM)?(entry->length):(self->buff_size);
+        if (entry->handle < self->num_buffs) memcpy(self->queue_app + entry->handle*5, entry->app, sizeof(entry->app));
+        if (++index == self->num_buffs) index = 0;
+    }
+
+    //the entries are read before the kernel can post over them
+    self->head_index = index;
+    __pzdud_store_release(&self->head_count, self->head_count + num);
+    __pzdud_publish_head(self);
+    __atomic_store_n(&self->compq->consumer, (uint32_t)self->head_count, __ATOMIC_RELEASE);
+}
+
+/*!
+ * The next index of the ring with wrap-around.
+ * The acquire and release paths take the wrap as a function,
+ * which the C++ ring specializes on a compile-time ring size.
+ */
+typedef size_t (*__pzdud_next_fn)(const pzdud_t *self, const size_t index);
+
+static inline size_t __pzdud_next(const pzdud_t *self, const size_t index)
+{
+    return (index + 1 == self->num_buffs)?0:(index + 1);
+}
+
+//! Acquire the head buffer (acquire thread only), the direction may be a compile-time constant
+static inline int __pzdud_acquire_head(pzdud_t *self, const pzdud_dir_t dir, const __pzdud_next_fn next, size_t *length)
+{
+    if (__pzdud_num_claimed(self) == self->num_buffs) return PZDUD_ERROR_CLAIMED;
+
+    //the kernel posts the handle of each completion to the completion queue,
+    //and it already synced a cacheable buffer for the CPU
+    if (self->compq != NULL)
+    {
+        size_t handle = 0;
+        if (__pzdud_num_ready(self) == 0) return PZDUD_ERROR_COMPLETE;
+        __pzdud_queue_acquire(self, &handle, length, 1);
+        return (int)handle;
+    }
+
+    //check completion status of the buffer (status page first, then the descriptor)
+    const xilinx_dma_desc_t *desc = self->sgtable + self->head_index;
+    const bool ready = __pzdud_num_ready(self) != 0;
+    const uint32_t status = (dir == PZDUD_S2MM || !ready)?desc->status:0;
+    if (!ready && (status & (1 << 31)) == 0) return PZDUD_ERROR_COMPLETE;
+
+    //the buffer contents are ordered after the engine hand-off
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    __pzdud_sync(self, POTHOS_ZYNQ_DMA_SYNC_CPU, self->head_index, 1);
+
+    //fill in the buffer structure
+    const int handle = (int)self->head_index;
+    *length = (dir == PZDUD_S2MM)?(status & 0x7fffff):(self->buff_size);
+
+    //increment to next
+    self->head_index = next(self, self->head_index);
+    __pzdud_store_release(&self->head_count, self->head_count + 1);
+    __pzdud_publish_head(self);
+
+    return handle;
+}
+
+//! Write the descriptor of a released buffer (release thread only)
+static inline void __pzdud_release_desc_dir(pzdud_t *self, const pzdud_dir_t dir, size_t handle, size_t length)
+{
+    if (self->fillq != NULL) return __pzdud_queue_fill(self, handle, length);
+
+    uint32_t ctrl_word = (dir == PZDUD_S2MM)?(self->buff_size):(length | XILINX_DMA_BD_SOP | XILINX_DMA_BD_EOP);
+
+    xilinx_dma_desc_t *desc = self->sgtable+handle;
+
+    //restore the buffer after a transfer out of user memory
+    if (self->umem_submitted) desc->buf_addr = self->allocs.buffs[handle].paddr;
+
+    desc->control = ctrl_word; //new control flags
+    desc->status = 0; //clear status
+}
+
+static inline void __pzdud_release_desc(pzdud_t *self, size_t handle, size_t length)
+{
+    __pzdud_release_desc_dir(self, self->direction, handle, length);
+}
+
+//! Hand the released descriptors after the tail to the engine (release thread only)
+static inline void __pzdud_advance_tail_next(pzdud_t *self, const __pzdud_next_fn next)
+{
+    if (self->fillq != NULL) return __pzdud_queue_kick(self);
+
+    //determine the new tail (buffers may not be released in order),
+    //short of the buffers that a blocking subscriber still holds
+    const size_t num_claimed = __pzdud_sub_limit(self, __pzdud_load_acquire(&self->head_count) - self->tail_count);
+    const size_t first_index = self->tail_index;
+    xilinx_dma_desc_t *tail = NULL;
+    size_t num = 0;
+    while (num < num_claimed)
+    {
+        xilinx_dma_desc_t *desc = self->sgtable + self->tail_index;
+        if (desc->status != 0) break;
+        tail = desc;
+        self->tail_index = next(self, self->tail_index);
+        num++;
+    }
+    if (num == 0) return;
+
+    //buffer contents and descriptor updates are ordered before the engine hand-off
+    __pzdud_sync(self, POTHOS_ZYNQ_DMA_SYNC_DEVICE, first_index, num);
+    __pzdud_release_fence(self);
+
+    //ring the doorbell once for the entire range, after publishing the range:
+    //an attach after a crash in between repeats the doorbell
+    __pzdud_publish_tail(self, self->tail_count + num);
+    __pzdud_write32(self->tail_reg, __pzdud_virt_to_phys(tail, &self->allocs.sgbuff));
+    __pzdud_store_release(&self->tail_count, self->tail_count + num);
+}
+
+static inline void __pzdud_advance_tail(pzdud_t *self)
+{
+    __pzdud_advance_tail_next(self, __pzdud_next);
+}
+
+//! Map the allocation from the alloc or attach IOCTL into this process
+static inline int __pzdud_map(pzdud_t *self)
+{
+    pothos_zynq_dma_alloc_t *allocs = &self->allocs;
+    const size_t num_buffs = self->num_buffs;
+
+    //a subscriber only reads the ring of the owner
+    const int prot = self->subscriber?PROT_READ:(PROT_READ | PROT_WRITE);
+
+    //map the completion status page read-only (rings of one buffer do not track)
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->statbuff;
+        if (buff->paddr == 0 || buff->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        buff->uaddr = mmap(NULL, buff->bytes, PROT_READ, MAP_SHARED, self->fd, buff->paddr);
+        if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        if (num_buffs >= 2) self->status = (const pothos_zynq_dma_status_t *)buff->uaddr;
+    }
+
+    //map the control page for poll() (rings of one buffer do not track)
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->ctrlbuff;
+        if (buff->paddr == 0 || buff->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        buff->uaddr = mmap(NULL, buff->bytes, prot, MAP_SHARED, self->fd, buff->paddr);
+        if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        if (num_buffs >= 2) self->ctrl = (pothos_zynq_dma_ctrl_t *)buff->uaddr;
+    }
+
+    //map the completion timestamps read-only (rings of one buffer do not track)
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->timebuff;
+        if (buff->paddr == 0 || buff->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        buff->uaddr = mmap(NULL, buff->bytes, PROT_READ, MAP_SHARED, self->fd, buff->paddr);
+        if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        if (num_buffs >= 2) self->times = (const pothos_zynq_dma_time_t *)buff->uaddr;
+        if (num_buffs >= 2) self->lengths = (const uint32_t *)(self->times + num_buffs);
+    }
+
+    //map the subscriber cursors: the owner reads all of them, a subscriber writes its own
+    if (allocs->subsbuff.paddr != 0 && allocs->subsbuff.kaddr != NULL)
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->subsbuff;
+        self->cursor_stride = buff->bytes/POTHOS_ZYNQ_DMA_SUBS_MAX;
+        if (self->subscriber)
+        {
+            buff->uaddr = mmap(NULL, self->cursor_stride, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, buff->paddr + self->sub_slot*self->cursor_stride);
+            if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+            self->cursor = (pothos_zynq_dma_cursor_t *)buff->uaddr;
+        }
+        else
+        {
+            buff->uaddr = mmap(NULL, buff->bytes, PROT_READ, MAP_SHARED, self->fd, buff->paddr);
+            if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+            self->cursors = (const char *)buff->uaddr;
+        }
+    }
+    else allocs->subsbuff.uaddr = MAP_FAILED;
+
+    //map the fill and completion queues, which stand in for the SG table
+    allocs->fillbuff.uaddr = MAP_FAILED;
+    allocs->compbuff.uaddr = MAP_FAILED;
+    if ((allocs->flags & POTHOS_ZYNQ_DMA_ALLOC_QUEUES) != 0)
+    {
+        if (self->status == NULL || self->ctrl == NULL) return PZDUD_ERROR_CONFIG;
+        pothos_zynq_dma_buff_t *fill = &allocs->fillbuff;
+        pothos_zynq_dma_buff_t *comp = &allocs->compbuff;
+        if (fill->paddr == 0 || fill->kaddr == NULL || comp->paddr == 0 || comp->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        fill->uaddr = mmap(NULL, fill->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, fill->paddr);
+        if (fill->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        comp->uaddr = mmap(NULL, comp->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, comp->paddr);
+        if (comp->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        self->fillq = (pothos_zynq_dma_queue_t *)fill->uaddr;
+        self->compq = (pothos_zynq_dma_queue_t *)comp->uaddr;
+        self->queue_app = (uint32_t *)calloc(num_buffs*5, sizeof(uint32_t));
+    }
+
+    //map the slab once and locate everything else inside of it
+    if ((allocs->flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) != 0)
+    {
+        pothos_zynq_dma_buff_t *slab = &allocs->slab;
+        if (slab->paddr == 0 || slab->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        slab->uaddr = mmap(NULL, slab->bytes, prot, MAP_SHARED, self->fd, slab->paddr);
+        if (slab->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        for (size_t i = 0; i < num_buffs; i++)
+        {
+            pothos_zynq_dma_buff_t *buff = allocs->buffs + i;
+            buff->uaddr = __pzdud_phys_to_virt(buff->paddr, slab);
+        }
+        allocs->sgbuff.uaddr = __pzdud_phys_to_virt(allocs->sgbuff.paddr, slab);
+        self->sgtable = (xilinx_dma_desc_t *)allocs->sgbuff.uaddr;
+        return PZDUD_OK;
+    }
+
+    //check the results and mmap
+    for (size_t i = 0; i < num_buffs; i++)
+    {
+        pothos_zynq_dma_buff_t *buff = allocs->buffs + i;
+        if (buff->paddr == 0 || buff->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        buff->uaddr = mmap(NULL, buff->bytes, prot, MAP_SHARED, self->fd, buff->paddr);
+        if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+    }
+
+    //the kernel owns the SG table of a ring with queues
+    if (self->fillq != NULL)
+    {
+        allocs->sgbuff.uaddr = MAP_FAILED;
+        return PZDUD_OK;
+    }
+
+    //the last buffer is used for the sg table
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->sgbuff;
+        if (buff->paddr == 0 || buff->kaddr == NULL) return PZDUD_ERROR_ALLOC;
+        buff->uaddr = mmap(NULL, buff->bytes, prot, MAP_SHARED, self->fd, buff->paddr);
+        if (buff->uaddr == MAP_FAILED) return PZDUD_ERROR_ALLOC;
+        self->sgtable = (xilinx_dma_desc_t *)buff->uaddr;
+    }
+
+    return PZDUD_OK;
+}
+
+//! Recover the ring state of a persistent channel from the control page,
+//! given the completed count and the index it counts to next from the kernel
+static inline int __pzdud_restore_ring(pzdud_t *self, const pothos_zynq_dma_ring_t *ring)
+{
+    if (self->status == NULL || self->ctrl == NULL) return PZDUD_ERROR_CONFIG;
+    const size_t num_buffs = self->num_buffs;
+    const uint32_t acquired = __atomic_load_n(&self->ctrl->acquired, __ATOMIC_RELAXED);
+    const uint32_t released = __atomic_load_n(&self->ctrl->released, __ATOMIC_RELAXED);
+
+    //the head is behind the next completion by the completions not acquired,
+    //or ahead of it by the completions acquired before the kernel counted them
+    const int32_t ahead = (int32_t)(acquired - (uint32_t)ring->completed);
+    const uint32_t num_claimed = acquired - released;
+    if (ring->sgindex >= num_buffs || num_claimed > num_buffs) return PZDUD_ERROR_CONFIG;
+    if (ahead > (int32_t)num_buffs || ahead < -(int32_t)num_buffs) return PZDUD_ERROR_CONFIG;
+    self->head_index = (ring->sgindex + 2*num_buffs + ahead) % num_buffs;
+    self->tail_index = (self->head_index + num_buffs - num_claimed) % num_buffs;
+    self->head_count = acquired;
+    self->tail_count = self->head_count - num_claimed;
+
+    //repeat the doorbell when the last submitted descriptor is still pending:
+    //the previous process may have published the range and died before the write
+    if (num_claimed < num_buffs)
+    {
+        xilinx_dma_desc_t *tail = self->sgtable + (self->tail_index + num_buffs - 1) % num_buffs;
+        if (__atomic_load_n(&tail->status, __ATOMIC_ACQUIRE) == 0)
+        {
+            __pzdud_write32(self->tail_reg, __pzdud_virt_to_phys(tail, &self->allocs.sgbuff));
+        }
+    }
+
+    //hand the buffers held by the previous process back to the head,
+    //the ones released out of order are marked completed without a length
+    for (size_t i = 0, index = self->tail_index; i < num_claimed; i++)
+    {
+        xilinx_dma_desc_t *desc = self->sgtable + index;
+        if (desc->status == 0) desc->status = (1 << 31);
+        if (++index == num_buffs) index = 0;
+    }
+    self->head_index = self->tail_index;
+    self->head_count = self->tail_count;
+    __pzdud_publish_head(self);
+
+    //descriptors may still point into the previous process's registered memory
+    self->umem_submitted = true;
+    self->restarts_seen = __atomic_load_n(&self->status->restarts, __ATOMIC_RELAXED);
+    return PZDUD_OK;
+}
+
+//! Unmap the allocation from the alloc or attach IOCTL from this process
+static inline void __pzdud_unmap(pzdud_t *self)
+{
+    pothos_zynq_dma_alloc_t *allocs = &self->allocs;
+
+    //unmap the completion status page
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->statbuff;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        buff->uaddr = MAP_FAILED;
+        self->status = NULL;
+    }
+
+    //unmap the control page
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->ctrlbuff;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        buff->uaddr = MAP_FAILED;
+        self->ctrl = NULL;
+    }
+
+    //unmap the completion timestamps
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->timebuff;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        buff->uaddr = MAP_FAILED;
+        self->times = NULL;
+        self->lengths = NULL;
+    }
+
+    //unmap the subscriber cursors, a subscriber maps only its own
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->subsbuff;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, self->subscriber?self->cursor_stride:buff->bytes);
+        buff->uaddr = MAP_FAILED;
+        self->cursors = NULL;
+        self->cursor = NULL;
+    }
+
+    //unmap the fill and completion queues
+    {
+        if (allocs->fillbuff.uaddr != MAP_FAILED) munmap(allocs->fillbuff.uaddr, allocs->fillbuff.bytes);
+        allocs->fillbuff.uaddr = MAP_FAILED;
+        if (allocs->compbuff.uaddr != MAP_FAILED) munmap(allocs->compbuff.uaddr, allocs->compbuff.bytes);
+        allocs->compbuff.uaddr = MAP_FAILED;
+        free(self->queue_app);
+        self->fillq = NULL;
+        self->compq = NULL;
+        self->queue_app = NULL;
+    }
 
-static inline size_t __pzdud_virt_to_phys(void *virt, const pothos_zynq_dma_buff_t *buff)
-{
-    size_t offset = (size_t)virt - (size_t)buff->uaddr;
-    return offset + buff->paddr;
+    //unmap the slab which contains all the buffers
+    if ((allocs->flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) != 0)
+    {
+        pothos_zynq_dma_buff_t *buff = &allocs->slab;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        buff->uaddr = MAP_FAILED;
+    }
+
+    //unmap all the buffers and the sg table
+    else
+    {
+        for (size_t i = 0; i < allocs->num_buffs; i++)
+        {
+            pothos_zynq_dma_buff_t *buff = allocs->buffs + i;
+            if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        }
+        pothos_zynq_dma_buff_t *buff = &allocs->sgbuff;
+        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+    }
+
+    //nothing is unmapped twice by a later free or destroy
+    for (size_t i = 0; i < allocs->num_buffs; i++) allocs->buffs[i].uaddr = MAP_FAILED;
+    allocs->sgbuff.uaddr = MAP_FAILED;
+    self->sgtable = NULL;
 }
 
 /***********************************************************************
@@ -234,8 +1324,10 @@ static inline size_t __pzdud_virt_to_phys(void *virt, const pothos_zynq_dma_buff
  **********************************************************************/
 static inline pzdud_t *pzdud_create(const size_t engine_no, const pzdud_dir_t direction)
 {
-    //open the device
-    int fd = open("/dev/pothos_zynq_dma", O_RDWR | O_SYNC);
+    //open the device node of the engine
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/pothos_zynq_dma%zu", engine_no);
+    int fd = open(path, O_RDWR | O_SYNC);
     if (fd <= 0)
     {
         perror("pzdud_create::open()");
@@ -290,7 +1382,11 @@ static inline pzdud_t *pzdud_create(const size_t engine_no, const pzdud_dir_t di
 
 static inline int pzdud_destroy(pzdud_t *self)
 {
-    munmap(self->regs, POTHOS_ZYNQ_DMA_REGS_SIZE);
+    //a subscriber never frees the ring, it only maps it
+    if (self->subscriber && self->allocs.buffs != NULL) __pzdud_unmap(self);
+    if (self->subscriber) free(self->allocs.buffs);
+    for (size_t i = 0; i < POTHOS_ZYNQ_DMA_UMEM_MAX; i++) free(self->umems[i].segs);
+    if (self->regs != NULL) munmap(self->regs, POTHOS_ZYNQ_DMA_REGS_SIZE);
     close(self->fd);
     free(self);
     return PZDUD_OK;
@@ -316,6 +1412,11 @@ static inline int pzdud_reset(pzdud_t *self)
  * allocation implementation
  **********************************************************************/
 static inline int pzdud_alloc(pzdud_t *self, const size_t num_buffs, const size_t buff_size)
+{
+    return pzdud_alloc_ex(self, num_buffs, buff_size, 0);
+}
+
+static inline int pzdud_alloc_ex(pzdud_t *self, const size_t num_buffs, const size_t buff_size, const int flags)
 {
     pothos_zynq_dma_alloc_t *allocs = &self->allocs;
     memset(allocs, 0, sizeof(pothos_zynq_dma_alloc_t));
@@ -325,6 +1426,10 @@ static inline int pzdud_alloc(pzdud_t *self, const size_t num_buffs, const size_
     //load up the allocation request
     allocs->sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
     allocs->num_buffs = num_buffs;
+    if ((flags & PZDUD_ALLOC_CACHEABLE) != 0) allocs->flags |= POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE;
+    if ((flags & PZDUD_ALLOC_WRITECOMBINE) != 0) allocs->flags |= POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE;
+    if ((flags & PZDUD_ALLOC_SLAB) != 0) allocs->flags |= POTHOS_ZYNQ_DMA_ALLOC_SLAB;
+    if ((flags & PZDUD_ALLOC_QUEUES) != 0) allocs->flags |= POTHOS_ZYNQ_DMA_ALLOC_QUEUES;
     allocs->buffs = (pothos_zynq_dma_buff_t *)calloc(num_buffs, sizeof(pothos_zynq_dma_buff_t));
     for (size_t i = 0; i < num_buffs; i++)
     {
@@ -332,55 +1437,39 @@ static inline int pzdud_alloc(pzdud_t *self, const size_t num_buffs, const size_
     }
 
     //perform the allocation ioctl
-    int ret = ioctl(self->fd, POTHOS_ZYNQ_DMA_ALLOC, (void *)allocs);
+    int ret = __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_ALLOC, (void *)allocs);
     if (ret != 0)
     {
         perror("pzdud_alloc::ioctl(alloc)");
-        return PZDUD_ERROR_ALLOC;
-    }
 
-    //check the results and mmap
-    for (size_t i = 0; i < num_buffs; i++)
-    {
-        pothos_zynq_dma_buff_t *buff = allocs->buffs + i;
-        if (buff->paddr == 0 || buff->kaddr == NULL) goto fail;
-        buff->uaddr = mmap(NULL, buff->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, buff->paddr);
-        if (buff->uaddr == MAP_FAILED) goto fail;
+        //the ring of the previous owner is still mapped by its subscribers
+        return (errno == EADDRINUSE)?PZDUD_ERROR_BUSY:PZDUD_ERROR_ALLOC;
     }
 
-    //the last buffer is used for the sg table
+    //map everything into this process
+    if (__pzdud_map(self) != PZDUD_OK)
     {
-        pothos_zynq_dma_buff_t *buff = &allocs->sgbuff;
-        if (buff->paddr == 0 || buff->kaddr == NULL) goto fail;
-        buff->uaddr = mmap(NULL, buff->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, buff->paddr);
-        if (buff->uaddr == MAP_FAILED) goto fail;
-        self->sgtable = (xilinx_dma_desc_t *)buff->uaddr;
+        __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_FREE, NULL);
+        return PZDUD_ERROR_ALLOC;
     }
 
     return PZDUD_OK;
-
-    fail:
-        ioctl(self->fd, POTHOS_ZYNQ_DMA_FREE);
-        return PZDUD_ERROR_ALLOC;
 }
 
 static inline int pzdud_free(pzdud_t *self)
 {
     pothos_zynq_dma_alloc_t *allocs = &self->allocs;
 
-    //unmap all the buffers
-    for (size_t i = 0; i < allocs->num_buffs; i++)
-    {
-        pothos_zynq_dma_buff_t *buff = allocs->buffs + i;
-        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
-    }
+    //keep the mappings of an allocation that the kernel would not free
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_FREE, (void *)POTHOS_ZYNQ_DMA_FREE_CHECK) != 0)
     {
-        pothos_zynq_dma_buff_t *buff = &allocs->sgbuff;
-        if (buff->uaddr != MAP_FAILED) munmap(buff->uaddr, buff->bytes);
+        perror("pzdud_free::ioctl(free check)");
+        return (errno == EBUSY)?PZDUD_ERROR_BUSY:PZDUD_ERROR_ALLOC;
     }
+    __pzdud_unmap(self);
 
-    //free all the buffers
-    int ret = ioctl(self->fd, POTHOS_ZYNQ_DMA_FREE);
+    //free all the buffers, the check keeps subscribers from coming in
+    int ret = __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_FREE, NULL);
     if (ret != 0)
     {
         perror("pzdud_free::ioctl(free)");
@@ -410,8 +1499,8 @@ static inline int pzdud_init(pzdud_t *self, const bool release)
     //check for scatter/gather support
     if ((__pzdud_read32(self->stat_reg) & 0x8) == 0) return PZDUD_ERROR_NOSG;
 
-    //load the scatter gather table
-    for (size_t i = 0; i < self->num_buffs; i++)
+    //load the scatter gather table (the kernel loads it for a ring with queues)
+    for (size_t i = 0; self->sgtable != NULL && i < self->num_buffs; i++)
     {
         xilinx_dma_desc_t *desc = self->sgtable + i;
         size_t next_index = (i+1) % self->num_buffs;
@@ -422,28 +1511,61 @@ static inline int pzdud_init(pzdud_t *self, const bool release)
         desc->status = (1 << 31); //mark completed (ownership to caller)
     }
 
-    //initialize buffer tracking
+    //initialize buffer tracking (all buffers claimed by the user)
     self->head_index = 0;
     self->tail_index = 0;
-    self->num_acquired = self->num_buffs;
+    self->head_count = self->num_buffs;
+    self->tail_count = 0;
+    self->fill_pending = 0;
+    if (release && self->direction == PZDUD_MM2S) self->tail_count = self->head_count; //ready to acquire
+    __pzdud_publish_head(self);
+    __pzdud_publish_tail(self, self->tail_count);
+
+    //reset the status page: the completed count starts at the head count
+    //plus the descriptors that are already completed but not claimed
+    if (self->status != NULL)
+    {
+        pothos_zynq_dma_ring_t ring_args;
+        ring_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+        ring_args.completed = self->head_count + self->num_buffs - __pzdud_num_claimed(self);
+        ring_args.sgindex = self->head_index;
+        if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_RING_RESET, (void *)&ring_args) != 0)
+        {
+            perror("pzdud_init::ioctl(ring_reset)");
+            if (self->fillq != NULL) return PZDUD_ERROR_CONFIG;
+            self->status = NULL; //fall back to descriptor checks
+        }
+        self->restarts_seen = 0;
+    }
 
-    //load desc pointers
-    xilinx_dma_desc_t *head = self->sgtable + self->head_index;
-    __pzdud_write32(self->head_reg, __pzdud_virt_to_phys(head, &self->allocs.sgbuff));
-    xilinx_dma_desc_t *tail = self->sgtable + self->tail_index;
-    __pzdud_write32(self->tail_reg, __pzdud_virt_to_phys(tail, &self->allocs.sgbuff));
+    //the ring reset loaded the queues, the first kick starts the engine
+    if (self->fillq == NULL)
+    {
+        //load desc pointers
+        xilinx_dma_desc_t *head = self->sgtable + self->head_index;
+        __pzdud_write32(self->head_reg, __pzdud_virt_to_phys(head, &self->allocs.sgbuff));
+        xilinx_dma_desc_t *tail = self->sgtable + self->tail_index;
+        __pzdud_write32(self->tail_reg, __pzdud_virt_to_phys(tail, &self->allocs.sgbuff));
 
-    //start the engine
-    __pzdud_write32(self->ctrl_reg, __pzdud_read32(self->ctrl_reg) | XILINX_DMA_CR_RUNSTOP_MASK);
+        //start the engine
+        __pzdud_write32(self->ctrl_reg, __pzdud_read32(self->ctrl_reg) | XILINX_DMA_CR_RUNSTOP_MASK);
 
-    //enable interrupt on complete
-    __pzdud_write32(self->ctrl_reg, __pzdud_read32(self->ctrl_reg) | XILINX_DMA_XR_IRQ_IOC_MASK);
+        //enable interrupt on complete, and on error for the recovery
+        __pzdud_write32(self->ctrl_reg, __pzdud_read32(self->ctrl_reg) | XILINX_DMA_XR_IRQ_IOC_MASK | XILINX_DMA_XR_IRQ_ERROR_MASK);
+    }
+
+    //restore the interrupt moderation (the kernel programs the counters)
+    self->moder.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_MODERATION, (void *)&self->moder) != 0)
+    {
+        perror("pzdud_init::ioctl(moderation)");
+    }
 
     //release all the buffers into the engine
-    if (release) for (size_t i = 0; i < self->num_buffs; i++)
+    if (release && self->direction == PZDUD_S2MM)
     {
-        if (self->direction == PZDUD_S2MM) pzdud_release(self, i, 0);
-        else self->num_acquired--;
+        for (size_t i = 0; i < self->num_buffs; i++) __pzdud_release_desc(self, i, 0);
+        __pzdud_advance_tail(self);
     }
 
     return PZDUD_OK;
@@ -462,76 +1584,461 @@ static inline int pzdud_halt(pzdud_t *self)
     return PZDUD_OK;
 }
 
+/***********************************************************************
+ * persistent ring implementation
+ **********************************************************************/
+static inline int pzdud_persist(pzdud_t *self, const bool enable)
+{
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_PERSIST, (void *)(size_t)(enable?1:0)) != 0)
+    {
+        perror("pzdud_persist::ioctl(persist)");
+        return PZDUD_ERROR_CONFIG;
+    }
+    return PZDUD_OK;
+}
+
+//! Describe the allocation of the ring with the attach IOCTL
+static inline int __pzdud_describe(pzdud_t *self)
+{
+    pothos_zynq_dma_alloc_t *allocs = &self->allocs;
+    memset(allocs, 0, sizeof(pothos_zynq_dma_alloc_t));
+    allocs->sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+
+    //query the size of the ring, then describe each buffer
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_ATTACH, (void *)allocs) != 0 && errno != ENOSPC) return PZDUD_ERROR_CONFIG;
+    if (allocs->num_buffs == 0) return PZDUD_ERROR_CONFIG;
+    allocs->buffs = (pothos_zynq_dma_buff_t *)calloc(allocs->num_buffs, sizeof(pothos_zynq_dma_buff_t));
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_ATTACH, (void *)allocs) != 0)
+    {
+        perror("pzdud_attach::ioctl(attach)");
+        free(allocs->buffs);
+        allocs->buffs = NULL;
+        return PZDUD_ERROR_CONFIG;
+    }
+    self->num_buffs = allocs->num_buffs;
+    self->buff_size = allocs->buffs[0].bytes;
+    return PZDUD_OK;
+}
+
+static inline int pzdud_attach(pzdud_t *self)
+{
+    const int ret = __pzdud_describe(self);
+    if (ret != PZDUD_OK) return ret;
+
+    //map the same pages as the previous process, the ring keeps running
+    if (__pzdud_map(self) != PZDUD_OK) return PZDUD_ERROR_ALLOC;
+    return __pzdud_restore_ring(self, &self->allocs.ring);
+}
+
+/***********************************************************************
+ * subscriber implementation
+ **********************************************************************/
+//! Start a subscriber at the completion from the subscribe IOCTL, before the ring is mapped
+static inline void __pzdud_sub_start(pzdud_t *self, const size_t slot, const pothos_zynq_dma_ring_t *ring)
+{
+    self->subscriber = true;
+    self->sub_slot = slot;
+    self->head_index = ring->sgindex;
+    self->tail_index = ring->sgindex;
+    self->head_count = ring->completed;
+    self->tail_count = ring->completed;
+    self->sub_stale = 0;
+}
+
+//! Skip the completions that the owner handed back to the engine before the subscriber acquired them,
+//! the buffers the subscriber still holds were handed back as well
+static inline void __pzdud_sub_skip(pzdud_t *self, const uint32_t num)
+{
+    pothos_zynq_dma_cursor_t *cursor = self->cursor;
+    self->sub_stale += self->head_count - self->tail_count;
+    self->head_count += num;
+    self->head_index = (self->head_index + num) % self->num_buffs;
+    self->tail_count = self->head_count;
+    self->tail_index = self->head_index;
+    __atomic_store_n(&cursor->dropped, cursor->dropped + num, __ATOMIC_RELAXED);
+    __atomic_store_n(&cursor->released, (uint32_t)self->tail_count, __ATOMIC_RELEASE);
+    __atomic_store_n(&cursor->acquired, (uint32_t)self->head_count, __ATOMIC_RELAXED);
+}
+
+static inline pzdud_t *pzdud_subscribe(const size_t engine_no, const pzdud_lag_policy_t policy)
+{
+    //open the device node of the engine
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/pothos_zynq_dma%zu", engine_no);
+    int fd = open(path, O_RDWR | O_SYNC);
+    if (fd <= 0)
+    {
+        perror("pzdud_subscribe::open()");
+        return NULL;
+    }
+
+    //subscribe to the channel rather than claim it
+    pothos_zynq_dma_subscribe_t sub_args;
+    memset(&sub_args, 0, sizeof(sub_args));
+    sub_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    sub_args.engine_no = engine_no;
+    sub_args.direction = POTHOS_ZYNQ_DMA_S2MM;
+    sub_args.policy = (policy == PZDUD_LAG_DROP)?POTHOS_ZYNQ_DMA_LAG_DROP:POTHOS_ZYNQ_DMA_LAG_BLOCK;
+    if (ioctl(fd, POTHOS_ZYNQ_DMA_SUBSCRIBE, (void *)&sub_args) != 0)
+    {
+        perror("pzdud_subscribe::ioctl(subscribe)");
+        close(fd);
+        return NULL;
+    }
+
+    //initialize the object structure without the registers
+    pzdud_t *self = (pzdud_t *)calloc(1, sizeof(pzdud_t));
+    self->fd = fd;
+    self->engine_no = engine_no;
+    self->direction = PZDUD_S2MM;
+    __pzdud_sub_start(self, sub_args.slot, &sub_args.ring);
+
+    //map the ring of the owner
+    if (__pzdud_describe(self) != PZDUD_OK || __pzdud_map(self) != PZDUD_OK ||
+        self->status == NULL || self->lengths == NULL || self->cursor == NULL)
+    {
+        pzdud_destroy(self);
+        return NULL;
+    }
+    return self;
+}
+
+static inline int pzdud_sub_wait(pzdud_t *self, const long timeout_us)
+{
+    if (self->cursor == NULL) return PZDUD_ERROR_CONFIG;
+    if (__pzdud_num_ready(self) != 0) return PZDUD_OK;
+
+    //the kernel counts the completions after the acquired count on the cursor
+    pothos_zynq_dma_wait_n_t wait_args;
+    memset(&wait_args, 0, sizeof(wait_args));
+    wait_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    wait_args.sgindex = self->head_index;
+    wait_args.min_num = 1;
+    wait_args.max_num = self->num_buffs;
+    wait_args.timeout_us = timeout_us;
+    const int ret = __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_WAIT_N, (void *)&wait_args);
+    if (ret < 0 && errno == ENODEV) return PZDUD_ERROR_REMOVED;
+    if (__pzdud_num_ready(self) != 0) return PZDUD_OK;
+    return (ret < 0 && errno != ETIMEDOUT && errno != EINTR)?PZDUD_ERROR_CONFIG:PZDUD_ERROR_TIMEOUT;
+}
+
+static inline int pzdud_sub_acquire(pzdud_t *self, size_t *length)
+{
+    pothos_zynq_dma_cursor_t *cursor = self->cursor;
+    if (cursor == NULL) return PZDUD_ERROR_CONFIG;
+
+    //the owner publishes its releases before the engine can overwrite them
+    const int32_t missed = (int32_t)(__atomic_load_n(&self->ctrl->released, __ATOMIC_ACQUIRE) - (uint32_t)self->head_count);
+    if (missed > 0) __pzdud_sub_skip(self, (uint32_t)missed);
+    if (__pzdud_num_ready(self) == 0) return PZDUD_ERROR_COMPLETE;
+
+    //the buffer contents are ordered after the completed count
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    __pzdud_sync(self, POTHOS_ZYNQ_DMA_SYNC_CPU, self->head_index, 1);
+
+    //the descriptor status belongs to the owner, the kernel recorded the length
+    const int handle = self->head_index;
+    *length = self->lengths[handle];
+
+    //increment to next
+    self->head_index = (self->head_index + 1) % self->num_buffs;
+    self->head_count++;
+    __atomic_store_n(&cursor->delivered, cursor->delivered + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cursor->acquired, (uint32_t)self->head_count, __ATOMIC_RELAXED);
+    return handle;
+}
+
+static inline int pzdud_sub_release(pzdud_t *self)
+{
+    pothos_zynq_dma_cursor_t *cursor = self->cursor;
+    if (cursor == NULL) return PZDUD_ERROR_CONFIG;
+
+    //the buffers held across a skip were handed back before the skip
+    if (self->sub_stale != 0)
+    {
+        self->sub_stale--;
+        __atomic_store_n(&cursor->overruns, cursor->overruns + 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    if (self->head_count == self->tail_count) return PZDUD_ERROR_CONFIG;
+
+    //the reads of the buffer are ordered before the check of the owner's releases
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const uint32_t released = __atomic_load_n(&self->ctrl->released, __ATOMIC_RELAXED);
+    const bool overrun = (int32_t)(released - (uint32_t)self->tail_count) > 0;
+    if (overrun) __atomic_store_n(&cursor->overruns, cursor->overruns + 1, __ATOMIC_RELAXED);
+
+    //hand the buffer back to the owner
+    self->tail_index = (self->tail_index + 1) % self->num_buffs;
+    self->tail_count++;
+    __atomic_store_n(&cursor->released, (uint32_t)self->tail_count, __ATOMIC_RELEASE);
+    return overrun?1:0;
+}
+
+static inline int pzdud_sub_get_stats(pzdud_t *self, pzdud_sub_stats_t *stats)
+{
+    const pothos_zynq_dma_cursor_t *cursor = self->cursor;
+    if (cursor == NULL) return PZDUD_ERROR_CONFIG;
+    stats->delivered = cursor->delivered;
+    stats->dropped = cursor->dropped;
+    stats->overruns = cursor->overruns;
+    const int32_t lag = (int32_t)(__atomic_load_n(&self->status->completed, __ATOMIC_ACQUIRE) - (uint32_t)self->tail_count);
+    stats->lag = (lag > 0)?(size_t)lag:0;
+    return PZDUD_OK;
+}
+
 /***********************************************************************
  * acquire/release implementation
  **********************************************************************/
 static inline int pzdud_wait(pzdud_t *self, const long timeout_us)
 {
-    if (__sync_fetch_and_add(&self->num_acquired, 0) == self->num_buffs) return PZDUD_ERROR_CLAIMED;
+    return pzdud_wait_n(self, 1, timeout_us, NULL);
+}
+
+static inline int pzdud_wait_n(pzdud_t *self, size_t min_num, const long timeout_us, size_t *num_ready)
+{
+    const size_t num_claimed = __pzdud_num_claimed(self);
+    if (num_claimed == self->num_buffs) return PZDUD_ERROR_CLAIMED;
 
-    xilinx_dma_desc_t *desc = self->sgtable+self->head_index;
+    //the engine can only complete the buffers that were not claimed
+    const size_t num_avail = self->num_buffs - num_claimed;
+    if (min_num > num_avail) min_num = num_avail;
+    if (min_num == 0) min_num = 1;
+    size_t num_done = 0;
+    if (num_ready == NULL) num_ready = &num_done;
 
     //initial check without blocking
-    if ((desc->status & (1 << 31)) != 0) return PZDUD_OK;
+    *num_ready = __pzdud_num_done(self, num_avail);
+    if (*num_ready >= min_num)
+    {
+        self->wait_stats.ready++;
+        return PZDUD_OK;
+    }
+
+    //busy-poll the completion status for the spin portion of the timeout
+    long sleep_us = timeout_us;
+    if (self->wait_mode != PZDUD_WAIT_IRQ && timeout_us > 0)
+    {
+        long spin_us = timeout_us;
+        if (self->wait_mode == PZDUD_WAIT_HYBRID && self->spin_us < spin_us) spin_us = self->spin_us;
+        if (__pzdud_spin(self, min_num, spin_us))
+        {
+            self->wait_stats.spins++;
+            *num_ready = __pzdud_num_done(self, num_avail);
+            return PZDUD_OK;
+        }
+        sleep_us = timeout_us - spin_us;
+    }
 
-    //check completion status of the buffer with timeout
-    if (timeout_us > 0)
+    //check completion status of the batch with timeout
+    if (self->wait_mode != PZDUD_WAIT_POLL && sleep_us > 0)
     {
-        pothos_zynq_dma_wait_t wait_args;
+        self->wait_stats.sleeps++;
+        pothos_zynq_dma_wait_n_t wait_args;
         wait_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
-        wait_args.timeout_us = timeout_us;
         wait_args.sgindex = self->head_index;
-        int ret = ioctl(self->fd, POTHOS_ZYNQ_DMA_WAIT, (void *)&wait_args);
-        if (ret != 0)
+        wait_args.min_num = min_num;
+        wait_args.max_num = num_avail;
+        wait_args.timeout_us = sleep_us;
+        wait_args.num_completed = 0;
+        int ret = __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_WAIT_N, (void *)&wait_args);
+        if (ret < 0 && errno == ENODEV) return PZDUD_ERROR_REMOVED;
+
+        //the kernel rejected the wait (no ring, bad index), which waiting again cannot fix
+        if (ret < 0 && errno != ETIMEDOUT && errno != EINTR)
         {
-            perror("pzdud_free::ioctl(wait)");
-            return PZDUD_ERROR_TIMEOUT;
+            perror("pzdud_wait::ioctl(wait_n)");
+            *num_ready = __pzdud_num_done(self, num_avail);
+            return PZDUD_ERROR_CONFIG;
         }
     }
 
     //check the condition for the last time
-    if ((desc->status & (1 << 31)) != 0) return PZDUD_OK;
+    *num_ready = __pzdud_num_done(self, num_avail);
+    if (*num_ready >= min_num) return PZDUD_OK;
+    self->wait_stats.timeouts++;
     return PZDUD_ERROR_TIMEOUT;
 }
 
-static inline int pzdud_acquire(pzdud_t *self, size_t *length)
+static inline void pzdud_set_wait_policy(pzdud_t *self, const pzdud_wait_mode_t mode, const long spin_us)
 {
-    if (__sync_fetch_and_add(&self->num_acquired, 0) == self->num_buffs) return PZDUD_ERROR_CLAIMED;
+    self->wait_mode = mode;
+    self->spin_us = (spin_us < 0)?0:spin_us;
+}
+
+static inline void pzdud_get_wait_stats(pzdud_t *self, pzdud_wait_stats_t *stats)
+{
+    *stats = self->wait_stats;
+}
 
-    xilinx_dma_desc_t *desc = self->sgtable+self->head_index;
+static inline int pzdud_fd(pzdud_t *self)
+{
+    return self->fd;
+}
 
-    //check completion status of the buffer
-    if ((desc->status & (1 << 31)) == 0) return PZDUD_ERROR_COMPLETE;
+static inline int pzdud_set_moderation(pzdud_t *self, const pzdud_moder_mode_t mode, const size_t coalesce, const size_t delay_us)
+{
+    pothos_zynq_dma_moder_t moder_args;
+    moder_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    moder_args.mode = POTHOS_ZYNQ_DMA_MODER_OFF;
+    if (mode == PZDUD_MODER_ADAPTIVE) moder_args.mode = POTHOS_ZYNQ_DMA_MODER_ADAPTIVE;
+    if (mode == PZDUD_MODER_MANUAL) moder_args.mode = POTHOS_ZYNQ_DMA_MODER_MANUAL;
+    if (mode == PZDUD_MODER_POLL) moder_args.mode = POTHOS_ZYNQ_DMA_MODER_POLL;
+    moder_args.coalesce = coalesce;
+    moder_args.delay_us = delay_us;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_MODERATION, (void *)&moder_args) != 0)
+    {
+        perror("pzdud_set_moderation::ioctl(moderation)");
+        return PZDUD_ERROR_CONFIG;
+    }
+    self->moder = moder_args;
+    return PZDUD_OK;
+}
 
-    //fill in the buffer structure
-    int handle = self->head_index;
-    *length = (self->direction == PZDUD_S2MM)?(desc->status & 0x7fffff):(self->buff_size);
+static inline int pzdud_get_moderation_stats(pzdud_t *self, pzdud_moder_stats_t *stats)
+{
+    const pothos_zynq_dma_status_t *status = self->status;
+    if (status == NULL) return PZDUD_ERROR_CONFIG;
+    stats->coalesce = __atomic_load_n(&status->coalesce, __ATOMIC_RELAXED);
+    stats->delay_us = __atomic_load_n(&status->delay_us, __ATOMIC_RELAXED);
+    stats->irq_rate = __atomic_load_n(&status->irq_rate, __ATOMIC_RELAXED);
+    stats->completion_rate = __atomic_load_n(&status->completion_rate, __ATOMIC_RELAXED);
+    stats->latency_us = __atomic_load_n(&status->latency_us, __ATOMIC_RELAXED);
+    stats->poll_count = __atomic_load_n(&status->poll_count, __ATOMIC_RELAXED);
+    stats->poll_entries = __atomic_load_n(&status->poll_entries, __ATOMIC_RELAXED);
+    stats->irq_mode_us = __atomic_load_n(&status->irq_mode_us, __ATOMIC_RELAXED);
+    stats->poll_mode_us = __atomic_load_n(&status->poll_mode_us, __ATOMIC_RELAXED);
+    return PZDUD_OK;
+}
 
-    //increment to next
-    self->head_index = (self->head_index + 1) % self->num_buffs;
-    __sync_fetch_and_add(&self->num_acquired, 1);
+static inline int pzdud_get_stats(pzdud_t *self, pzdud_stats_t *stats)
+{
+    pothos_zynq_dma_stats_t stats_args;
+    memset(&stats_args, 0, sizeof(stats_args));
+    stats_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_STATS, (void *)&stats_args) != 0)
+    {
+        perror("pzdud_get_stats::ioctl(stats)");
+        return PZDUD_ERROR_CONFIG;
+    }
+    stats->bytes = stats_args.bytes;
+    stats->completions = stats_args.completions;
+    stats->irq_count = stats_args.irq_count;
+    stats->wait_calls = stats_args.wait_calls;
+    stats->wait_timeouts = stats_args.wait_timeouts;
+    stats->occupancy_max = stats_args.occupancy_max;
+    stats->errors = stats_args.errors;
+    stats->idle_us = stats_args.idle_us;
+    stats->pool_bytes = stats_args.pool_bytes;
+    stats->error_irqs = stats_args.error_irqs;
+    stats->restarts = stats_args.restarts;
+    return PZDUD_OK;
+}
+
+static inline size_t pzdud_restarts(pzdud_t *self)
+{
+    if (self->status == NULL) return 0;
+    const uint32_t restarts = __atomic_load_n(&self->status->restarts, __ATOMIC_ACQUIRE);
+    const uint32_t num = restarts - self->restarts_seen;
+    self->restarts_seen = restarts;
+    return num;
+}
+
+static inline int pzdud_acquire(pzdud_t *self, size_t *length)
+{
+    return __pzdud_acquire_head(self, self->direction, __pzdud_next, length);
+}
 
+static inline int pzdud_acquire_ts(pzdud_t *self, size_t *length, long long *time_ns, bool *kernel_time)
+{
+    //the status page count orders the timestamp read after the kernel's write
+    *kernel_time = __pzdud_head_time(self, time_ns);
+    const int handle = pzdud_acquire(self, length);
+    if (handle >= 0 && !*kernel_time) *time_ns = __pzdud_time_ns();
     return handle;
 }
 
-static inline void pzdud_release(pzdud_t *self, size_t handle, size_t length)
+static inline int pzdud_acquire_many(pzdud_t *self, size_t *handles, size_t *lengths, const size_t max_num)
 {
-    uint32_t ctrl_word = (self->direction == PZDUD_S2MM)?(self->buff_size):(length | XILINX_DMA_BD_SOP | XILINX_DMA_BD_EOP);
+    const size_t num_claimed = __pzdud_num_claimed(self);
+    if (num_claimed == self->num_buffs) return PZDUD_ERROR_CLAIMED;
 
-    xilinx_dma_desc_t *desc = self->sgtable+handle;
+    //the engine can only complete the buffers that were not claimed
+    size_t num_avail = self->num_buffs - num_claimed;
+    if (num_avail > max_num) num_avail = max_num;
 
-    desc->control = ctrl_word; //new control flags
-    desc->status = 0; //clear status
+    //the status page counts completions with a single cached load
+    size_t num = __pzdud_num_ready(self);
+    if (num > num_avail) num = num_avail;
 
-    //determine the new tail (buffers may not be released in order)
-    do
+    //the completion queue of a ring with queues is the only source
+    if (self->compq != NULL)
     {
-        xilinx_dma_desc_t *tail = self->sgtable + self->tail_index;
-        if (tail->status != 0) break;
-        __pzdud_write32(self->tail_reg, __pzdud_virt_to_phys(tail, &self->allocs.sgbuff));
-        self->tail_index = (self->tail_index + 1) % self->num_buffs;
+        if (num == 0) return PZDUD_ERROR_COMPLETE;
+        __pzdud_queue_acquire(self, handles, lengths, num);
+        return (int)num;
+    }
+
+    //otherwise find the completions from the current descriptor register
+    if (num == 0)
+    {
+        //descriptors from the head up to the current descriptor have been processed,
+        //the current descriptor itself is included and checked for completion below
+        num = num_avail;
+        const size_t cur_index = __pzdud_phys_to_index(self, __pzdud_read32(self->head_reg));
+        if (cur_index < self->num_buffs)
+        {
+            num = (cur_index >= self->head_index)?
+                (cur_index - self->head_index + 1):
+                (cur_index + self->num_buffs - self->head_index + 1);
+            if (num > num_avail) num = num_avail;
+        }
+
+        //completions are in order: back off to the last completed descriptor
+        while (num != 0)
+        {
+            size_t index = self->head_index + num - 1;
+            if (index >= self->num_buffs) index -= self->num_buffs;
+            if ((self->sgtable[index].status & (1 << 31)) != 0) break;
+            num--;
+        }
+    }
+    if (num == 0) return PZDUD_ERROR_COMPLETE;
+
+    //the buffer contents are ordered after the engine hand-off
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    __pzdud_sync(self, POTHOS_ZYNQ_DMA_SYNC_CPU, self->head_index, num);
+
+    //fill in the handles and lengths for the entire batch
+    size_t index = self->head_index;
+    for (size_t i = 0; i < num; i++)
+    {
+        handles[i] = index;
+        lengths[i] = (self->direction == PZDUD_S2MM)?(self->sgtable[index].status & 0x7fffff):(self->buff_size);
+        if (++index == self->num_buffs) index = 0;
+    }
+
+    //increment past the batch
+    self->head_index = index;
+    __pzdud_store_release(&self->head_count, self->head_count + num);
+    __pzdud_publish_head(self);
+
+    return (int)num;
+}
+
+static inline void pzdud_release(pzdud_t *self, size_t handle, size_t length)
+{
+    __pzdud_release_desc(self, handle, length);
+    __pzdud_advance_tail(self);
+}
+
+static inline void pzdud_release_many(pzdud_t *self, const size_t *handles, const size_t *lengths, const size_t num)
+{
+    for (size_t i = 0; i < num; i++)
+    {
+        __pzdud_release_desc(self, handles[i], (lengths == NULL)?0:lengths[i]);
     }
-    while (__sync_sub_and_fetch(&self->num_acquired, 1) != 0);
+    __pzdud_advance_tail(self);
 }
 
 /***********************************************************************
@@ -539,12 +2046,200 @@ static inline void pzdud_release(pzdud_t *self, size_t handle, size_t length)
  **********************************************************************/
 static inline void pzdud_set_app_field(pzdud_t *self, size_t handle, size_t which, const uint32_t value)
 {
+    //the fill entry of a ring with queues carries the fields of its handle
+    if (self->queue_app != NULL)
+    {
+        self->queue_app[handle*5 + which] = value;
+        return;
+    }
     uint32_t *addr = &(self->sgtable[handle].app_0);
     *(addr + which) = value;
 }
 
 static inline uint32_t pzdud_get_app_field(pzdud_t *self, size_t handle, size_t which)
 {
+    if (self->queue_app != NULL) return self->queue_app[handle*5 + which];
     const uint32_t *addr = &(self->sgtable[handle].app_0);
     return *(addr + which);
 }
+
+/***********************************************************************
+ * user memory implementation
+ **********************************************************************/
+static inline int pzdud_umem_register(pzdud_t *self, void *addr, const size_t bytes)
+{
+    pothos_zynq_dma_umem_t umem_args;
+    umem_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    umem_args.uaddr = addr;
+    umem_args.bytes = bytes;
+    umem_args.handle = 0;
+
+    //at most one segment per page, plus the splits of long contiguous runs
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    umem_args.num_segs = (((size_t)addr % page_size) + bytes + page_size - 1)/page_size + bytes/(XILINX_DMA_BD_LEN_MASK/2) + 1;
+    umem_args.segs = (pothos_zynq_dma_seg_t *)calloc(umem_args.num_segs, sizeof(pothos_zynq_dma_seg_t));
+
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_UMEM_REG, (void *)&umem_args) != 0)
+    {
+        perror("pzdud_umem_register::ioctl(umem_reg)");
+        free(umem_args.segs);
+        return PZDUD_ERROR_ALLOC;
+    }
+
+    self->umems[umem_args.handle] = umem_args;
+    return (int)umem_args.handle;
+}
+
+static inline int pzdud_umem_unregister(pzdud_t *self, const int region)
+{
+    if (region < 0 || region >= POTHOS_ZYNQ_DMA_UMEM_MAX) return PZDUD_ERROR_CONFIG;
+    pothos_zynq_dma_umem_t *umem = self->umems + region;
+    if (umem->segs == NULL) return PZDUD_ERROR_CONFIG;
+
+    const int ret = __pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_UMEM_UNREG, (void *)(size_t)region);
+    if (ret != 0 && errno == EBUSY) return PZDUD_ERROR_BUSY;
+    free(umem->segs);
+    memset(umem, 0, sizeof(pothos_zynq_dma_umem_t));
+    if (ret != 0)
+    {
+        perror("pzdud_umem_unregister::ioctl(umem_unreg)");
+        return PZDUD_ERROR_CONFIG;
+    }
+    return PZDUD_OK;
+}
+
+static inline int pzdud_submit_umem(pzdud_t *self, const int region, const size_t offset, const size_t length)
+{
+    //the kernel only loads DMA buffers into the SG table of a ring with queues
+    if (self->direction != PZDUD_MM2S || self->fillq != NULL) return PZDUD_ERROR_CONFIG;
+    if (region < 0 || region >= POTHOS_ZYNQ_DMA_UMEM_MAX) return PZDUD_ERROR_CONFIG;
+    const pothos_zynq_dma_umem_t *umem = self->umems + region;
+    if (umem->segs == NULL || length == 0) return PZDUD_ERROR_CONFIG;
+    if (offset > umem->bytes || length > umem->bytes - offset) return PZDUD_ERROR_CONFIG;
+
+    //locate the segment which contains the offset
+    size_t seg_index = 0;
+    size_t seg_offset = offset;
+    while (seg_offset >= umem->segs[seg_index].bytes) seg_offset -= umem->segs[seg_index++].bytes;
+
+    //count the descriptors for the range
+    size_t num = 0;
+    for (size_t remaining = seg_offset + length; remaining != 0; num++)
+    {
+        const size_t bytes = umem->segs[seg_index + num].bytes;
+        remaining -= (remaining < bytes)?remaining:bytes;
+    }
+
+    //the descriptors must be free to acquire from the head
+    if (__pzdud_num_claimed(self) + num > self->num_buffs) return PZDUD_ERROR_CLAIMED;
+    if (__pzdud_num_done(self, num) < num) return PZDUD_ERROR_COMPLETE;
+
+    //write back the range from the cache before the engine reads it
+    pothos_zynq_dma_umem_sync_t sync_args;
+    sync_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    sync_args.handle = region;
+    sync_args.offset = offset;
+    sync_args.bytes = length;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_UMEM_SYNC_DEVICE, (void *)&sync_args) != 0)
+    {
+        perror("pzdud_submit_umem::ioctl(umem_sync)");
+        return PZDUD_ERROR_CONFIG;
+    }
+
+    //the descriptors are ordered after the engine hand-off
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    //point each descriptor at a segment, the range is a single packet
+    size_t index = self->head_index;
+    size_t remaining = length;
+    for (size_t i = 0; i < num; i++)
+    {
+        const pothos_zynq_dma_seg_t *seg = umem->segs + seg_index + i;
+        const size_t begin = (i == 0)?seg_offset:0;
+        size_t bytes = seg->bytes - begin;
+        if (bytes > remaining) bytes = remaining;
+        remaining -= bytes;
+
+        xilinx_dma_desc_t *desc = self->sgtable + index;
+        desc->buf_addr = seg->paddr + begin;
+        desc->control = bytes | ((i == 0)?XILINX_DMA_BD_SOP:0) | ((i + 1 == num)?XILINX_DMA_BD_EOP:0);
+        desc->status = 0;
+        if (++index == self->num_buffs) index = 0;
+    }
+    self->umem_submitted = true;
+
+    //claim the descriptors as one acquire and release them to the engine
+    self->head_index = index;
+    __pzdud_store_release(&self->head_count, self->head_count + num);
+    __pzdud_publish_head(self);
+    __pzdud_advance_tail(self);
+
+    return (int)num;
+}
+
+/***********************************************************************
+ * dma-buf implementation
+ **********************************************************************/
+static inline int __pzdud_dmabuf_export(pzdud_t *self, const size_t handle, const size_t flags)
+{
+    pothos_zynq_dma_export_t export_args;
+    export_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    export_args.handle = handle;
+    export_args.flags = flags;
+    export_args.fd = -1;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_EXPORT, (void *)&export_args) != 0)
+    {
+        perror("pzdud_dmabuf_export::ioctl(export)");
+        return PZDUD_ERROR_CONFIG;
+    }
+    return export_args.fd;
+}
+
+static inline int pzdud_dmabuf_export(pzdud_t *self, const size_t handle)
+{
+    return __pzdud_dmabuf_export(self, handle, 0);
+}
+
+static inline int pzdud_dmabuf_export_slab(pzdud_t *self)
+{
+    return __pzdud_dmabuf_export(self, 0, POTHOS_ZYNQ_DMA_EXPORT_SLAB);
+}
+
+static inline int pzdud_dmabuf_import(pzdud_t *self, const int fd)
+{
+    //the size of a dma-buf is the end of its file
+    const off_t bytes = lseek(fd, 0, SEEK_END);
+    if (bytes <= 0)
+    {
+        perror("pzdud_dmabuf_import::lseek()");
+        return PZDUD_ERROR_CONFIG;
+    }
+
+    pothos_zynq_dma_import_t import_args;
+    import_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    import_args.fd = fd;
+    import_args.bytes = 0;
+    import_args.handle = 0;
+
+    //at most one segment per page, plus the splits of long contiguous runs
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    import_args.num_segs = ((size_t)bytes + page_size - 1)/page_size + (size_t)bytes/(XILINX_DMA_BD_LEN_MASK/2) + 1;
+    import_args.segs = (pothos_zynq_dma_seg_t *)calloc(import_args.num_segs, sizeof(pothos_zynq_dma_seg_t));
+
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_IMPORT, (void *)&import_args) != 0)
+    {
+        perror("pzdud_dmabuf_import::ioctl(import)");
+        free(import_args.segs);
+        return PZDUD_ERROR_CONFIG;
+    }
+
+    //the region is used like registered user memory
+    pothos_zynq_dma_umem_t *umem = self->umems + import_args.handle;
+    umem->sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    umem->uaddr = NULL;
+    umem->bytes = import_args.bytes;
+    umem->handle = import_args.handle;
+    umem->num_segs = import_args.num_segs;
+    umem->segs = import_args.segs;
+    return (int)import_args.handle;
+}
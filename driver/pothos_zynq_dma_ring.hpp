@@ -0,0 +1,241 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Header-only C++ wrapper for the AXI DMA userspace driver.
+ *
+ * The ring is specialized at compile time on the channel direction
+ * and optionally on the number of buffers, which removes the runtime
+ * direction branches and the modulo from the acquire/release path.
+ * The wrapper is a lightweight view over an allocated pzdud_t and
+ * may be freely mixed with the C API on the same instance.
+ * Buffer handles refer to the pzdud_t rather than to the ring,
+ * so they may outlive the ring view that acquired them.
+ **********************************************************************/
+
+#pragma once
+#include "pothos_zynq_dma_driver.h"
+#include <cstddef>
+#include <utility> //swap
+
+/*!
+ * Index arithmetic for a ring with a compile-time number of buffers.
+ * Power-of-two rings wrap with a mask, other sizes with a compare.
+ * The wrap is passed to the acquire and release paths of the C API.
+ */
+template <size_t NumBuffs>
+struct PzdudRingIndex
+{
+    static const bool isPow2 = (NumBuffs & (NumBuffs - 1)) == 0;
+
+    static size_t next(const pzdud_t *, const size_t index)
+    {
+        if (isPow2) return (index + 1) & (NumBuffs - 1);
+        return (index + 1 == NumBuffs)?0:(index + 1);
+    }
+};
+
+/*!
+ * Index arithmetic for a ring sized at runtime by pzdud_alloc(),
+ * which is the same wrap as the C API.
+ */
+template <>
+struct PzdudRingIndex<0>
+{
+    static size_t next(const pzdud_t *self, const size_t index)
+    {
+        return __pzdud_next(self, index);
+    }
+};
+
+/*!
+ * A DMA channel ring specialized on direction and ring size.
+ * Construct the ring after pzdud_alloc() on the same instance;
+ * when NumBuffs is non-zero it must match the allocated number.
+ */
+template <pzdud_dir_t Dir, size_t NumBuffs = 0>
+class PzdudRing
+{
+public:
+
+    /*!
+     * A move-only buffer handle from PzdudRing::acquire().
+     * The buffer is released back to the engine on destruction,
+     * using the length from setLength() for the MM2S direction.
+     * The handle keeps the pzdud_t, which must outlive the handle.
+     */
+    class Buffer
+    {
+    public:
+        Buffer(void):
+            _self(nullptr),
+            _handle(0),
+            _length(0)
+        {
+            return;
+        }
+
+        Buffer(pzdud_t *self, const size_t handle, const size_t length):
+            _self(self),
+            _handle(handle),
+            _length(length)
+        {
+            return;
+        }
+
+        Buffer(Buffer &&other):
+            Buffer()
+        {
+            this->swap(other);
+        }
+
+        Buffer &operator=(Buffer &&other)
+        {
+            this->release();
+            this->swap(other);
+            return *this;
+        }
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        ~Buffer(void)
+        {
+            this->release();
+        }
+
+        //! Does this handle own a buffer?
+        explicit operator bool(void) const
+        {
+            return _self != nullptr;
+        }
+
+        //! The handle value/buffer index
+        size_t handle(void) const
+        {
+            return _handle;
+        }
+
+        //! The userspace address of the buffer
+        void *data(void) const
+        {
+            return _self->allocs.buffs[_handle].uaddr;
+        }
+
+        //! The number of bytes received or available to fill
+        size_t length(void) const
+        {
+            return _length;
+        }
+
+        //! Set the number of bytes to submit (MM2S only)
+        void setLength(const size_t length)
+        {
+            _length = length;
+        }
+
+        //! Release the buffer back to the engine now
+        void release(void)
+        {
+            if (_self == nullptr) return;
+            PzdudRing::releaseHandle(_self, _handle, _length);
+            _self = nullptr;
+        }
+
+        //! Give up ownership without releasing, returns the handle
+        size_t detach(void)
+        {
+            _self = nullptr;
+            return _handle;
+        }
+
+    private:
+        void swap(Buffer &other)
+        {
+            std::swap(_self, other._self);
+            std::swap(_handle, other._handle);
+            std::swap(_length, other._length);
+        }
+
+        pzdud_t *_self;
+        size_t _handle;
+        size_t _length;
+    };
+
+    PzdudRing(pzdud_t *self):
+        _self(self)
+    {
+        return;
+    }
+
+    //! Wait for the head buffer, see pzdud_wait()
+    int wait(const long timeout_us)
+    {
+        return pzdud_wait(_self, timeout_us);
+    }
+
+    //! Wait for a batch of buffers, see pzdud_wait_n()
+    int wait(const size_t minNum, const long timeout_us, size_t &numReady)
+    {
+        return pzdud_wait_n(_self, minNum, timeout_us, &numReady);
+    }
+
+    /*!
+     * Acquire the head buffer, see pzdud_acquire().
+     * \param [out] length the buffer length in bytes
+     * \return the handle or negative error code
+     */
+    int acquire(size_t &length)
+    {
+        return __pzdud_acquire_head(_self, Dir, &PzdudRingIndex<NumBuffs>::next, &length);
+    }
+
+    /*!
+     * Acquire the head buffer with its completion time, see pzdud_acquire_ts().
+     * \param [out] length the buffer length in bytes
+     * \param [out] timeNs the CLOCK_MONOTONIC completion time in nanoseconds
+     * \param [out] kernelTime true when the time was recorded by the kernel
+     * \return the handle or negative error code
+     */
+    int acquire(size_t &length, long long &timeNs, bool &kernelTime)
+    {
+        kernelTime = __pzdud_head_time(_self, &timeNs);
+        const int handle = this->acquire(length);
+        if (handle >= 0 and not kernelTime) timeNs = __pzdud_time_ns();
+        return handle;
+    }
+
+    //! Acquire the head buffer as an RAII handle (empty on error)
+    Buffer acquire(void)
+    {
+        size_t length = 0;
+        const int handle = this->acquire(length);
+        if (handle < 0) return Buffer();
+        return Buffer(_self, size_t(handle), length);
+    }
+
+    //! Release a buffer back to the engine, see pzdud_release()
+    void release(const size_t handle, const size_t length)
+    {
+        PzdudRing::releaseHandle(_self, handle, length);
+    }
+
+    //! Release many buffers with one doorbell, see pzdud_release_many()
+    void releaseMany(const size_t *handles, const size_t *lengths, const size_t num)
+    {
+        for (size_t i = 0; i < num; i++)
+        {
+            __pzdud_release_desc_dir(_self, Dir, handles[i], (lengths == nullptr)?0:lengths[i]);
+        }
+        __pzdud_advance_tail_next(_self, &PzdudRingIndex<NumBuffs>::next);
+    }
+
+private:
+    static void releaseHandle(pzdud_t *self, const size_t handle, const size_t length)
+    {
+        __pzdud_release_desc_dir(self, Dir, handle, length);
+        __pzdud_advance_tail_next(self, &PzdudRingIndex<NumBuffs>::next);
+    }
+
+    pzdud_t *_self;
+};
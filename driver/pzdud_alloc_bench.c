@@ -0,0 +1,116 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Ring allocation benchmark on the hardware:
+ * compare per-buffer allocations against a single slab allocation
+ * for the ring setup time and the data TLB misses when the CPU
+ * touches every buffer in the ring.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "pothos_zynq_dma_driver.h"
+
+#define NUM_SETUPS 10
+#define NUM_PASSES 16
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/***********************************************************************
+ * Data TLB read miss counter from perf events
+ **********************************************************************/
+static int dtlb_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long long dtlb_read(const int fd)
+{
+    unsigned long long count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+    return count;
+}
+
+/***********************************************************************
+ * Measure setup and access costs for the given allocation flags
+ **********************************************************************/
+static int bench_alloc(const char *name, const size_t index, const size_t num_buffs, const size_t buff_size, const int flags)
+{
+    pzdud_t *s2mm = pzdud_create(index, PZDUD_S2MM);
+    if (s2mm == NULL) return EXIT_FAILURE;
+
+    //time the allocation, mapping, and release of the entire ring
+    double setup_time = 0.0;
+    for (size_t n = 0; n < NUM_SETUPS; n++)
+    {
+        const double t0 = now_sec();
+        int ret = pzdud_alloc_ex(s2mm, num_buffs, buff_size, flags);
+        if (ret == PZDUD_OK) ret = pzdud_init(s2mm, false);
+        setup_time += now_sec() - t0;
+        if (ret != PZDUD_OK)
+        {
+            printf("Fail %s setup %d\n", name, ret);
+            pzdud_destroy(s2mm);
+            return EXIT_FAILURE;
+        }
+        if (n + 1 == NUM_SETUPS) break; //keep the last ring for access
+        pzdud_halt(s2mm);
+        pzdud_free(s2mm);
+    }
+
+    //touch one word per cache line in every buffer of the ring
+    const int dtlb_fd = dtlb_open();
+    const unsigned long long misses0 = dtlb_read(dtlb_fd);
+    const double t0 = now_sec();
+    volatile uint32_t sum = 0;
+    for (size_t pass = 0; pass < NUM_PASSES; pass++)
+    {
+        for (size_t handle = 0; handle < num_buffs; handle++)
+        {
+            const uint32_t *p = (const uint32_t *)pzdud_addr(s2mm, handle);
+            for (size_t i = 0; i < buff_size/sizeof(uint32_t); i += 64/sizeof(uint32_t)) sum += p[i];
+        }
+    }
+    const double access_time = now_sec() - t0;
+    const unsigned long long misses = dtlb_read(dtlb_fd) - misses0;
+    if (dtlb_fd >= 0) close(dtlb_fd);
+
+    const double num_touched = (double)NUM_PASSES*num_buffs;
+    printf("%-12s setup %8.3f ms  access %8.1f ns/buffer  ", name, setup_time*1e3/NUM_SETUPS, access_time*1e9/num_touched);
+    if (dtlb_fd >= 0) printf("dTLB misses %8.3f /buffer\n", misses/num_touched);
+    else printf("dTLB misses n/a\n");
+
+    pzdud_halt(s2mm);
+    pzdud_free(s2mm);
+    pzdud_destroy(s2mm);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t index = (argc > 1)?strtoul(argv[1], NULL, 10):0;
+    const size_t num_buffs = (argc > 2)?strtoul(argv[2], NULL, 10):2048;
+    const size_t buff_size = (argc > 3)?strtoul(argv[3], NULL, 10):4096;
+    printf("S2MM ring on engine %zu: %zu x %zu byte buffers\n", index, num_buffs, buff_size);
+
+    if (bench_alloc("per-buffer", index, num_buffs, buff_size, 0) != EXIT_SUCCESS) return EXIT_FAILURE;
+    if (bench_alloc("slab", index, num_buffs, buff_size, PZDUD_ALLOC_SLAB) != EXIT_SUCCESS) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include <stdio.h>
+#include <time.h>
+
+//count every register write made by the driver
+static unsigned long long mmio_writes = 0;
+#define PZDUD_MMIO_WRITE_HOOK(addr, val) mmio_writes++
+
+#include "pzdud_sim.h"
+
+#define NUM_BUFFS 256
+#define BUFF_SIZE 4096
+#define BATCH_SIZE 32
+#define TOTAL_BYTES (1024*1024*1024ull)
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/***********************************************************************
+ * Stream through a simulated S2MM ring in batches,
+ * releasing per-buffer or with pzdud_release_many().
+ **********************************************************************/
+static void bench_release(const char *name, const bool many)
+{
+    pzdud_sim_t sim;
+    pzdud_t *s2mm = pzdud_sim_create(&sim, PZDUD_S2MM, NUM_BUFFS, BUFF_SIZE);
+    pzdud_init(s2mm, true);
+
+    size_t handles[BATCH_SIZE];
+    size_t lengths[BATCH_SIZE];
+    unsigned long long num_bytes = 0;
+    unsigned long long num_buffs = 0;
+
+    mmio_writes = 0;
+    const double t0 = now_sec();
+    while (num_bytes < TOTAL_BYTES)
+    {
+        pzdud_sim_run(&sim, BATCH_SIZE);
+        const int num = pzdud_acquire_many(s2mm, handles, lengths, BATCH_SIZE);
+        if (num < 0) continue;
+        for (int i = 0; i < num; i++) num_bytes += lengths[i];
+        num_buffs += num;
+
+        if (many) pzdud_release_many(s2mm, handles, NULL, num);
+        else for (int i = 0; i < num; i++) pzdud_release(s2mm, handles[i], 0);
+    }
+    const double t1 = now_sec();
+
+    const double mbytes = num_bytes/(1024.0*1024.0);
+    printf("%-24s %10.3f MMIO writes/MB %10.1f ns/buffer\n", name, mmio_writes/mbytes, (t1-t0)*1e9/num_buffs);
+    pzdud_sim_destroy(&sim);
+}
+
+int main(int argc, const char* argv[])
+{
+    printf("Simulated S2MM ring: %d x %d byte buffers, batches of %d\n", NUM_BUFFS, BUFF_SIZE, BATCH_SIZE);
+    bench_release("pzdud_release()", false);
+    bench_release("pzdud_release_many()", true);
+    return EXIT_SUCCESS;
+}
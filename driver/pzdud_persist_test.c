@@ -0,0 +1,62 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Test for a persistent ring across a process restart:
+ * the engine keeps completing while no process is attached,
+ * the new process continues from the same head and tail,
+ * the buffers held by the old process come back in order,
+ * and a doorbell lost in the crash is repeated on attach.
+ **********************************************************************/
+
+#include <stdio.h>
+#include "pzdud_sim.h"
+
+int main(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_S2MM, false);
+    if (dma == NULL) return EXIT_FAILURE;
+    errors += pzdud_sim_check(pzdud_sim_reattach(&sim) == NULL, "attach without persistence");
+    errors += pzdud_sim_check(pzdud_persist(dma, true) == PZDUD_OK, "persist");
+
+    //the engine fills the ring, the old process holds one buffer
+    //and releases the one after it out of order
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "engine completions before the exit");
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, 4) == 4, "acquire before the exit");
+    pzdud_release(dma, handles[0], 0);
+    pzdud_release(dma, handles[1], 0);
+    pzdud_release(dma, handles[3], 0);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS + 2, "released count published");
+
+    //the process dies between publishing the range and the doorbell write
+    *((volatile uint32_t *)dma->tail_reg) = 0;
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 0, "engine stalls without the doorbell");
+
+    //the new process picks up at the buffer held by the old one
+    dma = pzdud_sim_reattach(&sim);
+    errors += pzdud_sim_check(dma != NULL, "reattach");
+    if (dma == NULL) return EXIT_FAILURE;
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 2, "engine completions after the repeated doorbell");
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire after the reattach");
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++)
+    {
+        const size_t handle = (i + 2) % PZDUD_SIM_NUM_BUFFS;
+        errors += pzdud_sim_check(handles[i] == handle, "handle order");
+        errors += pzdud_sim_check(lengths[i] == ((handle == 3)?0:PZDUD_SIM_BUFF_SIZE), "length of the buffer released out of order");
+        if (handle != 3) errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(dma, handle)) == i + 2, "sequence without a gap");
+    }
+
+    //the ring keeps going with the new process
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++) pzdud_release(dma, handles[i], 0);
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "engine completions with the new process");
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire with the new process");
+    errors += pzdud_sim_check(handles[0] == 2 && lengths[0] == PZDUD_SIM_BUFF_SIZE, "head with the new process");
+    errors += pzdud_sim_check(sim.num_errors == 0, "no descriptor completed twice");
+    pzdud_sim_destroy(&sim);
+
+    return pzdud_sim_report(errors);
+}
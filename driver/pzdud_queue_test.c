@@ -0,0 +1,112 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Test for a ring with kernel-managed fill and completion queues:
+ * a release list is a single kick, handles come back in completion order
+ * even when they were released out of order, MM2S lengths and app fields
+ * travel through the queue entries, and the ring can not be shared.
+ **********************************************************************/
+
+#include <stdio.h>
+#include "pzdud_sim.h"
+
+static int test_s2mm(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_S2MM, true);
+    if (dma == NULL) return 1;
+    errors += pzdud_sim_check(sim.kicks == 1, "one kick for the initial release");
+    errors += pzdud_sim_check(sim.queue_pending == PZDUD_SIM_NUM_BUFFS && sim.fillq->consumer == PZDUD_SIM_NUM_BUFFS, "all buffers loaded");
+
+    //completions are counted on the status page and posted by handle
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "engine completions");
+    size_t num_ready = 0;
+    errors += pzdud_sim_check(pzdud_wait_n(dma, PZDUD_SIM_NUM_BUFFS, 0, &num_ready) == 0 && num_ready == PZDUD_SIM_NUM_BUFFS, "wait for the batch");
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire all");
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++)
+    {
+        errors += pzdud_sim_check(handles[i] == i, "initial handle order");
+        errors += pzdud_sim_check(lengths[i] == PZDUD_SIM_BUFF_SIZE, "length from the completion entry");
+        errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(dma, handles[i])) == i, "initial sequence");
+    }
+
+    //out of order releases are loaded in release order, each list is one kick
+    const size_t first[2] = {2, 0};
+    pzdud_release_many(dma, first, NULL, 2);
+    errors += pzdud_sim_check(sim.kicks == 2, "one kick per release list");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 2, "engine completions after the first list");
+    const size_t rest[6] = {1, 3, 4, 5, 6, 7};
+    pzdud_release_many(dma, rest, NULL, 6);
+    errors += pzdud_sim_check(sim.kicks == 3, "one kick per release list");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 6, "engine completions after the rest");
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire in completion order");
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++)
+    {
+        errors += pzdud_sim_check(handles[i] == ((i < 2)?first[i]:rest[i - 2]), "handles in release order");
+        errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(dma, handles[i])) == PZDUD_SIM_NUM_BUFFS + i, "sequence in completion order");
+    }
+
+    //nothing is kicked without new entries, and the ring can not be shared
+    pzdud_release_many(dma, NULL, NULL, 0);
+    errors += pzdud_sim_check(sim.kicks == 3, "no kick for an empty release");
+    errors += pzdud_sim_check(pzdud_sim_subscribe(&sim, PZDUD_LAG_DROP) == NULL && errno == EOPNOTSUPP, "subscribe refused");
+    errors += pzdud_sim_check(__pzdud_ioctl(dma->fd, POTHOS_ZYNQ_DMA_PERSIST, (void *)1) != 0 && errno == EOPNOTSUPP, "persist refused");
+    errors += pzdud_sim_check(sim.num_errors == 0, "no descriptor completed twice");
+    pzdud_sim_destroy(&sim);
+    return errors;
+}
+
+static int test_mm2s(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_MM2S, true);
+    if (dma == NULL) return 1;
+    errors += pzdud_sim_check(sim.kicks == 0, "nothing loaded");
+
+    //the ring reset seeds the completion queue with every buffer
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire the seeded buffers");
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++)
+    {
+        errors += pzdud_sim_check(handles[i] == i && lengths[i] == PZDUD_SIM_BUFF_SIZE, "seeded handle");
+    }
+
+    //the lengths and app fields of the fill entries are loaded into the descriptors
+    pzdud_set_app_field(dma, 1, 0, 0xabcd);
+    const size_t send_lengths[3] = {100, 200, 300};
+    pzdud_release_many(dma, handles, send_lengths, 3);
+    errors += pzdud_sim_check(sim.kicks == 1, "one kick per release list");
+    errors += pzdud_sim_check((sim.sgtable[2].control & XILINX_DMA_BD_LEN_MASK) == 300, "length loaded");
+    errors += pzdud_sim_check(sim.sgtable[1].app_0 == 0xabcd, "app field loaded");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 3, "engine completions");
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == 3, "acquire the sent buffers");
+    errors += pzdud_sim_check(handles[0] == 0 && handles[1] == 1 && handles[2] == 2, "sent handle order");
+    errors += pzdud_sim_check(pzdud_get_app_field(dma, 1, 0) == 0xabcd, "app field from the completion entry");
+    errors += pzdud_sim_check(sim.stats.bytes == 600 && sim.stats.completions == 3, "stats");
+
+    //an invalid length is refused by the kick
+    const size_t too_long = PZDUD_SIM_BUFF_SIZE + 1;
+    __pzdud_queue_fill(dma, handles[0], too_long);
+    dma->fill_pending = 0;
+    sim.fillq->producer++;
+    errors += pzdud_sim_check(__pzdud_ioctl(dma->fd, POTHOS_ZYNQ_DMA_KICK, NULL) != 0 && errno == EINVAL, "length refused");
+    errors += pzdud_sim_check(sim.kicks == 1 && sim.queue_pending == 0, "nothing loaded for a refused entry");
+    errors += pzdud_sim_check(sim.num_errors == 0, "no descriptor completed twice");
+    pzdud_sim_destroy(&sim);
+    return errors;
+}
+
+int main(void)
+{
+    int errors = 0;
+    errors += test_s2mm();
+    errors += test_mm2s();
+
+    return pzdud_sim_report(errors);
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Test for the in-place recovery from a DMA error:
+ * the descriptor in error is acquired with a zero length,
+ * the ring keeps going from the next descriptor,
+ * and the restart is reported on the status page and in the stats.
+ **********************************************************************/
+
+#include <stdio.h>
+#include "pzdud_sim.h"
+
+int main(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_S2MM, false);
+    if (dma == NULL) return EXIT_FAILURE;
+    errors += pzdud_sim_check(pzdud_restarts(dma) == 0, "no restarts after init");
+
+    //the second transfer ends in an error
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, 1) == 1, "engine completion before the error");
+    sim.fault = true;
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, 3) == 3, "engine completions through the error");
+    errors += pzdud_sim_check(pzdud_restarts(dma) == 1, "restart reported");
+    errors += pzdud_sim_check(pzdud_restarts(dma) == 0, "restart reported once");
+
+    //every descriptor is acquired in order, the one in error is empty
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == 4, "acquire through the error");
+    for (size_t i = 0; i < 4; i++)
+    {
+        errors += pzdud_sim_check(handles[i] == i, "handle order");
+        errors += pzdud_sim_check(lengths[i] == ((i == 1)?0:PZDUD_SIM_BUFF_SIZE), "length of the descriptor in error");
+    }
+    errors += pzdud_sim_check((dma->sgtable[1].status & XILINX_DMA_BD_ERR_ALL_MASK) != 0, "error bits in the descriptor");
+    errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(dma, 2)) == 2, "transfer after the error");
+
+    //the error cause and the restart are in the stats
+    pzdud_stats_t stats = {0};
+    errors += pzdud_sim_check(pzdud_get_stats(dma, &stats) == PZDUD_OK, "get stats");
+    errors += pzdud_sim_check(stats.error_irqs == 1, "stats error interrupts");
+    errors += pzdud_sim_check(stats.restarts == 1, "stats restarts");
+    errors += pzdud_sim_check(stats.errors != 0, "stats error cause");
+    errors += pzdud_sim_check(stats.completions == 4, "stats completions");
+
+    //the released buffers go around again without errors
+    for (size_t i = 0; i < 4; i++) pzdud_release(dma, handles[i], 0);
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "engine completions after the restart");
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire after the restart");
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++) errors += pzdud_sim_check(lengths[i] == PZDUD_SIM_BUFF_SIZE, "length after the restart");
+    errors += pzdud_sim_check(pzdud_restarts(dma) == 0, "no restarts without errors");
+    pzdud_sim_destroy(&sim);
+
+    return pzdud_sim_report(errors);
+}
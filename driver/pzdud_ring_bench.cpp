@@ -0,0 +1,101 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pzdud_sim.h"
+#include "pothos_zynq_dma_ring.hpp"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <chrono>
+
+#define NUM_BUFFS 256
+#define BUFF_SIZE 4096
+#define NUM_ITERS (1 << 22)
+
+/***********************************************************************
+ * CPU cycle counter from perf events, falls back to nanoseconds
+ **********************************************************************/
+static int cycles_fd = -1;
+
+static void cycles_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long long cycles_now(void)
+{
+    unsigned long long count = 0;
+    if (cycles_fd >= 0 and read(cycles_fd, &count, sizeof(count)) == sizeof(count)) return count;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/***********************************************************************
+ * Time acquire + release of one buffer on a simulated S2MM ring,
+ * the engine is run in large batches outside of the timed region
+ **********************************************************************/
+template <typename Fcn>
+static void bench(const char *name, Fcn &&acquireRelease)
+{
+    pzdud_sim_t sim;
+    pzdud_t *s2mm = pzdud_sim_create(&sim, PZDUD_S2MM, NUM_BUFFS, BUFF_SIZE);
+    pzdud_init(s2mm, true);
+
+    unsigned long long total = 0;
+    size_t numBuffs = 0;
+    while (numBuffs < NUM_ITERS)
+    {
+        const size_t num = pzdud_sim_run(&sim, NUM_BUFFS);
+        const unsigned long long t0 = cycles_now();
+        for (size_t i = 0; i < num; i++) acquireRelease(s2mm);
+        total += cycles_now() - t0;
+        numBuffs += num;
+    }
+
+    std::printf("%-28s %8.1f %s/buffer\n", name, double(total)/numBuffs, (cycles_fd >= 0)?"cycles":"ns");
+    pzdud_sim_destroy(&sim);
+}
+
+int main(int, const char**)
+{
+    cycles_open();
+    std::printf("Simulated S2MM ring: %d x %d byte buffers\n", NUM_BUFFS, BUFF_SIZE);
+
+    bench("C API", [](pzdud_t *s2mm)
+    {
+        size_t length = 0;
+        const int handle = pzdud_acquire(s2mm, &length);
+        pzdud_release(s2mm, handle, 0);
+    });
+
+    bench("PzdudRing<S2MM>", [](pzdud_t *s2mm)
+    {
+        PzdudRing<PZDUD_S2MM> ring(s2mm);
+        size_t length = 0;
+        const int handle = ring.acquire(length);
+        ring.release(handle, 0);
+    });
+
+    bench("PzdudRing<S2MM, 256>", [](pzdud_t *s2mm)
+    {
+        PzdudRing<PZDUD_S2MM, NUM_BUFFS> ring(s2mm);
+        size_t length = 0;
+        const int handle = ring.acquire(length);
+        ring.release(handle, 0);
+    });
+
+    bench("PzdudRing<S2MM, 256>::Buffer", [](pzdud_t *s2mm)
+    {
+        PzdudRing<PZDUD_S2MM, NUM_BUFFS> ring(s2mm);
+        auto buff = ring.acquire();
+    });
+
+    return EXIT_SUCCESS;
+}
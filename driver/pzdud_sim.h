@@ -0,0 +1,974 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Simulated AXI DMA engine for exercising the userspace driver
+ * without hardware: the register space and scatter/gather table
+ * live in ordinary memory and pzdud_sim_run() plays the engine.
+ **********************************************************************/
+
+#pragma once
+#include <errno.h>
+#include <sched.h>
+
+//driver ioctls on a simulated instance are handled by the simulation
+static inline int pzdud_sim_ioctl(int fd, unsigned long request, void *arg);
+#define PZDUD_IOCTL_HOOK pzdud_sim_ioctl
+#include "pothos_zynq_dma_driver.h"
+
+//! Fake physical base address of the simulated SG table
+#define PZDUD_SIM_SG_PADDR 0x10000000
+
+//! Fake physical base address of the simulated buffers
+#define PZDUD_SIM_BUFF_PADDR 0x20000000
+
+//! Fake physical base address of the simulated user memory
+#define PZDUD_SIM_UMEM_PADDR 0x40000000
+
+//! Page size of the simulated user memory, each page is a separate segment
+#define PZDUD_SIM_UMEM_PAGE 4096
+
+//! Number of buffers in the ring of pzdud_sim_setup()
+#define PZDUD_SIM_NUM_BUFFS 8
+
+//! Size of the buffers in the ring of pzdud_sim_setup()
+#define PZDUD_SIM_BUFF_SIZE 1024
+
+//! The maximum number of simulated instances at once
+#define PZDUD_SIM_MAX 16
+
+//! Simulated engine state for a single channel
+typedef struct
+{
+    pzdud_t *dma; //!< the user dma instance under test
+    xilinx_dma_desc_t *sgtable; //!< the SG table, only the kernel's with queues
+    size_t cur_index; //!< index of the current descriptor
+    bool idle; //!< engine completed the current descriptor
+    size_t num_completed; //!< total descriptors completed
+    size_t num_errors; //!< submitted descriptors that were still completed
+
+    //emulation of the kernel's completion tracking
+    pothos_zynq_dma_status_t status; //!< the completion status page
+    pothos_zynq_dma_ctrl_t ctrl; //!< the control page
+    size_t irq_index; //!< the next descriptor to count as completed
+    size_t irq_coalesce; //!< completions per interrupt (default 1)
+    size_t irq_pending; //!< completions since the last interrupt
+    bool poll_moder; //!< poll moderation is configured
+    bool polling; //!< the interrupt is masked and each run is a polling pass
+    pothos_zynq_dma_stats_t stats; //!< the channel statistics
+    long long last_complete_us; //!< the time of the last counted completion
+    pothos_zynq_dma_time_t *times; //!< the completion timestamps
+    uint32_t *lengths; //!< the completion lengths, after the timestamps
+    pothos_zynq_dma_cursor_t cursors[POTHOS_ZYNQ_DMA_SUBS_MAX]; //!< the subscriber cursor pages
+    bool umems[POTHOS_ZYNQ_DMA_UMEM_MAX]; //!< registered user memory by handle
+    size_t umem_syncs; //!< user memory cache maintenance calls
+    bool removed; //!< the engine was removed, ioctls fail with ENODEV
+    bool fault; //!< the next descriptor (and the rest of its MM2S packet) ends in a DMA error
+    bool persistent; //!< the ring outlives the instance, see pzdud_sim_reattach()
+    bool ownerless; //!< the owner exited with subscribers, see pzdud_sim_close_owner()
+
+    //emulation of the kernel-managed SG table, see pzdud_sim_use_queues()
+    pothos_zynq_dma_queue_t *fillq; //!< the fill queue page
+    pothos_zynq_dma_queue_t *compq; //!< the completion queue page
+    uint32_t *desc_handles; //!< the handle loaded into each descriptor
+    size_t fill_index; //!< the next fill entry to load
+    uint32_t fill_consumer; //!< the fill entries loaded
+    size_t queue_tail; //!< the next free descriptor to load
+    size_t queue_pending; //!< descriptors loaded and not posted
+    size_t comp_index; //!< the next completion entry to post
+    uint32_t comp_producer; //!< the completion entries posted
+    size_t kicks; //!< kick ioctls which loaded descriptors
+} pzdud_sim_t;
+
+//! Simulated instances by slot, the fd of an instance encodes its slot
+//! and the fd of a subscriber encodes its subscriber slot as well
+static pzdud_sim_t *pzdud_sim_slots[PZDUD_SIM_MAX];
+
+/*!
+ * Create a user DMA instance backed by a simulated engine.
+ * The instance is already allocated and can be passed to pzdud_init().
+ */
+static inline pzdud_t *pzdud_sim_create(pzdud_sim_t *sim, const pzdud_dir_t direction, const size_t num_buffs, const size_t buff_size)
+{
+    pzdud_t *self = (pzdud_t *)calloc(1, sizeof(pzdud_t));
+    self->fd = -1;
+    for (int slot = 0; slot < PZDUD_SIM_MAX; slot++)
+    {
+        if (pzdud_sim_slots[slot] != NULL) continue;
+        pzdud_sim_slots[slot] = sim;
+        self->fd = -2 - slot;
+        break;
+    }
+    self->regs = calloc(1, POTHOS_ZYNQ_DMA_REGS_SIZE);
+    self->direction = direction;
+
+    const size_t chan_off = (direction == PZDUD_S2MM)?XILINX_DMA_RX_CHANNEL_OFFSET:0;
+    self->ctrl_reg = ((char *)self->regs) + chan_off + XILINX_DMA_MM2S_DMACR_OFFSET;
+    self->stat_reg = ((char *)self->regs) + chan_off + XILINX_DMA_MM2S_DMASR_OFFSET;
+    self->head_reg = ((char *)self->regs) + chan_off + XILINX_DMA_MM2S_CURDESC_OFFSET;
+    self->tail_reg = ((char *)self->regs) + chan_off + XILINX_DMA_MM2S_TAILDESC_OFFSET;
+    __pzdud_write32(self->stat_reg, 0x8); //SG included
+
+    //buffers and the SG table come from the heap
+    self->num_buffs = num_buffs;
+    self->buff_size = buff_size;
+    self->allocs.num_buffs = num_buffs;
+    self->allocs.buffs = (pothos_zynq_dma_buff_t *)calloc(num_buffs, sizeof(pothos_zynq_dma_buff_t));
+    for (size_t i = 0; i < num_buffs; i++)
+    {
+        pothos_zynq_dma_buff_t *buff = self->allocs.buffs + i;
+        buff->bytes = buff_size;
+        buff->paddr = PZDUD_SIM_BUFF_PADDR + i*buff_size;
+        buff->uaddr = calloc(1, buff_size);
+    }
+    pothos_zynq_dma_buff_t *sgbuff = &self->allocs.sgbuff;
+    sgbuff->bytes = num_buffs*sizeof(xilinx_dma_desc_t);
+    sgbuff->paddr = PZDUD_SIM_SG_PADDR;
+    if (posix_memalign(&sgbuff->uaddr, sizeof(xilinx_dma_desc_t), sgbuff->bytes) != 0) return NULL;
+    self->sgtable = (xilinx_dma_desc_t *)sgbuff->uaddr;
+
+    sim->dma = self;
+    sim->sgtable = self->sgtable;
+    sim->cur_index = 0;
+    sim->idle = false;
+    sim->num_completed = 0;
+    sim->num_errors = 0;
+    memset(&sim->status, 0, sizeof(sim->status));
+    sim->irq_index = 0;
+    sim->irq_coalesce = 1;
+    sim->irq_pending = 0;
+    sim->poll_moder = false;
+    sim->polling = false;
+    memset(&sim->ctrl, 0, sizeof(sim->ctrl));
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    sim->last_complete_us = 0;
+    sim->times = (pothos_zynq_dma_time_t *)calloc(num_buffs, sizeof(pothos_zynq_dma_time_t) + sizeof(uint32_t));
+    sim->lengths = (uint32_t *)(sim->times + num_buffs);
+    memset(sim->cursors, 0, sizeof(sim->cursors));
+    memset(sim->umems, 0, sizeof(sim->umems));
+    sim->umem_syncs = 0;
+    sim->removed = false;
+    sim->fault = false;
+    sim->persistent = false;
+    sim->ownerless = false;
+    sim->fillq = NULL;
+    sim->compq = NULL;
+    sim->desc_handles = NULL;
+    sim->kicks = 0;
+    if (num_buffs >= 2) self->status = &sim->status;
+    if (num_buffs >= 2) self->ctrl = &sim->ctrl;
+    if (num_buffs >= 2) self->times = sim->times;
+    if (num_buffs >= 2) self->lengths = sim->lengths;
+    self->cursors = (const char *)sim->cursors;
+    self->cursor_stride = sizeof(pothos_zynq_dma_cursor_t);
+    return self;
+}
+
+/*!
+ * Destroy a user DMA instance from pzdud_sim_create().
+ */
+static inline void pzdud_sim_destroy(pzdud_sim_t *sim)
+{
+    pzdud_t *self = sim->dma;
+    if (self->fd <= -2) pzdud_sim_slots[-2 - self->fd] = NULL;
+    for (size_t i = 0; i < self->num_buffs; i++) free(self->allocs.buffs[i].uaddr);
+    free(self->allocs.buffs);
+    free(self->allocs.sgbuff.uaddr);
+    free(sim->times);
+    free(sim->fillq);
+    free(sim->compq);
+    free(sim->desc_handles);
+    free(self->queue_app);
+    free(self->regs);
+    free(self);
+}
+
+/*!
+ * Give the simulated instance a kernel-managed SG table with fill and
+ * completion queues, like an allocation with PZDUD_ALLOC_QUEUES.
+ * Call after pzdud_sim_create() and before pzdud_init():
+ * the SG table is only seen by the simulated engine and kernel.
+ */
+static inline void pzdud_sim_use_queues(pzdud_sim_t *sim)
+{
+    pzdud_t *self = sim->dma;
+    const size_t queue_bytes = sizeof(pothos_zynq_dma_queue_t) + self->num_buffs*sizeof(pothos_zynq_dma_queue_entry_t);
+    sim->fillq = (pothos_zynq_dma_queue_t *)calloc(1, queue_bytes);
+    sim->compq = (pothos_zynq_dma_queue_t *)calloc(1, queue_bytes);
+    sim->desc_handles = (uint32_t *)calloc(self->num_buffs, sizeof(uint32_t));
+    self->allocs.flags |= POTHOS_ZYNQ_DMA_ALLOC_QUEUES;
+    self->fillq = sim->fillq;
+    self->compq = sim->compq;
+    self->queue_app = (uint32_t *)calloc(self->num_buffs*5, sizeof(uint32_t));
+    self->sgtable = NULL;
+}
+
+/*!
+ * Emulate the exit of the process which owns the simulated instance,
+ * and a new process which attaches to its persistent ring.
+ * The engine may keep running in between, on the old instance's ring.
+ * The new instance shares the buffers and pages rather than mapping them,
+ * and restores the ring state from the attach ioctl like pzdud_attach().
+ * \return the new instance, or NULL when the ring is not persistent
+ */
+static inline pzdud_t *pzdud_sim_reattach(pzdud_sim_t *sim)
+{
+    if (!sim->persistent) return NULL;
+    pzdud_t *old = sim->dma;
+    pzdud_t *self = (pzdud_t *)calloc(1, sizeof(pzdud_t));
+    self->fd = old->fd;
+    self->regs = old->regs;
+    self->direction = old->direction;
+    self->ctrl_reg = old->ctrl_reg;
+    self->stat_reg = old->stat_reg;
+    self->head_reg = old->head_reg;
+    self->tail_reg = old->tail_reg;
+    self->num_buffs = old->num_buffs;
+    self->buff_size = old->buff_size;
+    self->allocs = old->allocs;
+    self->sgtable = old->sgtable;
+    self->status = old->status;
+    self->ctrl = old->ctrl;
+    self->times = old->times;
+    self->lengths = old->lengths;
+    self->cursors = old->cursors;
+    self->cursor_stride = old->cursor_stride;
+    sim->dma = self;
+    free(old);
+
+    pothos_zynq_dma_alloc_t attach_args;
+    memset(&attach_args, 0, sizeof(attach_args));
+    attach_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    if (__pzdud_ioctl(self->fd, POTHOS_ZYNQ_DMA_ATTACH, (void *)&attach_args) != 0) return NULL;
+    if (__pzdud_restore_ring(self, &attach_args.ring) != PZDUD_OK) return NULL;
+    return self;
+}
+
+/*!
+ * Emulate another process which subscribes to the simulated S2MM ring.
+ * The subscriber shares the pages of the owner rather than mapping them,
+ * and starts from the subscribe ioctl like pzdud_subscribe().
+ * \return the subscriber instance, or NULL when the ioctl fails
+ */
+static inline pzdud_t *pzdud_sim_subscribe(pzdud_sim_t *sim, const pzdud_lag_policy_t policy)
+{
+    pzdud_t *owner = sim->dma;
+    pothos_zynq_dma_subscribe_t sub_args;
+    memset(&sub_args, 0, sizeof(sub_args));
+    sub_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    sub_args.direction = POTHOS_ZYNQ_DMA_S2MM;
+    sub_args.policy = (policy == PZDUD_LAG_DROP)?POTHOS_ZYNQ_DMA_LAG_DROP:POTHOS_ZYNQ_DMA_LAG_BLOCK;
+    if (__pzdud_ioctl(owner->fd, POTHOS_ZYNQ_DMA_SUBSCRIBE, (void *)&sub_args) != 0) return NULL;
+
+    pzdud_t *self = (pzdud_t *)calloc(1, sizeof(pzdud_t));
+    self->fd = owner->fd - PZDUD_SIM_MAX*(1 + (int)sub_args.slot);
+    self->direction = PZDUD_S2MM;
+    self->num_buffs = owner->num_buffs;
+    self->buff_size = owner->buff_size;
+    self->allocs = owner->allocs;
+    self->sgtable = owner->sgtable;
+    self->status = owner->status;
+    self->ctrl = owner->ctrl;
+    self->times = owner->times;
+    self->lengths = owner->lengths;
+    self->cursors = owner->cursors;
+    self->cursor_stride = owner->cursor_stride;
+    self->cursor = sim->cursors + sub_args.slot;
+    __pzdud_sub_start(self, sub_args.slot, &sub_args.ring);
+    return self;
+}
+
+/*!
+ * Emulate the exit of a subscriber from pzdud_sim_subscribe():
+ * the slot is cleared and the owner stops checking its cursor.
+ */
+static inline void pzdud_sim_unsubscribe(pzdud_sim_t *sim, pzdud_t *self)
+{
+    const uint32_t bit = 1u << self->sub_slot;
+    sim->status.sub_block_mask &= ~bit;
+    __atomic_store_n(&sim->status.sub_mask, sim->status.sub_mask & ~bit, __ATOMIC_RELEASE);
+    if (sim->status.sub_mask == 0) sim->ownerless = false; //the last subscriber frees the ring
+    free(self);
+}
+
+/*!
+ * Emulate the exit of the process which owns the simulated instance
+ * while it has subscribers: the ring stays allocated without an owner,
+ * and the waits of the subscribers fail once they have acquired what was completed.
+ * The owner's instance is only used for pzdud_sim_destroy() afterwards.
+ */
+static inline void pzdud_sim_close_owner(pzdud_sim_t *sim)
+{
+    if (sim->status.sub_mask != 0) sim->ownerless = true;
+}
+
+//! Publish completions on the status page, like the end of the module's harvest
+static inline void pzdud_sim_publish(pzdud_sim_t *sim, const size_t num, const long long now_ns)
+{
+    pothos_zynq_dma_status_t *status = &sim->status;
+    const size_t num_buffs = sim->dma->num_buffs;
+    sim->irq_index = (sim->irq_index + num) % num_buffs;
+    status->last_index = (sim->irq_index + num_buffs - 1) % num_buffs;
+    __atomic_store_n(&status->completed, status->completed + (uint32_t)num, __ATOMIC_RELEASE);
+
+    sim->stats.completions += num;
+    sim->last_complete_us = now_ns/1000;
+    const int32_t occupancy = (int32_t)(status->completed - __atomic_load_n(&sim->ctrl.acquired, __ATOMIC_RELAXED));
+    if (occupancy > (int32_t)sim->stats.occupancy_max) sim->stats.occupancy_max = (uint32_t)occupancy;
+}
+
+/*!
+ * Count completions of the kernel-managed SG table and post their handles.
+ * This is the same tracking as the module's queue harvest:
+ * count the complete bits up to the loaded descriptors.
+ */
+static inline size_t pzdud_sim_harvest_queue(pzdud_sim_t *sim)
+{
+    const size_t num_buffs = sim->dma->num_buffs;
+    size_t num = 0;
+    for (size_t index = sim->irq_index; num < sim->queue_pending; index = (index + 1) % num_buffs)
+    {
+        if ((__atomic_load_n(&sim->sgtable[index].status, __ATOMIC_ACQUIRE) & (1 << 31)) == 0) break;
+        num++;
+    }
+    if (num == 0) return 0;
+
+    const long long now_ns = __pzdud_time_ns();
+    pothos_zynq_dma_queue_entry_t *entries = (pothos_zynq_dma_queue_entry_t *)(sim->compq + 1);
+    for (size_t i = 0, index = sim->irq_index; i < num; i++, index = (index + 1) % num_buffs)
+    {
+        const xilinx_dma_desc_t *desc = sim->sgtable + index;
+        const uint32_t handle = sim->desc_handles[index];
+        const uint32_t length = desc->status & XILINX_DMA_BD_LEN_MASK;
+        pothos_zynq_dma_queue_entry_t *entry = entries + sim->comp_index;
+        entry->handle = handle;
+        entry->length = length;
+        entry->status = desc->status & XILINX_DMA_BD_ERR_ALL_MASK;
+        entry->app[0] = desc->app_0;
+        entry->app[1] = desc->app_1;
+        entry->app[2] = desc->app_2;
+        entry->app[3] = desc->app_3;
+        entry->app[4] = desc->app_4;
+        sim->comp_index = (sim->comp_index + 1) % num_buffs;
+        sim->stats.bytes += length;
+        sim->times[handle] = (pothos_zynq_dma_time_t)now_ns;
+        sim->lengths[handle] = length;
+    }
+
+    sim->queue_pending -= num;
+    sim->comp_producer += (uint32_t)num;
+    __atomic_store_n(&sim->compq->producer, sim->comp_producer, __ATOMIC_RELEASE);
+    pzdud_sim_publish(sim, num, now_ns);
+    return num;
+}
+
+/*!
+ * Count completions for the status page.
+ * This is the same tracking as the module's interrupt handler:
+ * count by position up to the current descriptor register,
+ * and include the current descriptor once it is written back.
+ */
+static inline size_t pzdud_sim_harvest(pzdud_sim_t *sim)
+{
+    pzdud_t *self = sim->dma;
+    const size_t num_buffs = self->num_buffs;
+    if (self->status == NULL) return 0;
+    if (sim->compq != NULL) return pzdud_sim_harvest_queue(sim);
+
+    const size_t cur = __pzdud_phys_to_index(self, *((volatile uint32_t *)self->head_reg));
+    if (cur >= num_buffs) return 0;
+    if ((cur + 1) % num_buffs == sim->irq_index) return 0;
+
+    size_t num = (cur + num_buffs - sim->irq_index) % num_buffs;
+    if ((__atomic_load_n(&sim->sgtable[cur].status, __ATOMIC_ACQUIRE) & (1 << 31)) != 0) num++;
+    if (num == 0) return 0;
+
+    const long long now_ns = __pzdud_time_ns();
+    for (size_t i = 0, index = sim->irq_index; i < num; i++, index = (index + 1) % num_buffs)
+    {
+        const uint32_t desc_status = __atomic_load_n(&sim->sgtable[index].status, __ATOMIC_ACQUIRE);
+        const uint32_t length = ((desc_status & (1 << 31)) != 0)?(desc_status & 0x7fffff):(sim->sgtable[index].control & 0x7fffff);
+        sim->stats.bytes += length;
+        sim->times[index] = (pothos_zynq_dma_time_t)now_ns;
+        sim->lengths[index] = length;
+    }
+
+    pzdud_sim_publish(sim, num, now_ns);
+    return num;
+}
+
+/*!
+ * Emulate the kernel's completion interrupt for the status page.
+ * pzdud_sim_run() raises it every irq_coalesce completions,
+ * and it may also be called directly like a delay timer interrupt.
+ * Under poll moderation, an interrupt with completions masks
+ * the interrupt and pzdud_sim_run() polls until the ring drains.
+ */
+static inline void pzdud_sim_irq(pzdud_sim_t *sim)
+{
+    if (sim->dma->status == NULL) return;
+    sim->status.irq_count++;
+    sim->stats.irq_count++;
+    const size_t num = pzdud_sim_harvest(sim);
+    if (!sim->poll_moder || sim->polling || num == 0) return;
+    sim->polling = true;
+    sim->status.poll_entries++;
+}
+
+/*!
+ * Emulate a pass of the kernel's interrupt thread under poll moderation.
+ * While the interrupt is masked, every pzdud_sim_run() is a polling pass,
+ * and a pass that finds nothing new unmasks the interrupt.
+ */
+static inline void pzdud_sim_poll(pzdud_sim_t *sim)
+{
+    if (!sim->polling) return;
+    sim->status.poll_count++;
+    if (pzdud_sim_harvest(sim) == 0) sim->polling = false;
+}
+
+/*!
+ * Emulate the kernel's recovery from a DMA error:
+ * the descriptors handed back with the error are counted,
+ * the engine restarts after the current descriptor with the descriptors
+ * that the user handed to it, and the restart is published on the status page.
+ * \return true when the engine has descriptors to run after the restart
+ */
+static inline bool pzdud_sim_recover(pzdud_sim_t *sim)
+{
+    pzdud_t *self = sim->dma;
+    const size_t num_buffs = self->num_buffs;
+    sim->stats.errors |= 0x20; //DMASlvErr
+    sim->stats.error_irqs++;
+    sim->stats.restarts++;
+    if (self->status != NULL)
+    {
+        sim->status.errors |= 0x20;
+        pzdud_sim_harvest(sim);
+    }
+
+    //the descriptors cleared by the user, up to the released count
+    //and the releases of the blocking subscribers
+    size_t limit = num_buffs;
+    if (self->status != NULL && sim->compq == NULL)
+    {
+        uint32_t released = __atomic_load_n(&sim->ctrl.released, __ATOMIC_ACQUIRE);
+        for (uint32_t mask = sim->status.sub_block_mask; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t sub_released = __atomic_load_n(&sim->cursors[__builtin_ctz(mask)].released, __ATOMIC_ACQUIRE);
+            if ((int32_t)(sub_released - released) < 0) released = sub_released;
+        }
+        const int32_t handed = (int32_t)(released + (uint32_t)num_buffs - sim->status.completed);
+        limit = (handed <= 0)?0:(((size_t)handed < num_buffs)?(size_t)handed:num_buffs);
+    }
+    const size_t resume = (sim->cur_index + 1) % num_buffs;
+    size_t pending = 0;
+    while (pending < limit && __atomic_load_n(&sim->sgtable[(resume + pending) % num_buffs].status, __ATOMIC_ACQUIRE) == 0) pending++;
+    if (self->status != NULL) __atomic_store_n(&sim->status.restarts, sim->status.restarts + 1, __ATOMIC_RELEASE);
+
+    //without descriptors, the engine waits for the next tail descriptor write
+    volatile uint32_t *tail_reg = (volatile uint32_t *)self->tail_reg;
+    if (pending == 0)
+    {
+        sim->idle = true;
+        *tail_reg = 0;
+        return false;
+    }
+    sim->cur_index = resume;
+    *((volatile uint32_t *)self->head_reg) = __pzdud_virt_to_phys(sim->sgtable + resume, &self->allocs.sgbuff);
+    *tail_reg = __pzdud_virt_to_phys(sim->sgtable + (resume + pending - 1) % num_buffs, &self->allocs.sgbuff);
+    return true;
+}
+
+/*!
+ * Let the simulated engine complete up to max_num submitted descriptors.
+ * Transfers complete with the length programmed in the control word,
+ * and S2MM transfers stamp the first word of the buffer with a sequence number.
+ * With the fault flag set, the next packet completes with a slave error
+ * and the engine restarts at the following descriptor, like the kernel's recovery.
+ * The engine may run on its own thread concurrently with the driver calls.
+ * \return the number of descriptors completed by this call
+ */
+static inline size_t pzdud_sim_run(pzdud_sim_t *sim, const size_t max_num)
+{
+    pzdud_t *self = sim->dma;
+    volatile uint32_t *head_reg = (volatile uint32_t *)self->head_reg;
+    volatile uint32_t *tail_reg = (volatile uint32_t *)self->tail_reg;
+
+    //an idle engine resumes on the next tail descriptor write
+    uint32_t tail_paddr = *tail_reg;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (sim->idle)
+    {
+        if (tail_paddr == 0)
+        {
+            pzdud_sim_poll(sim);
+            return 0;
+        }
+        sim->cur_index = (sim->cur_index + 1) % self->num_buffs;
+        *head_reg = __pzdud_virt_to_phys(sim->sgtable + sim->cur_index, &self->allocs.sgbuff);
+        sim->idle = false;
+    }
+
+    size_t tail_index = __pzdud_phys_to_index(self, tail_paddr);
+    size_t num = 0;
+    bool faulted = false;
+    while (num < max_num)
+    {
+        //every descriptor up to the tail must have been released,
+        //except for the initial tail before anything was submitted
+        xilinx_dma_desc_t *desc = sim->sgtable + sim->cur_index;
+        if (__atomic_load_n(&desc->status, __ATOMIC_ACQUIRE) != 0)
+        {
+            if (sim->num_completed != 0) sim->num_errors++;
+            break;
+        }
+
+        //the descriptor in error is handed back with a zero length
+        //(sequence numbers of the other transfers skip it)
+        if (sim->fault)
+        {
+            __atomic_store_n(&desc->status, (1 << 31) | 0x20000000, __ATOMIC_RELEASE);
+            faulted = true;
+            if (self->direction == PZDUD_S2MM || (desc->control & XILINX_DMA_BD_EOP) != 0) sim->fault = false;
+        }
+        else
+        {
+            if (self->direction == PZDUD_S2MM)
+            {
+                const size_t handle = (desc->buf_addr - PZDUD_SIM_BUFF_PADDR)/self->buff_size;
+                *((uint32_t *)self->allocs.buffs[handle].uaddr) = (uint32_t)sim->num_completed;
+            }
+            __atomic_store_n(&desc->status, (1 << 31) | (desc->control & 0x7fffff), __ATOMIC_RELEASE);
+        }
+        sim->num_completed++;
+        num++;
+
+        //the recovery restarts the engine after the packet in error
+        if (faulted && !sim->fault)
+        {
+            faulted = false;
+            if (!pzdud_sim_recover(sim)) break;
+            tail_paddr = *tail_reg;
+            tail_index = __pzdud_phys_to_index(self, tail_paddr);
+            continue;
+        }
+
+        //engine register updates bypass the driver's MMIO write hook,
+        //the tail register is cleared to detect the next doorbell write
+        if (sim->cur_index == tail_index)
+        {
+            sim->idle = true;
+            __sync_bool_compare_and_swap(tail_reg, tail_paddr, 0);
+            break;
+        }
+        sim->cur_index = (sim->cur_index + 1) % self->num_buffs;
+        *head_reg = __pzdud_virt_to_phys(sim->sgtable + sim->cur_index, &self->allocs.sgbuff);
+    }
+
+    //while the interrupt is masked, the completions are polled
+    if (sim->polling)
+    {
+        pzdud_sim_poll(sim);
+        return num;
+    }
+
+    //completions raise an interrupt once the coalesce count is reached
+    sim->irq_pending += num;
+    if (sim->irq_pending >= sim->irq_coalesce)
+    {
+        sim->irq_pending = 0;
+        pzdud_sim_irq(sim);
+    }
+    return num;
+}
+
+/***********************************************************************
+ * Emulation of the kernel module's ioctls
+ **********************************************************************/
+static inline size_t pzdud_sim_num_done(pzdud_sim_t *sim, const int sub_slot, size_t index, const size_t max_num)
+{
+    //the kernel counts the completions of its SG table from the acquired count,
+    //and the completions of a subscriber from the acquired count on its cursor
+    if (sim->compq != NULL || sub_slot >= 0)
+    {
+        const uint32_t acquired = (sub_slot >= 0)?
+            __atomic_load_n(&sim->cursors[sub_slot].acquired, __ATOMIC_ACQUIRE):
+            __atomic_load_n(&sim->ctrl.acquired, __ATOMIC_ACQUIRE);
+        const int32_t ahead = (int32_t)(__atomic_load_n(&sim->status.completed, __ATOMIC_ACQUIRE) - acquired);
+        return (ahead <= 0)?0:(((size_t)ahead < max_num)?(size_t)ahead:max_num);
+    }
+
+    size_t num = 0;
+    while (num < max_num && (__atomic_load_n(&sim->sgtable[index].status, __ATOMIC_ACQUIRE) & (1 << 31)) != 0)
+    {
+        num++;
+        index = (index + 1) % sim->dma->num_buffs;
+    }
+    return num;
+}
+
+//! Register simulated user memory: every page is a separate segment,
+//! the fake physical pages are spaced apart so that none merge
+static inline int pzdud_sim_umem_reg(pzdud_sim_t *sim, const size_t start, const size_t bytes, size_t *handle_out, size_t *num_segs_inout, pothos_zynq_dma_seg_t *segs)
+{
+    size_t handle = 0;
+    while (handle < POTHOS_ZYNQ_DMA_UMEM_MAX && sim->umems[handle]) handle++;
+    if (handle == POTHOS_ZYNQ_DMA_UMEM_MAX)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+    size_t num_segs = 0;
+    for (size_t pos = start; pos < start + bytes; num_segs++)
+    {
+        const size_t page = pos/PZDUD_SIM_UMEM_PAGE - start/PZDUD_SIM_UMEM_PAGE;
+        const size_t end = (pos/PZDUD_SIM_UMEM_PAGE + 1)*PZDUD_SIM_UMEM_PAGE;
+        if (num_segs == *num_segs_inout)
+        {
+            errno = ENOSPC;
+            return -1;
+        }
+        segs[num_segs].paddr = PZDUD_SIM_UMEM_PADDR + handle*0x1000000 + page*2*PZDUD_SIM_UMEM_PAGE + pos%PZDUD_SIM_UMEM_PAGE;
+        segs[num_segs].bytes = ((end < start + bytes)?end:(start + bytes)) - pos;
+        pos += segs[num_segs].bytes;
+    }
+    *num_segs_inout = num_segs;
+    *handle_out = handle;
+    sim->umems[handle] = true;
+    return 0;
+}
+
+//! Seed the queues on a ring reset like the module: every descriptor is free,
+//! and the completed count ahead of the acquired count is handed out from handle 0
+static inline void pzdud_sim_queue_seed(pzdud_sim_t *sim, const uint32_t completed)
+{
+    const size_t num_buffs = sim->dma->num_buffs;
+    for (size_t i = 0; i < num_buffs; i++)
+    {
+        xilinx_dma_desc_t *desc = sim->sgtable + i;
+        memset(desc, 0, sizeof(xilinx_dma_desc_t));
+        desc->next_desc = PZDUD_SIM_SG_PADDR + ((i + 1) % num_buffs)*sizeof(xilinx_dma_desc_t);
+        desc->status = (1 << 31);
+        sim->desc_handles[i] = 0;
+    }
+    sim->queue_tail = 0;
+    sim->queue_pending = 0;
+
+    sim->fill_index = 0;
+    sim->fill_consumer = sim->ctrl.released;
+    sim->fillq->producer = sim->fill_consumer;
+    sim->fillq->consumer = sim->fill_consumer;
+
+    const int32_t ahead = (int32_t)(completed - sim->ctrl.acquired);
+    const size_t seed = (ahead <= 0)?0:(((size_t)ahead < num_buffs)?(size_t)ahead:num_buffs);
+    pothos_zynq_dma_queue_entry_t *entries = (pothos_zynq_dma_queue_entry_t *)(sim->compq + 1);
+    memset(entries, 0, num_buffs*sizeof(pothos_zynq_dma_queue_entry_t));
+    for (size_t i = 0; i < seed; i++) entries[i].handle = (uint32_t)i;
+    sim->comp_index = seed % num_buffs;
+    sim->comp_producer = completed;
+    sim->compq->consumer = sim->ctrl.acquired;
+    sim->compq->producer = completed;
+
+    //the engine is halted until the first kick loads descriptor 0
+    sim->idle = true;
+    sim->cur_index = num_buffs - 1;
+    *((volatile uint32_t *)sim->dma->tail_reg) = 0;
+}
+
+//! Load the published fill entries into the free descriptors like the module's kick
+static inline int pzdud_sim_kick(pzdud_sim_t *sim)
+{
+    pzdud_t *self = sim->dma;
+    const size_t num_buffs = self->num_buffs;
+    const bool mm2s = (self->direction == PZDUD_MM2S);
+    const uint32_t avail = __atomic_load_n(&sim->fillq->producer, __ATOMIC_ACQUIRE) - sim->fill_consumer;
+    const size_t num = (avail < num_buffs - sim->queue_pending)?avail:(num_buffs - sim->queue_pending);
+    const pothos_zynq_dma_queue_entry_t *entries = (const pothos_zynq_dma_queue_entry_t *)(sim->fillq + 1);
+
+    bool invalid = false;
+    size_t loaded = 0;
+    for (; loaded < num; loaded++)
+    {
+        const pothos_zynq_dma_queue_entry_t entry = entries[sim->fill_index];
+        if (entry.handle >= num_buffs || (mm2s && (entry.length == 0 || entry.length > self->buff_size)))
+        {
+            invalid = true;
+            break;
+        }
+        const size_t index = (sim->queue_tail + loaded) % num_buffs;
+        xilinx_dma_desc_t *desc = sim->sgtable + index;
+        desc->buf_addr = self->allocs.buffs[entry.handle].paddr;
+        desc->control = mm2s?(entry.length | XILINX_DMA_BD_SOP | XILINX_DMA_BD_EOP):self->buff_size;
+        desc->app_0 = mm2s?entry.app[0]:0;
+        desc->app_1 = mm2s?entry.app[1]:0;
+        desc->app_2 = mm2s?entry.app[2]:0;
+        desc->app_3 = mm2s?entry.app[3]:0;
+        desc->app_4 = mm2s?entry.app[4]:0;
+        sim->desc_handles[index] = entry.handle;
+        sim->fill_index = (sim->fill_index + 1) % num_buffs;
+    }
+
+    //hand the loaded descriptors to the engine with a single tail write
+    if (loaded != 0)
+    {
+        for (size_t i = 0; i < loaded; i++) __atomic_store_n(&sim->sgtable[(sim->queue_tail + i) % num_buffs].status, 0, __ATOMIC_RELEASE);
+        sim->queue_pending += loaded;
+        sim->queue_tail = (sim->queue_tail + loaded) % num_buffs;
+        const size_t tail = (sim->queue_tail + num_buffs - 1) % num_buffs;
+        __atomic_store_n((volatile uint32_t *)self->tail_reg, (uint32_t)(PZDUD_SIM_SG_PADDR + tail*sizeof(xilinx_dma_desc_t)), __ATOMIC_RELEASE);
+        sim->kicks++;
+    }
+
+    sim->fill_consumer += (uint32_t)loaded;
+    __atomic_store_n(&sim->fillq->consumer, sim->fill_consumer, __ATOMIC_RELEASE);
+    if (!invalid) return (int)loaded;
+    errno = EINVAL;
+    return -1;
+}
+
+static inline int pzdud_sim_ioctl(int fd, unsigned long request, void *arg)
+{
+    const int code = -2 - fd;
+    pzdud_sim_t *sim = (fd <= -2 && code < PZDUD_SIM_MAX*(1 + POTHOS_ZYNQ_DMA_SUBS_MAX))?pzdud_sim_slots[code % PZDUD_SIM_MAX]:NULL;
+    const int sub_slot = code/PZDUD_SIM_MAX - 1; //-1 for the owner
+    if (sim == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (sim->removed)
+    {
+        errno = ENODEV;
+        return -1;
+    }
+    switch (request)
+    {
+    case POTHOS_ZYNQ_DMA_RING_RESET:
+    {
+        const pothos_zynq_dma_ring_t *ring_args = (const pothos_zynq_dma_ring_t *)arg;
+        if (sim->status.sub_mask != 0)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        const size_t sgindex = (sim->compq != NULL)?0:ring_args->sgindex;
+        sim->irq_index = sgindex;
+        sim->status.last_index = (sgindex + sim->dma->num_buffs - 1) % sim->dma->num_buffs;
+        if (sim->compq != NULL) pzdud_sim_queue_seed(sim, (uint32_t)ring_args->completed);
+        sim->status.errors = 0;
+        sim->status.irq_count = 0;
+        sim->status.poll_count = 0;
+        sim->status.poll_entries = 0;
+        __atomic_store_n(&sim->status.completed, (uint32_t)ring_args->completed, __ATOMIC_RELEASE);
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_WAIT_N:
+    {
+        //count the completions from the head until the timeout expires
+        pothos_zynq_dma_wait_n_t *wait_args = (pothos_zynq_dma_wait_n_t *)arg;
+        const long long exit_us = __pzdud_time_us() + wait_args->timeout_us;
+        while ((wait_args->num_completed = pzdud_sim_num_done(sim, sub_slot, wait_args->sgindex, wait_args->max_num)) < wait_args->min_num)
+        {
+            if (__pzdud_time_us() >= exit_us || sim->ownerless) break;
+            sched_yield();
+        }
+        sim->stats.wait_calls++;
+        if (wait_args->num_completed >= wait_args->min_num) return (int)wait_args->num_completed;
+        if (sim->ownerless)
+        {
+            errno = ENODEV;
+            return -1;
+        }
+        sim->stats.wait_timeouts++;
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    case POTHOS_ZYNQ_DMA_MODERATION:
+    {
+        //manual moderation sets the simulated interrupt coalescing,
+        //poll moderation masks the interrupt after a completion
+        const pothos_zynq_dma_moder_t *moder_args = (const pothos_zynq_dma_moder_t *)arg;
+        if (moder_args->mode > POTHOS_ZYNQ_DMA_MODER_POLL)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        sim->irq_coalesce = (moder_args->mode == POTHOS_ZYNQ_DMA_MODER_MANUAL)?moder_args->coalesce:1;
+        sim->poll_moder = (moder_args->mode == POTHOS_ZYNQ_DMA_MODER_POLL);
+        sim->polling = sim->polling && sim->poll_moder;
+        sim->status.coalesce = (uint32_t)sim->irq_coalesce;
+        sim->status.delay_us = (moder_args->mode == POTHOS_ZYNQ_DMA_MODER_MANUAL)?(uint32_t)moder_args->delay_us:0;
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_STATS:
+    {
+        //the counters are not synchronized with the engine thread
+        pothos_zynq_dma_stats_t *stats_args = (pothos_zynq_dma_stats_t *)arg;
+        *stats_args = sim->stats;
+        stats_args->sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+        if (sim->stats.completions != 0) stats_args->idle_us = (uint64_t)(__pzdud_time_us() - sim->last_complete_us);
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_UMEM_REG:
+    {
+        pothos_zynq_dma_umem_t *umem_args = (pothos_zynq_dma_umem_t *)arg;
+        return pzdud_sim_umem_reg(sim, (size_t)umem_args->uaddr, umem_args->bytes, &umem_args->handle, &umem_args->num_segs, umem_args->segs);
+    }
+    case POTHOS_ZYNQ_DMA_IMPORT:
+    {
+        //any file stands in for a dma-buf, it is laid out from address zero
+        pothos_zynq_dma_import_t *import_args = (pothos_zynq_dma_import_t *)arg;
+        const off_t bytes = lseek(import_args->fd, 0, SEEK_END);
+        if (bytes <= 0)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        import_args->bytes = (size_t)bytes;
+        return pzdud_sim_umem_reg(sim, 0, import_args->bytes, &import_args->handle, &import_args->num_segs, import_args->segs);
+    }
+    case POTHOS_ZYNQ_DMA_UMEM_UNREG:
+    {
+        const size_t handle = (size_t)arg;
+        if (handle >= POTHOS_ZYNQ_DMA_UMEM_MAX || !sim->umems[handle])
+        {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+
+        //refused while a descriptor that is not complete points into the region
+        const size_t region_paddr = PZDUD_SIM_UMEM_PADDR + handle*0x1000000;
+        for (size_t i = 0; sim->sgtable != NULL && i < sim->dma->num_buffs; i++)
+        {
+            const xilinx_dma_desc_t *desc = sim->sgtable + i;
+            if ((__atomic_load_n(&desc->status, __ATOMIC_ACQUIRE) & (1 << 31)) != 0) continue;
+            if (desc->buf_addr < region_paddr || desc->buf_addr >= region_paddr + 0x1000000) continue;
+            errno = EBUSY;
+            return -1;
+        }
+        sim->umems[handle] = false;
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_KICK:
+        if (sim->fillq == NULL)
+        {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+        return pzdud_sim_kick(sim);
+    case POTHOS_ZYNQ_DMA_PERSIST:
+        if (sim->fillq != NULL && (size_t)arg != 0)
+        {
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+        sim->persistent = ((size_t)arg != 0);
+        return 0;
+    case POTHOS_ZYNQ_DMA_ATTACH:
+    {
+        //the simulated buffers are shared with the new instance rather than described
+        pothos_zynq_dma_alloc_t *alloc_args = (pothos_zynq_dma_alloc_t *)arg;
+        if (!sim->persistent)
+        {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+        alloc_args->num_buffs = sim->dma->num_buffs;
+        alloc_args->ring.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+        alloc_args->ring.completed = __atomic_load_n(&sim->status.completed, __ATOMIC_ACQUIRE);
+        alloc_args->ring.sgindex = sim->irq_index;
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_SUBSCRIBE:
+    {
+        //start after the releases of the owner like the module,
+        //the cursor pages are shared with the subscriber rather than mapped
+        pothos_zynq_dma_subscribe_t *sub_args = (pothos_zynq_dma_subscribe_t *)arg;
+        const uint32_t full = (uint32_t)((1ULL << POTHOS_ZYNQ_DMA_SUBS_MAX) - 1);
+        if (sim->fillq != NULL)
+        {
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+        if (sim->dma->direction != PZDUD_S2MM || sim->dma->status == NULL || sim->ownerless)
+        {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+        if (sim->status.sub_mask == full)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        const size_t num_buffs = sim->dma->num_buffs;
+        uint32_t start = __atomic_load_n(&sim->status.completed, __ATOMIC_ACQUIRE);
+        size_t sgindex = sim->irq_index;
+        const int32_t ahead = (int32_t)(__atomic_load_n(&sim->ctrl.released, __ATOMIC_ACQUIRE) - start);
+        if (ahead > 0 && (size_t)ahead < num_buffs)
+        {
+            start += ahead;
+            sgindex = (sgindex + ahead) % num_buffs;
+        }
+        const size_t slot = (size_t)__builtin_ctz(~sim->status.sub_mask);
+        pothos_zynq_dma_cursor_t *cursor = sim->cursors + slot;
+        memset(cursor, 0, sizeof(pothos_zynq_dma_cursor_t));
+        cursor->released = start;
+        cursor->acquired = start;
+        if (sub_args->policy == POTHOS_ZYNQ_DMA_LAG_BLOCK) sim->status.sub_block_mask |= (1u << slot);
+        __atomic_store_n(&sim->status.sub_mask, sim->status.sub_mask | (1u << slot), __ATOMIC_RELEASE);
+        sub_args->slot = slot;
+        sub_args->ring.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+        sub_args->ring.completed = start;
+        sub_args->ring.sgindex = sgindex;
+        return 0;
+    }
+    case POTHOS_ZYNQ_DMA_UMEM_SYNC_CPU:
+    case POTHOS_ZYNQ_DMA_UMEM_SYNC_DEVICE:
+        sim->umem_syncs++;
+        return 0;
+    case POTHOS_ZYNQ_DMA_SYNC_CPU:
+    case POTHOS_ZYNQ_DMA_SYNC_DEVICE:
+    case POTHOS_ZYNQ_DMA_WAIT:
+        return 0; //coherent memory, and waits return to the caller's final check
+    }
+    errno = ENOTTY;
+    return -1;
+}
+
+/***********************************************************************
+ * Common fixture and assertions of the simulated tests
+ **********************************************************************/
+/*!
+ * Create a simulated instance with the ring of the tests and initialize it
+ * with the initial release, optionally with kernel-managed queues.
+ * \return the instance, or NULL when the initialization fails
+ */
+static inline pzdud_t *pzdud_sim_setup(pzdud_sim_t *sim, const pzdud_dir_t direction, const bool queues)
+{
+    pzdud_t *self = pzdud_sim_create(sim, direction, PZDUD_SIM_NUM_BUFFS, PZDUD_SIM_BUFF_SIZE);
+    if (queues) pzdud_sim_use_queues(sim);
+    if (pzdud_init(self, true) == PZDUD_OK) return self;
+    printf("Fail init\n");
+    pzdud_sim_destroy(sim);
+    return NULL;
+}
+
+//! Print a failed assertion, and count it as an error
+static inline int pzdud_sim_check(const bool ok, const char *what)
+{
+    if (!ok) printf("Fail %s\n", what);
+    return ok?0:1;
+}
+
+//! Print the result of a test, and return its exit code
+static inline int pzdud_sim_report(const int errors)
+{
+    if (errors != 0)
+    {
+        printf("Fail with %d errors\n", errors);
+        return EXIT_FAILURE;
+    }
+    printf("Done!\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Multi-threaded stress test for the single-producer/single-consumer
+ * channel state: one thread acquires, another thread releases,
+ * and a third thread plays the DMA engine on a simulated ring.
+ * Pass "poll" to run with poll moderation rather than coalescing.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pzdud_sim.h"
+
+#define NUM_BUFFS 64
+#define BUFF_SIZE 1024
+#define NUM_XFERS (1 << 21)
+#define MAX_BATCH 16
+
+typedef struct
+{
+    pzdud_sim_t sim;
+    pzdud_t *dma;
+    bool done;
+    int errors;
+    size_t kernel_times; //!< acquires with a time recorded by the kernel
+
+    //handles passed from the acquire thread to the release thread
+    size_t queue[NUM_BUFFS];
+    size_t queue_head;
+    size_t queue_tail;
+} test_state_t;
+
+static void *engine_thread(void *arg)
+{
+    test_state_t *state = (test_state_t *)arg;
+    unsigned int seed = 1;
+    while (!__atomic_load_n(&state->done, __ATOMIC_ACQUIRE))
+    {
+        if (pzdud_sim_run(&state->sim, 1 + rand_r(&seed) % MAX_BATCH) != 0) continue;
+
+        //the delay timer interrupt flushes coalesced completions
+        if (rand_r(&seed) % 4 == 0) pzdud_sim_irq(&state->sim);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *acquire_thread(void *arg)
+{
+    test_state_t *state = (test_state_t *)arg;
+    unsigned int seed = 2;
+    size_t handles[MAX_BATCH];
+    size_t lengths[MAX_BATCH];
+    size_t num_xfers = 0;
+
+    while (num_xfers < NUM_XFERS && state->errors == 0)
+    {
+        //wait for a single buffer or a batch, the release thread
+        //can only add to the number of buffers that are not claimed
+        int num = 0;
+        size_t min_num = 1 + rand_r(&seed) % MAX_BATCH;
+        const size_t num_avail = NUM_BUFFS - __pzdud_num_claimed(state->dma);
+        if (min_num > num_avail) min_num = num_avail;
+        size_t num_ready = 0;
+        if (pzdud_wait_n(state->dma, min_num, 10, &num_ready) != PZDUD_OK)
+        {
+            sched_yield();
+            continue;
+        }
+        if (num_ready < min_num)
+        {
+            printf("Fail wait_n: %zu ready for %zu\n", num_ready, min_num);
+            state->errors++;
+        }
+
+        //acquire a single buffer with its completion time or a batch
+        if (rand_r(&seed) % 2 == 0)
+        {
+            long long time_ns = 0;
+            bool kernel_time = false;
+            const int handle = pzdud_acquire_ts(state->dma, lengths, &time_ns, &kernel_time);
+            if (handle >= 0) handles[num++] = handle;
+            if (handle >= 0 && kernel_time) state->kernel_times++;
+            if (handle >= 0 && (time_ns <= 0 || time_ns > __pzdud_time_ns()))
+            {
+                printf("Fail acquire_ts: time %lld\n", time_ns);
+                state->errors++;
+            }
+        }
+        else
+        {
+            num = pzdud_acquire_many(state->dma, handles, lengths, 1 + rand_r(&seed) % MAX_BATCH);
+        }
+
+        //check ring order, length, and the engine's sequence stamp
+        for (int i = 0; i < num; i++)
+        {
+            const size_t xfer = num_xfers++;
+            const uint32_t stamp = *((uint32_t *)pzdud_addr(state->dma, handles[i]));
+            if (handles[i] != xfer % NUM_BUFFS || lengths[i] != BUFF_SIZE || stamp != (uint32_t)xfer)
+            {
+                printf("Fail xfer %zu: handle %zu, length %zu, stamp %u\n", xfer, handles[i], lengths[i], stamp);
+                state->errors++;
+            }
+
+            //the queue cannot overflow since only NUM_BUFFS are in flight
+            state->queue[state->queue_head % NUM_BUFFS] = handles[i];
+            __pzdud_store_release(&state->queue_head, state->queue_head + 1);
+        }
+    }
+
+    __atomic_store_n(&state->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *release_thread(void *arg)
+{
+    test_state_t *state = (test_state_t *)arg;
+    unsigned int seed = 3;
+    size_t handles[MAX_BATCH+1];
+    size_t held = 0;
+    bool holding = false;
+
+    while (!__atomic_load_n(&state->done, __ATOMIC_ACQUIRE))
+    {
+        //pop a batch of handles from the acquire thread
+        size_t num = __pzdud_load_acquire(&state->queue_head) - state->queue_tail;
+        if (num == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        if (num > MAX_BATCH) num = 1 + rand_r(&seed) % MAX_BATCH;
+        for (size_t i = 0; i < num; i++) handles[i] = state->queue[(state->queue_tail + i) % NUM_BUFFS];
+        __pzdud_store_release(&state->queue_tail, state->queue_tail + num);
+
+        //sometimes hold back the oldest handle until the next batch,
+        //so the following buffers are released ahead of the tail
+        if (holding)
+        {
+            handles[num++] = held;
+            holding = false;
+        }
+        else if (num > 1 && rand_r(&seed) % 4 == 0)
+        {
+            held = handles[0];
+            holding = true;
+            for (size_t i = 1; i < num; i++) handles[i-1] = handles[i];
+            num--;
+            pzdud_release_many(state->dma, handles, NULL, num);
+            sched_yield(); //let the engine observe the partial release
+            continue;
+        }
+
+        //release in reverse order sometimes to exercise the tail search
+        if (rand_r(&seed) % 2 == 0)
+        {
+            pzdud_release_many(state->dma, handles, NULL, num);
+        }
+        else for (size_t i = num; i > 0; i--)
+        {
+            pzdud_release(state->dma, handles[i-1], 0);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, const char* argv[])
+{
+    const bool poll = (argc > 1) && (strcmp(argv[1], "poll") == 0);
+    test_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.dma = pzdud_sim_create(&state.sim, PZDUD_S2MM, NUM_BUFFS, BUFF_SIZE);
+    if (poll) pzdud_set_moderation(state.dma, PZDUD_MODER_POLL, 0, 0); //polling passes lag the descriptors
+    else pzdud_set_moderation(state.dma, PZDUD_MODER_MANUAL, 16, 10); //the status page lags the descriptors
+    pzdud_set_wait_policy(state.dma, PZDUD_WAIT_POLL, 0);
+    pzdud_init(state.dma, true);
+    if (state.sim.irq_coalesce != (poll?1:16) || state.sim.poll_moder != poll)
+    {
+        printf("Fail moderation not restored by init\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Begin SPSC stress test with %d transfers%s\n", NUM_XFERS, poll?" and poll moderation":"");
+    pthread_t engine, acquirer, releaser;
+    pthread_create(&engine, NULL, engine_thread, &state);
+    pthread_create(&acquirer, NULL, acquire_thread, &state);
+    pthread_create(&releaser, NULL, release_thread, &state);
+    pthread_join(acquirer, NULL);
+    pthread_join(releaser, NULL);
+    pthread_join(engine, NULL);
+
+    pzdud_wait_stats_t stats;
+    pzdud_get_wait_stats(state.dma, &stats);
+    printf("completed %zu, wait ready %llu, spins %llu, timeouts %llu, kernel times %zu\n",
+        state.sim.num_completed, stats.ready, stats.spins, stats.timeouts, state.kernel_times);
+    state.errors += state.sim.num_errors;
+
+    //most timed acquires wait for the kernel to count the completion
+    if (state.kernel_times == 0)
+    {
+        printf("Fail acquire_ts never had a kernel time\n");
+        state.errors++;
+    }
+
+    //the status page must account for every completion
+    pzdud_sim_irq(&state.sim);
+    const uint32_t page_completed = state.sim.status.completed - NUM_BUFFS;
+    if (page_completed != (uint32_t)state.sim.num_completed)
+    {
+        printf("Fail status page completed %u\n", page_completed);
+        state.errors++;
+    }
+
+    //the statistics must account for every completion and its length
+    pzdud_stats_t chan_stats;
+    if (pzdud_get_stats(state.dma, &chan_stats) != PZDUD_OK ||
+        chan_stats.completions != state.sim.num_completed ||
+        chan_stats.bytes != (unsigned long long)state.sim.num_completed*BUFF_SIZE ||
+        chan_stats.occupancy_max == 0 || chan_stats.occupancy_max > NUM_BUFFS)
+    {
+        printf("Fail stats completions %llu, bytes %llu, occupancy %zu\n",
+            chan_stats.completions, chan_stats.bytes, chan_stats.occupancy_max);
+        state.errors++;
+    }
+
+    //poll moderation must have switched to polling under load
+    pzdud_moder_stats_t moder_stats;
+    pzdud_get_moderation_stats(state.dma, &moder_stats);
+    if (poll) printf("irqs %u, poll entries %lu, poll passes %lu\n",
+        state.sim.status.irq_count, moder_stats.poll_entries, moder_stats.poll_count);
+    if (poll && (moder_stats.poll_entries == 0 || moder_stats.poll_count == 0))
+    {
+        printf("Fail poll moderation never polled\n");
+        state.errors++;
+    }
+
+    //the control page must publish every acquire for poll()
+    if (state.sim.ctrl.acquired != (uint32_t)state.dma->head_count)
+    {
+        printf("Fail control page acquired %u\n", state.sim.ctrl.acquired);
+        state.errors++;
+    }
+    pzdud_sim_destroy(&state.sim);
+
+    if (state.errors != 0)
+    {
+        printf("Fail with %d errors\n", state.errors);
+        return EXIT_FAILURE;
+    }
+    printf("Done!\n");
+    return EXIT_SUCCESS;
+}
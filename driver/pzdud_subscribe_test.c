@@ -0,0 +1,155 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Test for read-only subscribers to the S2MM ring of the owner:
+ * subscribers acquire the same completions in the same sequence,
+ * a blocking subscriber holds back the owner's releases until it releases,
+ * a dropping subscriber skips the completions the owner handed back,
+ * and the owner's releases resume once the subscriber is gone.
+ * The restart after a DMA error keeps holding back the owner's releases.
+ **********************************************************************/
+
+#include <stdio.h>
+#include "pzdud_sim.h"
+
+static int test_policies(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_S2MM, false);
+    if (dma == NULL) return 1;
+    pzdud_t *block = pzdud_sim_subscribe(&sim, PZDUD_LAG_BLOCK);
+    pzdud_t *drop = pzdud_sim_subscribe(&sim, PZDUD_LAG_DROP);
+    errors += pzdud_sim_check(block != NULL && drop != NULL, "subscribe");
+    if (block == NULL || drop == NULL) return errors;
+    errors += pzdud_sim_check(sim.status.sub_mask == 0x3 && sim.status.sub_block_mask == 0x1, "slots on the status page");
+
+    //the subscribers see the same handles and contents as the owner
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, 4) == 4, "engine completions");
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == 4, "owner acquire");
+    for (size_t i = 0; i < 4; i++)
+    {
+        size_t length = 0;
+        errors += pzdud_sim_check(pzdud_sub_acquire(block, &length) == (int)handles[i], "blocking subscriber handle order");
+        errors += pzdud_sim_check(length == PZDUD_SIM_BUFF_SIZE, "length recorded by the kernel");
+        errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(block, handles[i])) == i, "shared sequence");
+    }
+    size_t length = 0;
+    errors += pzdud_sim_check(pzdud_sub_acquire(block, &length) == PZDUD_ERROR_COMPLETE, "blocking subscriber caught up");
+    errors += pzdud_sim_check(pzdud_sub_acquire(drop, &length) == 0, "dropping subscriber first handle");
+    errors += pzdud_sim_check(pzdud_sub_acquire(drop, &length) == 1, "dropping subscriber second handle");
+
+    //each subscriber waits on the completions after its own cursor
+    errors += pzdud_sim_check(pzdud_sub_wait(block, 100) == PZDUD_ERROR_TIMEOUT, "blocking subscriber wait timeout");
+    errors += pzdud_sim_check(sim.stats.wait_calls == 1 && sim.stats.wait_timeouts == 1, "subscriber wait in the kernel");
+    pothos_zynq_dma_wait_n_t wait_args;
+    memset(&wait_args, 0, sizeof(wait_args));
+    wait_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    wait_args.min_num = 1;
+    wait_args.max_num = PZDUD_SIM_NUM_BUFFS;
+    errors += pzdud_sim_check(__pzdud_ioctl(drop->fd, POTHOS_ZYNQ_DMA_WAIT_N, (void *)&wait_args) == 2, "dropping subscriber wait from its cursor");
+
+    //the owner's releases wait for the blocking subscriber
+    pzdud_release_many(dma, handles, NULL, 4);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS, "releases held back");
+    errors += pzdud_sim_check(pzdud_sub_release(block) == 0, "blocking subscriber release");
+    errors += pzdud_sim_check(pzdud_sub_release(block) == 0, "blocking subscriber release");
+    pzdud_release_many(dma, NULL, NULL, 0);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS + 2, "held back releases retried");
+
+    //the dropping subscriber held the buffers that were handed back
+    errors += pzdud_sim_check(pzdud_sub_release(drop) == 1, "overrun on release");
+    errors += pzdud_sim_check(pzdud_sub_release(drop) == 1, "overrun on release");
+    errors += pzdud_sim_check(pzdud_sub_acquire(drop, &length) == 2, "dropping subscriber after the overrun");
+
+    //the owner's releases resume once the blocking subscriber is gone
+    pzdud_sim_unsubscribe(&sim, block);
+    errors += pzdud_sim_check(sim.status.sub_mask == 0x2 && sim.status.sub_block_mask == 0, "slot cleared");
+    pzdud_release_many(dma, NULL, NULL, 0);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS + 4, "releases after the unsubscribe");
+
+    //the dropping subscriber skips past the completions it missed
+    errors += pzdud_sim_check(pzdud_sub_acquire(drop, &length) == PZDUD_ERROR_COMPLETE, "skip to the completed count");
+    errors += pzdud_sim_check(pzdud_sub_release(drop) == 1, "held buffer overrun by the skip");
+    errors += pzdud_sim_check(pzdud_sub_release(drop) < 0, "nothing left to release");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, 4) == 4, "engine completions after the skip");
+    errors += pzdud_sim_check(pzdud_sub_acquire(drop, &length) == 4, "dropping subscriber after the skip");
+    errors += pzdud_sim_check(length == PZDUD_SIM_BUFF_SIZE, "length after the skip");
+    errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(drop, 4)) == 4, "sequence after the skip");
+
+    //the counters add up and the ring cannot be reset under the subscriber
+    pzdud_sub_stats_t stats = {0};
+    errors += pzdud_sim_check(pzdud_sub_get_stats(drop, &stats) == PZDUD_OK, "get stats");
+    errors += pzdud_sim_check(stats.delivered == 4, "stats delivered");
+    errors += pzdud_sim_check(stats.dropped == 1, "stats dropped");
+    errors += pzdud_sim_check(stats.overruns == 3, "stats overruns");
+    errors += pzdud_sim_check(stats.lag == 4, "stats lag");
+    pothos_zynq_dma_ring_t ring_args;
+    ring_args.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    ring_args.completed = 0;
+    ring_args.sgindex = 0;
+    errors += pzdud_sim_check(__pzdud_ioctl(dma->fd, POTHOS_ZYNQ_DMA_RING_RESET, (void *)&ring_args) != 0 && errno == EBUSY, "reset refused");
+
+    //the subscriber drains the ring after its owner exits, then its wait fails
+    pzdud_sim_close_owner(&sim);
+    errors += pzdud_sim_check(pzdud_sim_subscribe(&sim, PZDUD_LAG_DROP) == NULL && errno == EADDRNOTAVAIL, "subscribe to an ownerless ring refused");
+    errors += pzdud_sim_check(pzdud_sub_wait(drop, 100) == PZDUD_OK, "completions left after the owner exits");
+    while (pzdud_sub_acquire(drop, &length) >= 0) pzdud_sub_release(drop);
+    errors += pzdud_sim_check(pzdud_sub_wait(drop, 100000) == PZDUD_ERROR_REMOVED, "wait fails without an owner");
+    pzdud_sim_unsubscribe(&sim, drop);
+    errors += pzdud_sim_check(!sim.ownerless, "the last subscriber frees the ring");
+    errors += pzdud_sim_check(sim.num_errors == 0, "no descriptor completed twice");
+    pzdud_sim_destroy(&sim);
+    return errors;
+}
+
+static int test_restart(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_S2MM, false);
+    if (dma == NULL) return 1;
+    pzdud_t *block = pzdud_sim_subscribe(&sim, PZDUD_LAG_BLOCK);
+    errors += pzdud_sim_check(block != NULL, "subscribe");
+    if (block == NULL) return errors;
+
+    //the owner releases its buffers while the subscriber holds the second one
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, 4) == 4, "engine completions");
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == 4, "owner acquire");
+    size_t length = 0;
+    errors += pzdud_sim_check(pzdud_sub_acquire(block, &length) == 0, "subscriber first handle");
+    errors += pzdud_sim_check(pzdud_sub_acquire(block, &length) == 1, "subscriber second handle");
+    errors += pzdud_sim_check(pzdud_sub_release(block) == 0, "subscriber release");
+    pzdud_release_many(dma, handles, NULL, 4);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS + 1, "releases held back");
+
+    //the restart after the error queues the handed buffers,
+    //but not the ones that the subscriber holds
+    sim.fault = true;
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 5, "only the handed buffers complete");
+    errors += pzdud_sim_check(pzdud_restarts(dma) == 1, "restart reported");
+    errors += pzdud_sim_check(*((uint32_t *)pzdud_addr(block, 1)) == 1, "held buffer not overwritten");
+
+    //the owner's releases resume with the subscriber's
+    errors += pzdud_sim_check(pzdud_sub_release(block) == 0, "subscriber release after the restart");
+    pzdud_release_many(dma, NULL, NULL, 0);
+    errors += pzdud_sim_check(sim.ctrl.released == PZDUD_SIM_NUM_BUFFS + 2, "held back release retried");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 1, "engine completion after the restart");
+    errors += pzdud_sim_check(sim.num_errors == 0, "no descriptor completed twice");
+    pzdud_sim_unsubscribe(&sim, block);
+    pzdud_sim_destroy(&sim);
+    return errors;
+}
+
+int main(void)
+{
+    int errors = 0;
+    errors += test_policies();
+    errors += test_restart();
+    return pzdud_sim_report(errors);
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Test for zero-copy transfers out of registered user memory:
+ * a range which spans several simulated pages is submitted as one packet
+ * of descriptors, and the ring buffers are restored on the next release.
+ * An imported dma-buf is submitted through the same registered region.
+ * A wait on an engine removed from the device tree fails.
+ **********************************************************************/
+
+#include <stdio.h>
+#include "pzdud_sim.h"
+
+#define UMEM_SIZE (3*PZDUD_SIM_UMEM_PAGE)
+
+int main(void)
+{
+    int errors = 0;
+    pzdud_sim_t sim;
+    pzdud_t *dma = pzdud_sim_setup(&sim, PZDUD_MM2S, false);
+    if (dma == NULL) return EXIT_FAILURE;
+
+    //page aligned memory, so the simulated segments are the pages
+    void *mem = NULL;
+    if (posix_memalign(&mem, PZDUD_SIM_UMEM_PAGE, UMEM_SIZE) != 0) return EXIT_FAILURE;
+    const int region = pzdud_umem_register(dma, mem, UMEM_SIZE);
+    errors += pzdud_sim_check(region >= 0, "register");
+    errors += pzdud_sim_check(pzdud_submit_umem(dma, region, 0, UMEM_SIZE + 1) == PZDUD_ERROR_CONFIG, "submit out of range");
+    errors += pzdud_sim_check(pzdud_submit_umem(dma, -1, 0, 1) == PZDUD_ERROR_CONFIG, "submit bad region");
+
+    //a range from the middle of the first page into the last page
+    const size_t offset = 100;
+    const size_t length = UMEM_SIZE - 200;
+    const int num = pzdud_submit_umem(dma, region, offset, length);
+    errors += pzdud_sim_check(num == 3, "submit descriptor count");
+    errors += pzdud_sim_check(sim.umem_syncs == 1, "submit cache maintenance");
+    for (int i = 0; i < num && num == 3; i++)
+    {
+        const xilinx_dma_desc_t *desc = dma->sgtable + i;
+        const size_t page_paddr = PZDUD_SIM_UMEM_PADDR + region*0x1000000 + i*2*PZDUD_SIM_UMEM_PAGE;
+        const size_t bytes = desc->control & XILINX_DMA_BD_LEN_MASK;
+        errors += pzdud_sim_check(desc->buf_addr == page_paddr + ((i == 0)?offset:0), "descriptor address");
+        errors += pzdud_sim_check(bytes == ((i == 1)?PZDUD_SIM_UMEM_PAGE:(PZDUD_SIM_UMEM_PAGE - 100)), "descriptor length");
+        errors += pzdud_sim_check(((desc->control & XILINX_DMA_BD_SOP) != 0) == (i == 0), "start of packet");
+        errors += pzdud_sim_check(((desc->control & XILINX_DMA_BD_EOP) != 0) == (i == 2), "end of packet");
+    }
+
+    //the memory stays registered while the packet is in flight
+    errors += pzdud_sim_check(pzdud_umem_unregister(dma, region) == PZDUD_ERROR_BUSY, "unregister in flight");
+    errors += pzdud_sim_check(sim.umems[region], "still registered in kernel");
+
+    //the engine sends the packet and the descriptors come back in order
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 3, "engine completions");
+    pzdud_stats_t stats;
+    pzdud_get_stats(dma, &stats);
+    errors += pzdud_sim_check(stats.bytes == length, "stats bytes");
+    size_t lengths[PZDUD_SIM_NUM_BUFFS];
+    size_t handles[PZDUD_SIM_NUM_BUFFS];
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "acquire every buffer");
+    errors += pzdud_sim_check(handles[PZDUD_SIM_NUM_BUFFS-3] == 0, "descriptors acquired after the free buffers");
+
+    //not enough free descriptors with every buffer acquired
+    errors += pzdud_sim_check(pzdud_submit_umem(dma, region, 0, UMEM_SIZE) == PZDUD_ERROR_CLAIMED, "submit without descriptors");
+
+    //releasing a descriptor restores its ring buffer
+    pzdud_release(dma, handles[PZDUD_SIM_NUM_BUFFS-3], PZDUD_SIM_BUFF_SIZE);
+    errors += pzdud_sim_check(dma->sgtable[0].buf_addr == dma->allocs.buffs[0].paddr, "ring buffer restored");
+
+    errors += pzdud_sim_check(pzdud_umem_unregister(dma, region) == PZDUD_OK, "unregister");
+    errors += pzdud_sim_check(!sim.umems[region], "unregister in kernel");
+
+    //hand every buffer back to the engine for the import
+    for (size_t i = 0; i < PZDUD_SIM_NUM_BUFFS; i++)
+    {
+        if (i != PZDUD_SIM_NUM_BUFFS-3) pzdud_release(dma, handles[i], PZDUD_SIM_BUFF_SIZE);
+    }
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS, "engine completions after release");
+
+    //an imported buffer is submitted like registered memory,
+    //the simulation stands in a temporary file for the dma-buf
+    FILE *file = tmpfile();
+    if (file == NULL || ftruncate(fileno(file), 2*PZDUD_SIM_UMEM_PAGE) != 0) return EXIT_FAILURE;
+    const int imported = pzdud_dmabuf_import(dma, fileno(file));
+    errors += pzdud_sim_check(imported >= 0, "import");
+    errors += pzdud_sim_check(pzdud_submit_umem(dma, imported, 0, 2*PZDUD_SIM_UMEM_PAGE) == 2, "submit imported");
+
+    //the submitted descriptors never complete when the engine is removed
+    errors += pzdud_sim_check(pzdud_acquire_many(dma, handles, lengths, PZDUD_SIM_NUM_BUFFS) == PZDUD_SIM_NUM_BUFFS-2, "acquire the free buffers");
+    sim.removed = true;
+    errors += pzdud_sim_check(pzdud_wait(dma, 1000) == PZDUD_ERROR_REMOVED, "wait on a removed engine");
+    sim.removed = false;
+    errors += pzdud_sim_check(pzdud_umem_unregister(dma, imported) == PZDUD_ERROR_BUSY, "unregister imported in flight");
+    errors += pzdud_sim_check(pzdud_sim_run(&sim, PZDUD_SIM_NUM_BUFFS) == 2, "engine completions of the import");
+    errors += pzdud_sim_check(pzdud_umem_unregister(dma, imported) == PZDUD_OK, "unregister imported");
+    fclose(file);
+    pzdud_sim_destroy(&sim);
+    free(mem);
+
+    return pzdud_sim_report(errors);
+}
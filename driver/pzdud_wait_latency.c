@@ -0,0 +1,164 @@
+// Copyright (c) 2014-2015 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Wait latency test: measure the actual duration of pzdud_wait()
+ * timeouts against the requested microseconds, and the wake-up latency
+ * from a completion to the return of the wait.
+ *
+ * On the hardware, the S2MM channel is left without a stream,
+ * so every wait times out and only the timeout distribution is shown.
+ * Pass "sim" for the simulated engine: a completion thread finishes
+ * one buffer at a random time within twice the timeout of each wait.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <pthread.h>
+#include "pzdud_sim.h"
+
+#define NUM_BUFFS 16
+#define BUFF_SIZE 4096
+#define NUM_WAITS 200
+
+static const long timeouts_us[] = {20, 50, 100, 200, 500, 1000, 5000};
+
+/***********************************************************************
+ * Completion source for the simulated engine
+ **********************************************************************/
+typedef struct
+{
+    pzdud_sim_t sim;
+    long delay_us; //!< delay to the next completion, negative when idle
+    long long complete_us; //!< time of the last completion
+    bool done;
+} sim_source_t;
+
+static void *sim_source_thread(void *arg)
+{
+    sim_source_t *source = (sim_source_t *)arg;
+    while (!__atomic_load_n(&source->done, __ATOMIC_ACQUIRE))
+    {
+        const long delay_us = __atomic_load_n(&source->delay_us, __ATOMIC_ACQUIRE);
+        if (delay_us < 0)
+        {
+            sched_yield();
+            continue;
+        }
+        const struct timespec ts = {delay_us/1000000, (delay_us%1000000)*1000};
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+        pzdud_sim_run(&source->sim, 1);
+        __atomic_store_n(&source->complete_us, __pzdud_time_us(), __ATOMIC_RELEASE);
+        __atomic_store_n(&source->delay_us, -1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/***********************************************************************
+ * Distribution summary
+ **********************************************************************/
+static int compare_ll(const void *a, const void *b)
+{
+    const long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_dist(const char *name, long long *samples, const size_t num)
+{
+    if (num == 0)
+    {
+        printf("  %-8s n/a\n", name);
+        return;
+    }
+    qsort(samples, num, sizeof(long long), compare_ll);
+    printf("  %-8s n=%3zu min %6lld p50 %6lld p99 %6lld max %6lld us\n", name, num,
+        samples[0], samples[num/2], samples[(num*99)/100], samples[num-1]);
+}
+
+/***********************************************************************
+ * Measure each requested timeout
+ **********************************************************************/
+static int measure(pzdud_t *dma, sim_source_t *source)
+{
+    long long waited[NUM_WAITS], woken[NUM_WAITS];
+    unsigned int seed = 1;
+
+    pzdud_set_wait_policy(dma, PZDUD_WAIT_IRQ, 0);
+    for (size_t t = 0; t < sizeof(timeouts_us)/sizeof(timeouts_us[0]); t++)
+    {
+        const long timeout_us = timeouts_us[t];
+        size_t num_waited = 0, num_woken = 0;
+        for (size_t i = 0; i < NUM_WAITS; i++)
+        {
+            //schedule the next completion from the source
+            if (source != NULL) __atomic_store_n(&source->delay_us, (long)(rand_r(&seed) % (2*timeout_us)), __ATOMIC_RELEASE);
+
+            const long long t0 = __pzdud_time_us();
+            const int ret = pzdud_wait(dma, timeout_us);
+            const long long t1 = __pzdud_time_us();
+
+            if (ret == PZDUD_ERROR_TIMEOUT) waited[num_waited++] = t1 - t0;
+            else if (ret != PZDUD_OK)
+            {
+                printf("Fail pzdud_wait %d\n", ret);
+                return EXIT_FAILURE;
+            }
+            else woken[num_woken++] = t1 - __atomic_load_n(&source->complete_us, __ATOMIC_ACQUIRE);
+
+            //wait out the completion and hand the buffer back to the source
+            if (source == NULL) continue;
+            while (__atomic_load_n(&source->delay_us, __ATOMIC_ACQUIRE) >= 0) sched_yield();
+            size_t length = 0;
+            const int handle = pzdud_acquire(dma, &length);
+            if (handle < 0)
+            {
+                printf("Fail pzdud_acquire %d\n", handle);
+                return EXIT_FAILURE;
+            }
+            pzdud_release(dma, handle, 0);
+        }
+
+        printf("timeout %5ld us\n", timeout_us);
+        print_dist("timeout", waited, num_waited);
+        if (source != NULL) print_dist("wake-up", woken, num_woken);
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char* argv[])
+{
+    const bool sim = (argc > 1) && (strcmp(argv[1], "sim") == 0);
+    int ret = EXIT_SUCCESS;
+
+    if (sim)
+    {
+        printf("Wait latency on the simulated engine\n");
+        sim_source_t source;
+        memset(&source, 0, sizeof(source));
+        source.delay_us = -1;
+        pzdud_t *s2mm = pzdud_sim_create(&source.sim, PZDUD_S2MM, NUM_BUFFS, BUFF_SIZE);
+        pzdud_init(s2mm, true);
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, sim_source_thread, &source);
+        ret = measure(s2mm, &source);
+        __atomic_store_n(&source.done, true, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+        pzdud_sim_destroy(&source.sim);
+        return ret;
+    }
+
+    const size_t index = (argc > 1)?strtoul(argv[1], NULL, 10):0;
+    printf("Wait latency on engine %zu without a stream\n", index);
+    pzdud_t *s2mm = pzdud_create(index, PZDUD_S2MM);
+    if (s2mm == NULL) return EXIT_FAILURE;
+    if (pzdud_alloc(s2mm, NUM_BUFFS, BUFF_SIZE) != PZDUD_OK || pzdud_init(s2mm, true) != PZDUD_OK)
+    {
+        pzdud_destroy(s2mm);
+        return EXIT_FAILURE;
+    }
+    ret = measure(s2mm, NULL);
+    pzdud_halt(s2mm);
+    pzdud_free(s2mm);
+    pzdud_destroy(s2mm);
+    return ret;
+}
@@ -5,9 +5,136 @@
 #include <linux/uaccess.h> //copy_to/from_user
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
+#include <linux/gfp.h> //alloc_pages_exact
+#include <linux/string.h> //memset
+#include <linux/io.h> //virt_to_phys, memremap
+#include <linux/ktime.h> //ktime_get
+#include <linux/genalloc.h> //gen_pool
+#include <linux/of.h> //of_parse_phandle
+#include <linux/of_address.h> //of_address_to_resource
+#include <linux/of_reserved_mem.h> //of_reserved_mem_device_init
+#include <linux/slab.h> //kcalloc
+#include <linux/spinlock.h> //spin_lock_irqsave
+#include <linux/compiler.h> //READ_ONCE
+#include <linux/mutex.h> //mutex_lock
+#include "pothos_zynq_dma_trace.h"
 
-static void pothos_zynq_dma_buff_alloc(struct platform_device *pdev, pothos_zynq_dma_buff_t *buff)
+/***********************************************************************
+ * Optional DMA pool from a device-tree reserved-memory region
+ **********************************************************************/
+void pothos_zynq_dma_pool_init(pothos_zynq_dma_engine_t *engine)
 {
+    struct platform_device *pdev = engine->pdev;
+    pothos_zynq_dma_buff_t *region = &engine->pool_region;
+    engine->pool = NULL;
+    engine->pool_remapped = false;
+    memset(region, 0, sizeof(pothos_zynq_dma_buff_t));
+
+    //the pool is optional: a memory-region phandle to a shared-dma-pool
+    struct device_node *rmem_node = of_parse_phandle(pdev->dev.of_node, "memory-region", 0);
+    if (rmem_node == NULL) return;
+    struct resource res;
+    const int rc = of_address_to_resource(rmem_node, 0, &res);
+    const bool no_map = of_property_read_bool(rmem_node, "no-map");
+    of_node_put(rmem_node);
+    if (rc != 0)
+    {
+        dev_err(&pdev->dev, "Error getting the memory-region resource = %d.\n", rc);
+        return;
+    }
+
+    //a no-map region is mapped in full, since the per-device coherent pool
+    //would only hand out the largest power of two of it in one allocation
+    if (no_map)
+    {
+        region->bytes = resource_size(&res) & PAGE_MASK;
+        region->paddr = res.start; //the engine addresses physical memory directly
+        region->kaddr = memremap(res.start, region->bytes, MEMREMAP_WC);
+        if (region->kaddr == NULL)
+        {
+            dev_err(&pdev->dev, "Error mapping %zu bytes of the memory-region.\n", region->bytes);
+            memset(region, 0, sizeof(pothos_zynq_dma_buff_t));
+            return;
+        }
+        engine->pool_remapped = true;
+    }
+
+    //assign a CMA area to the device and claim all of it at load time
+    else
+    {
+        if (of_reserved_mem_device_init(&pdev->dev) != 0)
+        {
+            dev_err(&pdev->dev, "Error assigning the memory-region, expected compatible = \"shared-dma-pool\".\n");
+            return;
+        }
+        dma_set_coherent_mask(&pdev->dev, DMA_BIT_MASK(32));
+        dma_addr_t phys_addr = 0;
+        region->bytes = resource_size(&res) & PAGE_MASK;
+        region->kaddr = dma_alloc_coherent(&pdev->dev, region->bytes, &phys_addr, GFP_KERNEL);
+        region->paddr = phys_addr;
+        if (region->kaddr == NULL)
+        {
+            dev_err(&pdev->dev, "Error claiming %zu bytes from the memory-region.\n", region->bytes);
+            of_reserved_mem_device_release(&pdev->dev);
+            memset(region, 0, sizeof(pothos_zynq_dma_buff_t));
+            return;
+        }
+    }
+
+    //only a partial page at the end of the region is left out
+    const size_t unused = resource_size(&res) - region->bytes;
+    if (unused != 0) dev_warn(&pdev->dev, "DMA pool leaves %zu bytes of the memory-region unused.\n", unused);
+
+    //page granularity so that every allocation can be mapped on its own
+    engine->pool = gen_pool_create(PAGE_SHIFT, -1);
+    if (engine->pool == NULL || gen_pool_add_virt(engine->pool, (unsigned long)region->kaddr, region->paddr, region->bytes, -1) != 0)
+    {
+        dev_err(&pdev->dev, "Error creating the DMA pool.\n");
+        pothos_zynq_dma_pool_exit(engine);
+        return;
+    }
+    dev_info(&pdev->dev, "DMA pool of %zu bytes at 0x%zx\n", region->bytes, region->paddr);
+}
+
+void pothos_zynq_dma_pool_exit(pothos_zynq_dma_engine_t *engine)
+{
+    struct platform_device *pdev = engine->pdev;
+    pothos_zynq_dma_buff_t *region = &engine->pool_region;
+    if (engine->pool != NULL) gen_pool_destroy(engine->pool);
+    engine->pool = NULL;
+    if (region->kaddr == NULL) return;
+    if (engine->pool_remapped) memunmap(region->kaddr);
+    else
+    {
+        dma_free_coherent(&pdev->dev, region->bytes, region->kaddr, region->paddr);
+        of_reserved_mem_device_release(&pdev->dev);
+    }
+    engine->pool_remapped = false;
+    memset(region, 0, sizeof(pothos_zynq_dma_buff_t));
+}
+
+/***********************************************************************
+ * Buffer allocation helpers
+ **********************************************************************/
+static void pothos_zynq_dma_buff_alloc(pothos_zynq_dma_engine_t *engine, pothos_zynq_dma_chan_t *chan, pothos_zynq_dma_buff_t *buff)
+{
+    struct platform_device *pdev = engine->pdev;
+
+    //carve from the engine's pool when configured, there is no fallback:
+    //the allocation time does not depend on the state of system memory
+    if (engine->pool != NULL)
+    {
+        const size_t bytes = PAGE_ALIGN(buff->bytes);
+        const unsigned long virt_addr = gen_pool_alloc(engine->pool, bytes);
+        buff->kaddr = (void *)virt_addr;
+        buff->paddr = (virt_addr == 0)?0:gen_pool_virt_to_phys(engine->pool, virt_addr);
+        buff->uaddr = NULL; //filled by user with mmap
+        if (virt_addr == 0) return;
+        memset(buff->kaddr, 0, bytes);
+        chan->pool_bytes += bytes;
+        return;
+    }
+
     dma_addr_t phys_addr = 0;
     int rc = dma_set_coherent_mask(&pdev->dev, DMA_BIT_MASK(32));
     if (rc)
@@ -18,7 +145,89 @@ static void pothos_zynq_dma_buff_alloc(struct platform_device *pdev, pothos_zynq
     buff->uaddr = NULL; //filled by user with mmap
 }
 
-long pothos_zynq_dma_ioctl_alloc(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config)
+static void pothos_zynq_dma_buff_free(pothos_zynq_dma_engine_t *engine, pothos_zynq_dma_chan_t *chan, pothos_zynq_dma_buff_t *buff)
+{
+    if (buff->kaddr == NULL) return; //alloc failed earlier
+    if (engine->pool != NULL)
+    {
+        gen_pool_free(engine->pool, (unsigned long)buff->kaddr, PAGE_ALIGN(buff->bytes));
+        chan->pool_bytes -= PAGE_ALIGN(buff->bytes);
+    }
+    else dma_free_coherent(&engine->pdev->dev, buff->bytes, buff->kaddr, buff->paddr);
+}
+
+static void pothos_zynq_dma_buff_alloc_cacheable(struct platform_device *pdev, pothos_zynq_dma_buff_t *buff, enum dma_data_direction dir)
+{
+    int rc = dma_set_mask(&pdev->dev, DMA_BIT_MASK(32));
+    if (rc)
+        dev_err(&pdev->dev, "Error dma_set_mask() = %d.\n", rc);
+    buff->paddr = 0;
+    buff->kaddr = NULL;
+    buff->uaddr = NULL; //filled by user with mmap
+
+    //normal cacheable pages with a streaming mapping for the device
+    void *virt_addr = alloc_pages_exact(buff->bytes, GFP_KERNEL | __GFP_ZERO);
+    if (virt_addr == NULL) return;
+    dma_addr_t phys_addr = dma_map_single(&pdev->dev, virt_addr, buff->bytes, dir);
+    if (dma_mapping_error(&pdev->dev, phys_addr))
+    {
+        free_pages_exact(virt_addr, buff->bytes);
+        return;
+    }
+    buff->paddr = phys_addr;
+    buff->kaddr = virt_addr;
+}
+
+static void pothos_zynq_dma_queue_buff_alloc(pothos_zynq_dma_buff_t *buff, const size_t num_buffs)
+{
+    //the header and an entry per buffer, a queue never holds more handles than there are buffers
+    buff->bytes = PAGE_ALIGN(sizeof(pothos_zynq_dma_queue_t) + num_buffs*sizeof(pothos_zynq_dma_queue_entry_t));
+    buff->kaddr = alloc_pages_exact(buff->bytes, GFP_KERNEL | __GFP_ZERO);
+    buff->paddr = (buff->kaddr == NULL)?0:virt_to_phys(buff->kaddr);
+    buff->uaddr = NULL; //filled by user with mmap
+}
+
+static void pothos_zynq_dma_slab_carve(const pothos_zynq_dma_buff_t *slab, pothos_zynq_dma_buff_t *buff, size_t *offset)
+{
+    buff->paddr = slab->paddr + *offset;
+    buff->kaddr = (char *)slab->kaddr + *offset;
+    buff->uaddr = NULL; //filled by user with mmap
+    *offset += ALIGN(buff->bytes, POTHOS_ZYNQ_DMA_SLAB_ALIGN);
+}
+
+static void pothos_zynq_dma_slab_alloc(pothos_zynq_dma_engine_t *engine, pothos_zynq_dma_chan_t *chan, pothos_zynq_dma_alloc_t *allocs, pothos_zynq_dma_buff_t *sgbuff)
+{
+    //the SG table comes first, followed by each buffer in order
+    size_t offset = ALIGN(sgbuff->bytes, POTHOS_ZYNQ_DMA_SLAB_ALIGN);
+    for (size_t i = 0; i < allocs->num_buffs; i++)
+    {
+        offset += ALIGN(allocs->buffs[i].bytes, POTHOS_ZYNQ_DMA_SLAB_ALIGN);
+    }
+
+    //one contiguous allocation for the entire ring
+    allocs->slab.bytes = PAGE_ALIGN(offset);
+    pothos_zynq_dma_buff_alloc(engine, chan, &allocs->slab);
+    if (allocs->slab.kaddr == NULL) return; //user checks each buffer
+
+    //handles are fixed offsets into the slab
+    offset = 0;
+    pothos_zynq_dma_slab_carve(&allocs->slab, sgbuff, &offset);
+    for (size_t i = 0; i < allocs->num_buffs; i++)
+    {
+        pothos_zynq_dma_slab_carve(&allocs->slab, allocs->buffs+i, &offset);
+    }
+}
+
+//! The total bytes of the DMA buffers in an allocation
+static size_t pothos_zynq_dma_alloc_bytes(const pothos_zynq_dma_alloc_t *allocs)
+{
+    size_t bytes = 0;
+    if (allocs->buffs == NULL) return 0;
+    for (size_t i = 0; i < allocs->num_buffs; i++) bytes += allocs->buffs[i].bytes;
+    return bytes;
+}
+
+static long pothos_zynq_dma_alloc(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config)
 {
     pothos_zynq_dma_chan_t *chan = user->chan;
     struct platform_device *pdev = user->engine->pdev;
@@ -30,55 +239,359 @@ long pothos_zynq_dma_ioctl_alloc(pothos_zynq_dma_user_t *user, pothos_zynq_dma_a
     //check the sentinel
     if (alloc_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
 
+    //check for unknown and conflicting flags,
+    //cacheable buffers cannot share a slab with the uncached SG table,
+    //and the SG table of a channel with queues is never mapped
+    if ((alloc_args.flags & ~(POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE | POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE |
+        POTHOS_ZYNQ_DMA_ALLOC_SLAB | POTHOS_ZYNQ_DMA_ALLOC_QUEUES)) != 0) return -EINVAL;
+    if ((alloc_args.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0 &&
+        (alloc_args.flags & (POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE | POTHOS_ZYNQ_DMA_ALLOC_SLAB)) != 0) return -EINVAL;
+    if ((alloc_args.flags & POTHOS_ZYNQ_DMA_ALLOC_QUEUES) != 0 &&
+        (alloc_args.flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) != 0) return -EINVAL;
+
+    //the ring of the previous owner is still mapped by its subscribers
+    if (READ_ONCE(chan->ownerless)) return -EADDRINUSE;
+
     //are we already allocated?
     if (chan->allocs.buffs != NULL) return -EBUSY;
 
     //copy the dma buffers array into kernel space
     chan->allocs.num_buffs = alloc_args.num_buffs;
-    chan->allocs.buffs = devm_kzalloc(&pdev->dev, alloc_args.num_buffs*sizeof(pothos_zynq_dma_buff_t), GFP_KERNEL);
+    chan->allocs.flags = alloc_args.flags;
+    memset(&chan->allocs.slab, 0, sizeof(pothos_zynq_dma_buff_t));
+    //not device managed: the allocation outlives the unbind of a removed engine
+    chan->allocs.buffs = kcalloc(alloc_args.num_buffs, sizeof(pothos_zynq_dma_buff_t), GFP_KERNEL);
+    if (chan->allocs.buffs == NULL)
+    {
+        chan->allocs.num_buffs = 0;
+        return -ENOMEM;
+    }
     if (copy_from_user(chan->allocs.buffs, alloc_args.buffs, alloc_args.num_buffs*sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
 
-    //allocate dma buffers
-    for (size_t i = 0; i < chan->allocs.num_buffs; i++)
+    //allocate the SG table and buffers from a single slab
+    chan->sgbuff.bytes = sizeof(xilinx_dma_desc_t)*chan->allocs.num_buffs;
+    if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) != 0)
     {
-        pothos_zynq_dma_buff_alloc(pdev, chan->allocs.buffs+i);
+        pothos_zynq_dma_slab_alloc(user->engine, chan, &chan->allocs, &chan->sgbuff);
     }
 
-    //allocate SG table
-    chan->sgbuff.bytes = sizeof(xilinx_dma_desc_t)*chan->allocs.num_buffs;
-    pothos_zynq_dma_buff_alloc(pdev, &chan->sgbuff);
+    //or allocate dma buffers individually
+    else
+    {
+        for (size_t i = 0; i < chan->allocs.num_buffs; i++)
+        {
+            if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0)
+                pothos_zynq_dma_buff_alloc_cacheable(pdev, chan->allocs.buffs+i, chan->dma_dir);
+            else pothos_zynq_dma_buff_alloc(user->engine, chan, chan->allocs.buffs+i);
+        }
+
+        //allocate SG table
+        pothos_zynq_dma_buff_alloc(user->engine, chan, &chan->sgbuff);
+    }
     chan->sgtable = (xilinx_dma_desc_t *)chan->sgbuff.kaddr;
 
+    //allocate the completion status page
+    pothos_zynq_dma_buff_t *statbuff = &chan->allocs.statbuff;
+    statbuff->bytes = PAGE_SIZE;
+    statbuff->kaddr = (void *)get_zeroed_page(GFP_KERNEL);
+    statbuff->paddr = (statbuff->kaddr == NULL)?0:virt_to_phys(statbuff->kaddr);
+    statbuff->uaddr = NULL; //filled by user with mmap
+    chan->irq_index = 0;
+    chan->status = (pothos_zynq_dma_status_t *)statbuff->kaddr;
+
+    //allocate the user's control page
+    pothos_zynq_dma_buff_t *ctrlbuff = &chan->allocs.ctrlbuff;
+    ctrlbuff->bytes = PAGE_SIZE;
+    ctrlbuff->kaddr = (void *)get_zeroed_page(GFP_KERNEL);
+    ctrlbuff->paddr = (ctrlbuff->kaddr == NULL)?0:virt_to_phys(ctrlbuff->kaddr);
+    ctrlbuff->uaddr = NULL; //filled by user with mmap
+    chan->ctrl = (pothos_zynq_dma_ctrl_t *)ctrlbuff->kaddr;
+
+    //allocate the completion timestamps and lengths, one each per descriptor
+    pothos_zynq_dma_buff_t *timebuff = &chan->allocs.timebuff;
+    timebuff->bytes = PAGE_ALIGN(chan->allocs.num_buffs*(sizeof(pothos_zynq_dma_time_t) + sizeof(u32)));
+    timebuff->kaddr = alloc_pages_exact(timebuff->bytes, GFP_KERNEL | __GFP_ZERO);
+    timebuff->paddr = (timebuff->kaddr == NULL)?0:virt_to_phys(timebuff->kaddr);
+    timebuff->uaddr = NULL; //filled by user with mmap
+    chan->times = (pothos_zynq_dma_time_t *)timebuff->kaddr;
+    chan->lengths = (timebuff->kaddr == NULL)?NULL:(u32 *)(chan->times + chan->allocs.num_buffs);
+
+    //allocate the subscriber cursors, one page per slot so that each maps on its own
+    pothos_zynq_dma_buff_t *subsbuff = &chan->allocs.subsbuff;
+    memset(subsbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    if (chan->direction == POTHOS_ZYNQ_DMA_S2MM)
+    {
+        subsbuff->bytes = POTHOS_ZYNQ_DMA_SUBS_MAX*PAGE_SIZE;
+        subsbuff->kaddr = alloc_pages_exact(subsbuff->bytes, GFP_KERNEL | __GFP_ZERO);
+        subsbuff->paddr = (subsbuff->kaddr == NULL)?0:virt_to_phys(subsbuff->kaddr);
+    }
+
+    //allocate the fill and completion queues, and the handle of each descriptor;
+    //the channel only switches to queues once all of them are allocated
+    pothos_zynq_dma_buff_t *fillbuff = &chan->allocs.fillbuff;
+    pothos_zynq_dma_buff_t *compbuff = &chan->allocs.compbuff;
+    memset(fillbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    memset(compbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_QUEUES) != 0)
+    {
+        pothos_zynq_dma_queue_buff_alloc(fillbuff, chan->allocs.num_buffs);
+        pothos_zynq_dma_queue_buff_alloc(compbuff, chan->allocs.num_buffs);
+        chan->desc_handles = kcalloc(chan->allocs.num_buffs, sizeof(u32), GFP_KERNEL);
+        if (fillbuff->kaddr != NULL && compbuff->kaddr != NULL && chan->desc_handles != NULL)
+        {
+            chan->fillq = (pothos_zynq_dma_queue_t *)fillbuff->kaddr;
+            chan->compq = (pothos_zynq_dma_queue_t *)compbuff->kaddr;
+        }
+    }
+
     //copy the allocation results back to the user ioctl buffer
     if (copy_to_user(alloc_args.buffs, chan->allocs.buffs, alloc_args.num_buffs*sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
     if (copy_to_user(&user_config->sgbuff, &chan->sgbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->slab, &chan->allocs.slab, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->statbuff, statbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->ctrlbuff, ctrlbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->timebuff, timebuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->subsbuff, subsbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->fillbuff, fillbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(&user_config->compbuff, compbuff, sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
 
     return 0;
 }
 
-long pothos_zynq_dma_ioctl_free(pothos_zynq_dma_user_t *user)
+long pothos_zynq_dma_ioctl_alloc(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config)
 {
-    pothos_zynq_dma_chan_t *chan = user->chan;
-    struct platform_device *pdev = user->engine->pdev;
+    const ktime_t start = ktime_get();
+    const long ret = pothos_zynq_dma_alloc(user, user_config);
+    const u64 duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    const pothos_zynq_dma_alloc_t *allocs = &user->chan->allocs;
+    trace_pothos_zynq_dma_alloc(user->chan, (ret == 0)?allocs->num_buffs:0, (ret == 0)?pothos_zynq_dma_alloc_bytes(allocs):0, duration_ns, ret);
+    return ret;
+}
+
+static long pothos_zynq_dma_chan_busy(pothos_zynq_dma_chan_t *chan)
+{
+    //exported buffers are still in use by another driver
+    if (atomic_read(&chan->exports) != 0) return -EBUSY;
+
+    //subscribers still map the ring, the last one to close frees it
+    if (READ_ONCE(chan->sub_mask) != 0) return -EBUSY;
+    return 0;
+}
+
+long pothos_zynq_dma_chan_free(pothos_zynq_dma_engine_t *engine, pothos_zynq_dma_chan_t *chan)
+{
+    struct platform_device *pdev = engine->pdev;
 
     //are we already free?
     if (chan->allocs.buffs == NULL) return 0;
+    const long busy = pothos_zynq_dma_chan_busy(chan);
+    if (busy != 0) return busy;
+    const ktime_t start = ktime_get();
+    const size_t num_buffs = chan->allocs.num_buffs;
+    const size_t bytes = pothos_zynq_dma_alloc_bytes(&chan->allocs);
+
+    //the kernel started the engine of a channel with queues:
+    //stop it before the buffers that it writes are freed,
+    //and hold off the kicks until the queues are gone
+    const bool queues = (chan->fillq != NULL);
+    if (queues) mutex_lock(&chan->kick_lock);
+    if (queues && !engine->removed) pothos_zynq_dma_chan_halt(chan);
+
+    //stop the interrupt handler from tracking completions
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    chan->status = NULL;
+    chan->ctrl = NULL;
+    chan->times = NULL;
+    chan->lengths = NULL;
+    chan->sgtable = NULL;
+    chan->fillq = NULL;
+    chan->compq = NULL;
+    chan->queue_pending = 0;
+    chan->ring_ready = false;
+    WRITE_ONCE(chan->ownerless, false);
+    spin_unlock_irqrestore(&chan->lock, flags);
+    if (queues) mutex_unlock(&chan->kick_lock);
+
+    //free the completion status page
+    if (chan->allocs.statbuff.kaddr != NULL) free_page((unsigned long)chan->allocs.statbuff.kaddr);
+    memset(&chan->allocs.statbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+
+    //free the user's control page
+    if (chan->allocs.ctrlbuff.kaddr != NULL) free_page((unsigned long)chan->allocs.ctrlbuff.kaddr);
+    memset(&chan->allocs.ctrlbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+
+    //free the completion timestamps
+    if (chan->allocs.timebuff.kaddr != NULL) free_pages_exact(chan->allocs.timebuff.kaddr, chan->allocs.timebuff.bytes);
+    memset(&chan->allocs.timebuff, 0, sizeof(pothos_zynq_dma_buff_t));
+
+    //free the subscriber cursors
+    if (chan->allocs.subsbuff.kaddr != NULL) free_pages_exact(chan->allocs.subsbuff.kaddr, chan->allocs.subsbuff.bytes);
+    memset(&chan->allocs.subsbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+
+    //free the fill and completion queues
+    if (chan->allocs.fillbuff.kaddr != NULL) free_pages_exact(chan->allocs.fillbuff.kaddr, chan->allocs.fillbuff.bytes);
+    memset(&chan->allocs.fillbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    if (chan->allocs.compbuff.kaddr != NULL) free_pages_exact(chan->allocs.compbuff.kaddr, chan->allocs.compbuff.bytes);
+    memset(&chan->allocs.compbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    kfree(chan->desc_handles);
+    chan->desc_handles = NULL;
+
+    //free the slab which contains the SG table and buffers
+    if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) != 0)
+    {
+        pothos_zynq_dma_buff_t *slab = &chan->allocs.slab;
+        pothos_zynq_dma_buff_free(engine, chan, slab);
+        memset(slab, 0, sizeof(pothos_zynq_dma_buff_t));
+    }
 
     //free dma buffers
-    for (size_t i = 0; i < chan->allocs.num_buffs; i++)
+    else for (size_t i = 0; i < chan->allocs.num_buffs; i++)
     {
-        if (chan->allocs.buffs[i].kaddr == NULL) continue; //alloc failed eariler
-        dma_free_coherent(&pdev->dev, chan->allocs.buffs[i].bytes, chan->allocs.buffs[i].kaddr, chan->allocs.buffs[i].paddr);
+        pothos_zynq_dma_buff_t *buff = chan->allocs.buffs + i;
+        if (buff->kaddr == NULL) continue; //alloc failed earlier
+        if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0)
+        {
+            dma_unmap_single(&pdev->dev, buff->paddr, buff->bytes, chan->dma_dir);
+            free_pages_exact(buff->kaddr, buff->bytes);
+        }
+        else pothos_zynq_dma_buff_free(engine, chan, buff);
     }
 
     //free the SG buffer
-    dma_free_coherent(&pdev->dev, chan->sgbuff.bytes, chan->sgbuff.kaddr, chan->sgbuff.paddr);
-    chan->sgtable = NULL;
+    if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) == 0)
+    {
+        pothos_zynq_dma_buff_free(engine, chan, &chan->sgbuff);
+    }
+    chan->sgbuff.paddr = 0;
+    chan->sgbuff.kaddr = NULL;
 
     //free the dma buffer structures
-    devm_kfree(&pdev->dev, chan->allocs.buffs);
+    kfree(chan->allocs.buffs);
     chan->allocs.num_buffs = 0;
+    chan->allocs.flags = 0;
     chan->allocs.buffs = NULL;
 
+    trace_pothos_zynq_dma_free(chan, num_buffs, bytes, ktime_to_ns(ktime_sub(ktime_get(), start)));
+    return 0;
+}
+
+long pothos_zynq_dma_ioctl_free(pothos_zynq_dma_user_t *user, const size_t check)
+{
+    //the user checks before it unmaps the ring that a refused free leaves behind:
+    //a check that passes refuses new subscribers until the next ring reset,
+    //so that none can come in between the check and the free
+    if (check == POTHOS_ZYNQ_DMA_FREE_CHECK)
+    {
+        pothos_zynq_dma_chan_t *chan = user->chan;
+        mutex_lock(&chan->users_lock);
+        unsigned long flags;
+        spin_lock_irqsave(&chan->lock, flags);
+        const long busy = pothos_zynq_dma_chan_busy(chan);
+        if (busy == 0) chan->ring_ready = false;
+        spin_unlock_irqrestore(&chan->lock, flags);
+        mutex_unlock(&chan->users_lock);
+        return busy;
+    }
+
+    //an explicit free ends the persistence of the ring
+    mutex_lock(&user->chan->users_lock);
+    const long ret = pothos_zynq_dma_chan_free(user->engine, user->chan);
+    if (ret == 0) user->chan->persistent = false;
+    mutex_unlock(&user->chan->users_lock);
+    return ret;
+}
+
+long pothos_zynq_dma_ioctl_persist(pothos_zynq_dma_user_t *user, const size_t enable)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //only an allocated ring can be kept, the kernel stops a ring with queues on release
+    if (enable != 0 && chan->allocs.buffs == NULL) return -EADDRNOTAVAIL;
+    if (enable != 0 && chan->fillq != NULL) return -EOPNOTSUPP;
+    chan->persistent = (enable != 0);
+    return 0;
+}
+
+long pothos_zynq_dma_ioctl_attach(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //copy the buffer into kernel space
+    pothos_zynq_dma_alloc_t alloc_args;
+    if (copy_from_user(&alloc_args, user_config, sizeof(pothos_zynq_dma_alloc_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (alloc_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //only a ring left behind by a persistent channel can be attached,
+    //or the ring of the owner for a subscriber
+    if (user->sub_slot < 0 && !chan->persistent) return -EADDRNOTAVAIL;
+    if (chan->allocs.buffs == NULL) return -EADDRNOTAVAIL;
+
+    //report the size of the ring when the user's array is too small
+    const size_t capacity = alloc_args.num_buffs;
+    alloc_args.num_buffs = chan->allocs.num_buffs;
+    alloc_args.flags = chan->allocs.flags;
+    if (alloc_args.buffs == NULL || capacity < chan->allocs.num_buffs)
+    {
+        if (copy_to_user(user_config, &alloc_args, sizeof(pothos_zynq_dma_alloc_t)) != 0) return -EACCES;
+        return -ENOSPC;
+    }
+
+    //copy the allocation back to the user ioctl buffer like a new allocation
+    alloc_args.sgbuff = chan->sgbuff;
+    alloc_args.slab = chan->allocs.slab;
+    alloc_args.statbuff = chan->allocs.statbuff;
+    alloc_args.ctrlbuff = chan->allocs.ctrlbuff;
+    alloc_args.timebuff = chan->allocs.timebuff;
+    alloc_args.subsbuff = chan->allocs.subsbuff;
+    alloc_args.fillbuff = chan->allocs.fillbuff;
+    alloc_args.compbuff = chan->allocs.compbuff;
+
+    //the completed count and the descriptor it counts to next move together
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    alloc_args.ring.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+    alloc_args.ring.completed = (chan->status == NULL)?0:READ_ONCE(chan->status->completed);
+    alloc_args.ring.sgindex = chan->irq_index;
+    spin_unlock_irqrestore(&chan->lock, flags);
+    if (copy_to_user(alloc_args.buffs, chan->allocs.buffs, chan->allocs.num_buffs*sizeof(pothos_zynq_dma_buff_t)) != 0) return -EACCES;
+    if (copy_to_user(user_config, &alloc_args, sizeof(pothos_zynq_dma_alloc_t)) != 0) return -EACCES;
+
+    trace_pothos_zynq_dma_chan_attach(chan);
+    return 0;
+}
+
+long pothos_zynq_dma_ioctl_sync(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_sync_t *user_config, const int for_device)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    struct platform_device *pdev = user->engine->pdev;
+
+    //copy the buffer into kernel space
+    pothos_zynq_dma_sync_t sync_args;
+    if (copy_from_user(&sync_args, user_config, sizeof(pothos_zynq_dma_sync_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (sync_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //check that the range is allocated
+    if (chan->allocs.buffs == NULL) return -EADDRNOTAVAIL;
+    if (sync_args.handle >= chan->allocs.num_buffs) return -ECHRNG;
+    if (sync_args.num_buffs > chan->allocs.num_buffs) return -ECHRNG;
+
+    //coherent buffers do not require maintenance
+    if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) == 0) return 0;
+
+    //transfer ownership of each buffer in the range
+    size_t index = sync_args.handle;
+    for (size_t i = 0; i < sync_args.num_buffs; i++)
+    {
+        const pothos_zynq_dma_buff_t *buff = chan->allocs.buffs + index;
+        if (for_device) dma_sync_single_for_device(&pdev->dev, buff->paddr, buff->bytes, chan->dma_dir);
+        else dma_sync_single_for_cpu(&pdev->dev, buff->paddr, buff->bytes, chan->dma_dir);
+        if (++index == chan->allocs.num_buffs) index = 0;
+    }
+
     return 0;
 }
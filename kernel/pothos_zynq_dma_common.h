@@ -12,7 +12,7 @@
 #define POTHOS_ZYNQ_DMA_REGS_SIZE 1024
 
 //! Change this when the structure changes
-#define POTHOS_ZYNQ_DMA_SENTINEL 0xab0d1d87
+#define POTHOS_ZYNQ_DMA_SENTINEL 0xab0d1d95
 
 //! Constant for stream to memory map
 #define POTHOS_ZYNQ_DMA_S2MM 0
@@ -20,6 +20,21 @@
 //! Constant for memory map to stream
 #define POTHOS_ZYNQ_DMA_MM2S 1
 
+//! Allocation flag for buffers mapped cacheable into userspace
+#define POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE (1 << 0)
+
+//! Allocation flag for buffers mapped write-combining into userspace
+#define POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE (1 << 1)
+
+//! Allocation flag for the SG table and all buffers in one contiguous slab
+#define POTHOS_ZYNQ_DMA_ALLOC_SLAB (1 << 2)
+
+//! Alignment of the SG table and buffers within a slab allocation
+#define POTHOS_ZYNQ_DMA_SLAB_ALIGN 64
+
+//! Allocation flag for a kernel-managed SG table with fill and completion queues
+#define POTHOS_ZYNQ_DMA_ALLOC_QUEUES (1 << 3)
+
 /*!
  * A descriptor for a single DMA buffer.
  */
@@ -43,10 +58,90 @@ typedef struct
     size_t direction; //!< Channel direction specifies MM2S or S2MM
 } pothos_zynq_dma_setup_t;
 
+/*!
+ * The completion status page for a channel (read-only to the user).
+ * The interrupt handler updates the page on every completion interrupt
+ * (and the interrupt thread on every polling pass under poll moderation),
+ * writing the completed count last so that a reader which observes the
+ * count (with acquire ordering) also observes the other fields.
+ * The counters are free-running and wrap: compare them with subtraction.
+ */
+typedef struct
+{
+    uint32_t completed; //!< total descriptors completed since the ring reset baseline
+    uint32_t last_index; //!< the SG index of the last completed descriptor
+    uint32_t errors; //!< sticky DMASR error bits since the ring reset
+    uint32_t irq_count; //!< completion interrupts handled since the ring reset
+
+    //interrupt moderation, updated once per moderation window
+    uint32_t coalesce; //!< the current completions per interrupt
+    uint32_t delay_us; //!< the current delay timer in microseconds (0 = disabled)
+    uint32_t irq_rate; //!< interrupts per second over the last window
+    uint32_t completion_rate; //!< completions per second over the last window
+    uint32_t latency_us; //!< estimated mean time from a completion to its interrupt
+
+    //interrupt masking under poll moderation, since the ring reset
+    uint32_t poll_count; //!< polling passes made by the interrupt thread
+    uint32_t poll_entries; //!< switches from interrupts to polling
+    uint64_t irq_mode_us; //!< time spent with the interrupt unmasked, at the last switch
+    uint64_t poll_mode_us; //!< time spent with the interrupt masked and polling, at the last switch
+
+    //error recovery, since the ring reset
+    uint32_t restarts; //!< in-place restarts of the ring after a DMA error on either channel of the engine
+
+    //subscribers to an S2MM ring, updated on subscribe and on close
+    uint32_t sub_mask; //!< the subscriber slots in use
+    uint32_t sub_block_mask; //!< the slots whose released count holds back the owner's releases
+} pothos_zynq_dma_status_t;
+
+/*!
+ * The control page for a channel (written by the user, read by the kernel).
+ * The user publishes its progress here rather than with a system call,
+ * so that poll() can compare it against the completed count.
+ * The page outlives the user of a persistent ring, so the next user
+ * recovers the head and tail of the ring from these counts and the status page.
+ */
+typedef struct
+{
+    uint32_t acquired; //!< total buffers acquired by the user, compared against completed
+    uint32_t released; //!< total buffers handed to the engine, published before the tail descriptor write
+} pothos_zynq_dma_ctrl_t;
+
+/*!
+ * The IOCTL structured used to reset the completion tracking for a ring.
+ * The user calls this after loading the SG table and before starting the engine.
+ * For a channel with queues, the kernel halts the engine and loads the SG table,
+ * sgindex is ignored, and the completed count starts the completion queue:
+ * the handles from 0 up to its distance ahead of the acquired count on the
+ * control page are posted as completions (see pothos_zynq_dma_queue_t).
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t completed; //!< The initial value for the completed count
+    size_t sgindex; //!< The index of the first descriptor the engine will complete
+} pothos_zynq_dma_ring_t;
+
 /*!
  * The IOCTL structured used to request allocations.
  * The addresses will be filled in on successful allocations with ioctl.
  * The user must call mmap with paddr as the offset to fill in the uaddr.
+ * The status page must be mapped read-only and is cacheable.
+ * The control page is mapped read-write and is cacheable.
+ *
+ * With the slab flag, the SG table and buffers are carved from one region:
+ * the user calls mmap once with the slab paddr as the offset, and the other
+ * uaddrs are found at the same offsets from the slab as their paddrs.
+ *
+ * With the queues flag, the kernel owns the SG table and the user never maps it:
+ * buffer handles are exchanged through the fill and completion queues,
+ * which are mapped read-write and are cacheable. The queues flag cannot be
+ * combined with the slab flag, and the ring cannot be persistent or subscribed.
+ *
+ * The attach IOCTL fills in the same structure for the ring of a persistent
+ * channel or for a subscriber, where num_buffs is the capacity of buffs on input,
+ * along with a consistent snapshot of the completion tracking.
+ * The owner maps the subscriber buffer read-only to find the cursors.
  */
 typedef struct
 {
@@ -54,10 +149,108 @@ typedef struct
     size_t chan_index; //!< Channel index specifies the DMA engine number
     size_t chan_dir; //!< Channel directions specifies MM2S or S2MM
     size_t num_buffs; //!< The number of DMA buffers
+    size_t flags; //!< Allocation flags POTHOS_ZYNQ_DMA_ALLOC_*
     pothos_zynq_dma_buff_t *buffs; //!< An array of DMA buffers
     pothos_zynq_dma_buff_t sgbuff; //!< The buffer for the SG table
+    pothos_zynq_dma_buff_t slab; //!< The region containing all others (slab flag)
+    pothos_zynq_dma_buff_t statbuff; //!< The page for pothos_zynq_dma_status_t
+    pothos_zynq_dma_buff_t ctrlbuff; //!< The page for pothos_zynq_dma_ctrl_t
+    pothos_zynq_dma_buff_t timebuff; //!< The completion timestamps and lengths (see below)
+    pothos_zynq_dma_buff_t subsbuff; //!< The cursor pages of the subscribers (S2MM, see below)
+    pothos_zynq_dma_buff_t fillbuff; //!< The fill queue (queues flag, see below)
+    pothos_zynq_dma_buff_t compbuff; //!< The completion queue (queues flag, see below)
+    pothos_zynq_dma_ring_t ring; //!< The completed count and the index of the next completion (attach only)
 } pothos_zynq_dma_alloc_t;
 
+/*!
+ * The completion timestamps are an array of uint64_t indexed by SG index
+ * (read-only to the user). The interrupt handler stores the CLOCK_MONOTONIC
+ * time in nanoseconds at which it counted each descriptor as completed,
+ * before it publishes the completed count on the status page.
+ * An array of uint32_t transfer lengths follows the timestamps in the
+ * same buffer, stored at the same time, for readers other than the owner
+ * which cannot rely on the descriptor status after the owner releases it.
+ */
+typedef uint64_t pothos_zynq_dma_time_t;
+
+/*!
+ * The header of a fill or completion queue, followed by num_buffs entries.
+ * The counts are free-running and wrap: compare them with subtraction.
+ * The entry positions start at 0 on the ring reset and advance with the counts,
+ * wrapping at num_buffs. Each side publishes its count after the entries
+ * with release ordering, on a cache line of its own.
+ *
+ * The user produces buffer handles to the fill queue and hands them over
+ * with the kick IOCTL; the kernel consumes them into the SG table in order.
+ * The kernel produces an entry to the completion queue for each completed
+ * descriptor, before it publishes the completed count on the status page,
+ * and the user consumes them. A handle is in at most one place at a time:
+ * held by the user, in a queue, or loaded in the SG table. The timestamps
+ * and lengths of pothos_zynq_dma_time_t are then indexed by handle.
+ */
+typedef struct
+{
+    uint32_t producer; //!< entries produced, written by the producer
+    uint32_t pad0[15];
+    uint32_t consumer; //!< entries consumed, written by the consumer
+    uint32_t pad1[15];
+} pothos_zynq_dma_queue_t;
+
+/*!
+ * An entry of the fill or completion queue.
+ * Fill entries carry the length to send and the app fields for the control
+ * stream (MM2S); completion entries carry the transferred length, the error
+ * bits of the descriptor status, and the app fields from the status stream (S2MM).
+ */
+typedef struct
+{
+    uint32_t handle; //!< the index of the DMA buffer
+    uint32_t length; //!< the length in bytes (fill: MM2S only)
+    uint32_t status; //!< the descriptor error bits (completion only)
+    uint32_t app[5]; //!< the descriptor app fields
+} pothos_zynq_dma_queue_entry_t;
+
+//! The maximum number of subscribers to an S2MM ring
+#define POTHOS_ZYNQ_DMA_SUBS_MAX 16
+
+//! Lag policies for pothos_zynq_dma_subscribe_t
+#define POTHOS_ZYNQ_DMA_LAG_BLOCK 0 //!< the owner holds back its releases until the subscriber releases
+#define POTHOS_ZYNQ_DMA_LAG_DROP 1 //!< the owner releases freely, the subscriber skips what it missed
+
+/*!
+ * The cursor of a subscriber, one per page of the subscriber buffer
+ * (written by the subscriber, read-only to the owner of the ring).
+ * The counts are in the sequence of the completed count on the status page.
+ */
+typedef struct
+{
+    uint32_t released; //!< the next completion to release, the owner's releases stop here (block policy)
+    uint32_t acquired; //!< the next completion to acquire, compared against completed by poll()
+    uint32_t delivered; //!< completions acquired since the subscription
+    uint32_t dropped; //!< completions skipped because the owner released them first
+    uint32_t overruns; //!< completions the owner released while the subscriber held them
+} pothos_zynq_dma_cursor_t;
+
+/*!
+ * The IOCTL structured used to subscribe to the S2MM ring of another process.
+ * It takes the place of the setup IOCTL on a newly opened file descriptor:
+ * the channel stays claimed by its owner, and the subscriber describes the
+ * allocation with the attach IOCTL. The subscriber maps the buffers, the SG table,
+ * and the status, control, and timestamp pages read-only, and only the page
+ * at its slot of the subscriber buffer read-write. The subscriber starts at
+ * the completed count of the snapshot in ring; its cursor is zeroed and
+ * set to that count before the owner observes the slot in sub_block_mask.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t engine_no; //!< Engine number specifies the DMA engine number
+    size_t direction; //!< Channel direction must be S2MM
+    size_t policy; //!< The lag policy POTHOS_ZYNQ_DMA_LAG_*
+    size_t slot; //!< The subscriber slot, the page of the cursor in subsbuff (output)
+    pothos_zynq_dma_ring_t ring; //!< The first completion for the subscriber and its SG index (output)
+} pothos_zynq_dma_subscribe_t;
+
 /*!
  * The IOCTL structured used for wait completions (direction-independent).
  * The index should indicate the head entry in a scatter/gather table.
@@ -69,19 +262,210 @@ typedef struct
     long timeout_us; //!< the timeout to wait for completion in microseconds
 } pothos_zynq_dma_wait_t;
 
+/*!
+ * The IOCTL structured used to wait for a number of completions.
+ * Completions are counted in order from the head entry of the scatter/gather table,
+ * or from the acquired count on the cursor page for a subscriber.
+ * The ioctl returns the number completed when at least min_num are done,
+ * or -ETIMEDOUT on timeout; num_completed is filled in for both cases.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t sgindex; //!< The index into the scatter/gather table of the head entry
+    size_t min_num; //!< The number of completed entries to wait for
+    size_t max_num; //!< The maximum number of entries to count (not claimed by the user)
+    long timeout_us; //!< the timeout to wait for completion in microseconds
+    size_t num_completed; //!< The number of completed entries from the head (output)
+} pothos_zynq_dma_wait_n_t;
+
+/*!
+ * The IOCTL structured used for cache maintenance on cacheable buffers.
+ * The range starts at the handle and wraps around the end of the buffers.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t handle; //!< The index of the first DMA buffer in the range
+    size_t num_buffs; //!< The number of DMA buffers in the range
+} pothos_zynq_dma_sync_t;
+
+
+//! Interrupt moderation modes for pothos_zynq_dma_moder_t
+#define POTHOS_ZYNQ_DMA_MODER_OFF 0 //!< one interrupt per completion
+#define POTHOS_ZYNQ_DMA_MODER_ADAPTIVE 1 //!< tune coalesce and delay from the completion rate
+#define POTHOS_ZYNQ_DMA_MODER_MANUAL 2 //!< fixed coalesce and delay from the user
+#define POTHOS_ZYNQ_DMA_MODER_POLL 3 //!< mask the interrupt under load and poll until the ring drains
+
+/*!
+ * The IOCTL structured used to configure interrupt moderation.
+ * The engine interrupts after coalesce completions, or after the
+ * delay timer expires with completions pending and the channel idle.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t mode; //!< The moderation mode POTHOS_ZYNQ_DMA_MODER_*
+    size_t coalesce; //!< Completions per interrupt in manual mode (1 to 255)
+    size_t delay_us; //!< Delay timer in microseconds in manual mode (0 = disabled)
+} pothos_zynq_dma_moder_t;
+
+/*!
+ * The IOCTL structured used to read the channel statistics.
+ * The counters accumulate from module load and are never reset;
+ * the same numbers are shown in debugfs under pothos_zynq_dma/.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    uint64_t bytes; //!< bytes transferred by completed descriptors
+    uint64_t completions; //!< descriptors completed
+    uint64_t irq_count; //!< interrupts handled
+    uint64_t wait_calls; //!< wait IOCTL calls
+    uint64_t wait_timeouts; //!< wait IOCTL calls which timed out
+    uint32_t occupancy_max; //!< high-water mark of completions not yet acquired by the user
+    uint32_t errors; //!< sticky DMASR error bits
+    uint64_t idle_us; //!< microseconds since the last completion (0 before the first)
+    uint64_t pool_bytes; //!< bytes held by the channel from the engine's reserved-memory pool
+    uint64_t error_irqs; //!< error interrupts (the DMASR cause is in errors)
+    uint64_t restarts; //!< in-place restarts of the ring after a DMA error on either channel
+} pothos_zynq_dma_stats_t;
+
+//! The maximum number of user memory regions registered per channel
+#define POTHOS_ZYNQ_DMA_UMEM_MAX 16
+
+/*!
+ * A contiguous range of DMA addresses in registered user memory.
+ * Each segment fits in the length field of a single descriptor.
+ */
+typedef struct
+{
+    size_t paddr; //!< the DMA address of the segment
+    size_t bytes; //!< the length of the segment in bytes
+} pothos_zynq_dma_seg_t;
+
+/*!
+ * The IOCTL structured used to register user memory for DMA.
+ * The kernel pins the pages for the range and maps them for the channel,
+ * then fills in the handle and the segments in order of the range.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    void *uaddr; //!< The userspace address of the memory
+    size_t bytes; //!< The length of the memory in bytes
+    size_t handle; //!< The handle of the registered region (output)
+    size_t num_segs; //!< The capacity of segs on input, the number of segments on output
+    pothos_zynq_dma_seg_t *segs; //!< The user's array of segments
+} pothos_zynq_dma_umem_t;
+
+/*!
+ * The IOCTL structured used for cache maintenance on registered user memory.
+ * The range is an offset and length into the registered region.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t handle; //!< The handle of the registered region
+    size_t offset; //!< The offset of the range in bytes
+    size_t bytes; //!< The length of the range in bytes
+} pothos_zynq_dma_umem_sync_t;
+
+//! Export flag for the entire slab rather than a single buffer
+#define POTHOS_ZYNQ_DMA_EXPORT_SLAB (1 << 0)
+
+/*!
+ * The IOCTL structured used to export a DMA buffer as a dma-buf.
+ * The channel stays open and its buffers allocated while the
+ * dma-buf file descriptor or any of its attachments remain.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    size_t handle; //!< The index of the DMA buffer to export
+    size_t flags; //!< Export flags POTHOS_ZYNQ_DMA_EXPORT_*
+    int fd; //!< The dma-buf file descriptor (output)
+} pothos_zynq_dma_export_t;
+
+/*!
+ * The IOCTL structured used to import a dma-buf for DMA.
+ * The imported buffer is a registered region like pinned user memory:
+ * the handle and segments are filled in the same way, and cache
+ * maintenance for the device waits on the buffer's exclusive fence.
+ */
+typedef struct
+{
+    unsigned int sentinel; //!< A expected word for ABI compatibility checks
+    int fd; //!< The dma-buf file descriptor
+    size_t bytes; //!< The length of the dma-buf in bytes (output)
+    size_t handle; //!< The handle of the registered region (output)
+    size_t num_segs; //!< The capacity of segs on input, the number of segments on output
+    pothos_zynq_dma_seg_t *segs; //!< The user's array of segments
+} pothos_zynq_dma_import_t;
 
 //! Setup the DMA channel for the open file descriptor
 #define POTHOS_ZYNQ_DMA_SETUP _IOW('p', 1, pothos_zynq_dma_setup_t *)
 
-//! Allocate DMA buffers and the scatter/gather table
+//! Allocate DMA buffers and the scatter/gather table (-EADDRINUSE while subscribers map the previous owner's ring)
 #define POTHOS_ZYNQ_DMA_ALLOC _IOWR('p', 2, pothos_zynq_dma_alloc_t *)
 
 //! Free all allocations performed by POTHOS_ZYNQ_DMA_ALLOC
 #define POTHOS_ZYNQ_DMA_FREE _IO('p', 3)
 
+//! Argument of POTHOS_ZYNQ_DMA_FREE which only checks that the free would not be refused (new subscribers are refused until the next ring reset)
+#define POTHOS_ZYNQ_DMA_FREE_CHECK 1
+
 //! Wait with a timeout for a scatter/gather entry to complete
 #define POTHOS_ZYNQ_DMA_WAIT _IOW('p', 4, pothos_zynq_dma_wait_t *)
 
+//! Give ownership of a range of cacheable buffers to the CPU
+#define POTHOS_ZYNQ_DMA_SYNC_CPU _IOW('p', 5, pothos_zynq_dma_sync_t *)
+
+//! Give ownership of a range of cacheable buffers to the device
+#define POTHOS_ZYNQ_DMA_SYNC_DEVICE _IOW('p', 6, pothos_zynq_dma_sync_t *)
+
+//! Reset the completion status page for a newly loaded SG table
+#define POTHOS_ZYNQ_DMA_RING_RESET _IOW('p', 7, pothos_zynq_dma_ring_t *)
+
+//! Wait with a timeout for a number of scatter/gather entries to complete
+#define POTHOS_ZYNQ_DMA_WAIT_N _IOWR('p', 8, pothos_zynq_dma_wait_n_t *)
+
+//! Configure the interrupt moderation for the channel
+#define POTHOS_ZYNQ_DMA_MODERATION _IOW('p', 9, pothos_zynq_dma_moder_t *)
+
+//! Read the statistics for the channel
+#define POTHOS_ZYNQ_DMA_STATS _IOWR('p', 10, pothos_zynq_dma_stats_t *)
+
+//! Pin and map a range of user memory for DMA
+#define POTHOS_ZYNQ_DMA_UMEM_REG _IOWR('p', 11, pothos_zynq_dma_umem_t *)
+
+//! Unmap and unpin a registered region (the argument is the handle)
+#define POTHOS_ZYNQ_DMA_UMEM_UNREG _IO('p', 12)
+
+//! Give ownership of a range of registered user memory to the CPU
+#define POTHOS_ZYNQ_DMA_UMEM_SYNC_CPU _IOW('p', 13, pothos_zynq_dma_umem_sync_t *)
+
+//! Give ownership of a range of registered user memory to the device
+#define POTHOS_ZYNQ_DMA_UMEM_SYNC_DEVICE _IOW('p', 14, pothos_zynq_dma_umem_sync_t *)
+
+//! Export a DMA buffer or the slab as a dma-buf
+#define POTHOS_ZYNQ_DMA_EXPORT _IOWR('p', 15, pothos_zynq_dma_export_t *)
+
+//! Import a dma-buf as a registered region
+#define POTHOS_ZYNQ_DMA_IMPORT _IOWR('p', 16, pothos_zynq_dma_import_t *)
+
+//! Keep the allocation and the running ring after close (the argument is 1 or 0)
+#define POTHOS_ZYNQ_DMA_PERSIST _IO('p', 17)
+
+//! Describe the allocation of a persistent ring after setup (buffs may be NULL to query num_buffs)
+#define POTHOS_ZYNQ_DMA_ATTACH _IOWR('p', 18, pothos_zynq_dma_alloc_t *)
+
+//! Subscribe read-only to the S2MM ring of the channel's owner
+#define POTHOS_ZYNQ_DMA_SUBSCRIBE _IOWR('p', 19, pothos_zynq_dma_subscribe_t *)
+
+//! Load the fill queue into the SG table and start the engine (returns the number loaded)
+#define POTHOS_ZYNQ_DMA_KICK _IO('p', 20)
+
 /***********************************************************************
  * Register constants for AXI DMA v7.1
  *
@@ -105,6 +489,7 @@ typedef struct
 #define XILINX_DMA_CR_RUNSTOP_MASK	0x00000001 /* Start/stop DMA engine */
 #define XILINX_DMA_SR_HALTED_MASK	0x00000001 /* DMA channel halted */
 #define XILINX_DMA_SR_IDLE_MASK	0x00000002 /* DMA channel idle */
+#define XILINX_DMA_SR_ERR_ALL_MASK	0x00000770 /* DMA and SG internal/slave/decode errors */
 #define XILINX_DMA_XR_IRQ_IOC_MASK	0x00001000 /* Completion interrupt */
 #define XILINX_DMA_XR_IRQ_DELAY_MASK	0x00002000 /* Delay interrupt */
 #define XILINX_DMA_XR_IRQ_ERROR_MASK	0x00004000 /* Error interrupt */
@@ -119,8 +504,10 @@ typedef struct
 
 /* BD definitions for AXI Dma */
 #define XILINX_DMA_BD_STS_ALL_MASK	0xF0000000
+#define XILINX_DMA_BD_ERR_ALL_MASK	0x70000000 /* Internal, slave, and decode error bits */
 #define XILINX_DMA_BD_SOP	0x08000000 /* Start of packet bit */
 #define XILINX_DMA_BD_EOP	0x04000000 /* End of packet bit */
+#define XILINX_DMA_BD_LEN_MASK	0x007FFFFF /* Transfer length */
 
 /* Feature encodings */
 #define XILINX_DMA_FTR_HAS_SG	0x00000100 /* Has SG */
@@ -0,0 +1,203 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/uaccess.h> //copy_to/from_user
+#include <linux/mm.h> //remap_pfn_range
+#include <linux/slab.h> //kzalloc
+#include <linux/fs.h> //get_file
+#include <linux/file.h> //fput, fd_install
+#include <linux/dma-buf.h> //dma_buf_export
+#include <linux/dma-mapping.h> //dma_map_sg
+#include <linux/platform_device.h> //struct platform_device
+#include <linux/err.h> //IS_ERR
+
+/*!
+ * Exporter data for a single dma-buf.
+ * The export holds a reference on the channel's open file,
+ * so the buffer stays allocated until the dma-buf is released.
+ */
+typedef struct
+{
+    pothos_zynq_dma_user_t *user;
+    struct file *filp;
+    pothos_zynq_dma_buff_t buff; //!< the exported range
+    size_t flags; //!< the allocation flags of the exported range
+} pothos_zynq_dma_export_priv_t;
+
+/***********************************************************************
+ * Attachments: a single entry table mapped for the importer's device.
+ * The engine has no IOMMU, so its DMA address is the physical address.
+ **********************************************************************/
+static struct sg_table *pothos_zynq_dma_dmabuf_map(struct dma_buf_attachment *attach, enum dma_data_direction dir)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)attach->dmabuf->priv;
+    struct sg_table *sgt = kzalloc(sizeof(struct sg_table), GFP_KERNEL);
+    if (sgt == NULL) return ERR_PTR(-ENOMEM);
+    if (sg_alloc_table(sgt, 1, GFP_KERNEL) != 0)
+    {
+        kfree(sgt);
+        return ERR_PTR(-ENOMEM);
+    }
+    //a buffer carved from the slab starts at an offset into its first page
+    sg_set_page(sgt->sgl, pfn_to_page(PHYS_PFN(priv->buff.paddr)), priv->buff.bytes, offset_in_page(priv->buff.paddr));
+    if (dma_map_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir) == 0)
+    {
+        sg_free_table(sgt);
+        kfree(sgt);
+        return ERR_PTR(-ENOMEM);
+    }
+    return sgt;
+}
+
+static void pothos_zynq_dma_dmabuf_unmap(struct dma_buf_attachment *attach, struct sg_table *sgt, enum dma_data_direction dir)
+{
+    dma_unmap_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir);
+    sg_free_table(sgt);
+    kfree(sgt);
+}
+
+static void pothos_zynq_dma_dmabuf_release(struct dma_buf *dmabuf)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    atomic_dec(&priv->user->chan->exports);
+    fput(priv->filp);
+    kfree(priv);
+}
+
+/***********************************************************************
+ * CPU access: cache maintenance for cacheable buffers
+ * (DMA_BUF_IOCTL_SYNC from userspace and importers in the kernel)
+ **********************************************************************/
+static int pothos_zynq_dma_dmabuf_begin_cpu(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    if ((priv->flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) == 0) return 0;
+    dma_sync_single_for_cpu(&priv->user->engine->pdev->dev, priv->buff.paddr, priv->buff.bytes, priv->user->chan->dma_dir);
+    return 0;
+}
+
+static int pothos_zynq_dma_dmabuf_end_cpu(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    if ((priv->flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) == 0) return 0;
+    dma_sync_single_for_device(&priv->user->engine->pdev->dev, priv->buff.paddr, priv->buff.bytes, priv->user->chan->dma_dir);
+    return 0;
+}
+
+/***********************************************************************
+ * Kernel and user mappings of the exported range
+ **********************************************************************/
+static void *pothos_zynq_dma_dmabuf_kmap(struct dma_buf *dmabuf, unsigned long page_num)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    return (char *)priv->buff.kaddr + (page_num << PAGE_SHIFT);
+}
+
+static void *pothos_zynq_dma_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    return priv->buff.kaddr;
+}
+
+static int pothos_zynq_dma_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+    pothos_zynq_dma_export_priv_t *priv = (pothos_zynq_dma_export_priv_t *)dmabuf->priv;
+    const size_t size = vma->vm_end - vma->vm_start;
+    const size_t offset = vma->vm_pgoff << PAGE_SHIFT;
+    if (offset + size > PAGE_ALIGN(priv->buff.bytes)) return -EINVAL;
+
+    //pages can only map a buffer which starts on a page, map the slab export otherwise
+    if (offset_in_page(priv->buff.paddr) != 0) return -EINVAL;
+
+    //the same page protection as the mmap of the channel
+    if ((priv->flags & POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE) != 0) vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+    else if ((priv->flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) == 0) vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    return remap_pfn_range(vma, vma->vm_start, PHYS_PFN(priv->buff.paddr) + vma->vm_pgoff, size, vma->vm_page_prot);
+}
+
+static const struct dma_buf_ops pothos_zynq_dma_dmabuf_ops = {
+    map_dma_buf: pothos_zynq_dma_dmabuf_map,
+    unmap_dma_buf: pothos_zynq_dma_dmabuf_unmap,
+    release: pothos_zynq_dma_dmabuf_release,
+    begin_cpu_access: pothos_zynq_dma_dmabuf_begin_cpu,
+    end_cpu_access: pothos_zynq_dma_dmabuf_end_cpu,
+    map_atomic: pothos_zynq_dma_dmabuf_kmap,
+    map: pothos_zynq_dma_dmabuf_kmap,
+    vmap: pothos_zynq_dma_dmabuf_vmap,
+    mmap: pothos_zynq_dma_dmabuf_mmap
+};
+
+/***********************************************************************
+ * Export a DMA buffer or the slab as a dma-buf file descriptor
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_export(pothos_zynq_dma_user_t *user, pothos_zynq_dma_export_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_export_t export_args;
+    if (copy_from_user(&export_args, user_config, sizeof(pothos_zynq_dma_export_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (export_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //locate the range to export
+    if (chan->allocs.buffs == NULL) return -EADDRNOTAVAIL;
+    const pothos_zynq_dma_buff_t *buff = NULL;
+    if ((export_args.flags & POTHOS_ZYNQ_DMA_EXPORT_SLAB) != 0)
+    {
+        if ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_SLAB) == 0) return -EINVAL;
+        buff = &chan->allocs.slab;
+    }
+    else
+    {
+        if (export_args.handle >= chan->allocs.num_buffs) return -ECHRNG;
+        buff = chan->allocs.buffs + export_args.handle;
+    }
+    if (buff->kaddr == NULL) return -EADDRNOTAVAIL;
+
+    //importers map the pages, which a no-map reserved-memory pool does not have
+    if (!pfn_valid(PHYS_PFN(buff->paddr))) return -ENXIO;
+
+    pothos_zynq_dma_export_priv_t *priv = kzalloc(sizeof(pothos_zynq_dma_export_priv_t), GFP_KERNEL);
+    if (priv == NULL) return -ENOMEM;
+    priv->user = user;
+    priv->filp = user->filp;
+    priv->buff = *buff;
+    priv->flags = chan->allocs.flags;
+
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+    exp_info.ops = &pothos_zynq_dma_dmabuf_ops;
+    exp_info.size = PAGE_ALIGN(buff->bytes);
+    exp_info.flags = O_RDWR;
+    exp_info.priv = priv;
+    struct dma_buf *dmabuf = dma_buf_export(&exp_info);
+    if (IS_ERR(dmabuf))
+    {
+        kfree(priv);
+        return PTR_ERR(dmabuf);
+    }
+
+    //the release of the dma-buf drops these references
+    get_file(user->filp);
+    atomic_inc(&chan->exports);
+
+    //reserve the fd, but only install it once the user has its number
+    export_args.fd = get_unused_fd_flags(O_CLOEXEC);
+    if (export_args.fd < 0)
+    {
+        const int ret = export_args.fd;
+        dma_buf_put(dmabuf);
+        return ret;
+    }
+    if (copy_to_user(user_config, &export_args, sizeof(pothos_zynq_dma_export_t)) != 0)
+    {
+        put_unused_fd(export_args.fd);
+        dma_buf_put(dmabuf);
+        return -EACCES;
+    }
+    fd_install(export_args.fd, dmabuf->file);
+
+    return 0;
+}
@@ -7,6 +7,13 @@
 #include <linux/mm.h> //mmap
 #include <linux/slab.h> //kmalloc
 #include <linux/uaccess.h> //copy_to/from_user
+#include <linux/poll.h> //poll_wait
+#include <linux/spinlock.h> //spin_lock
+#include <linux/compiler.h> //READ_ONCE
+#include <linux/rwsem.h> //down_read
+#include <linux/mutex.h> //mutex_lock
+#include <linux/platform_device.h> //struct platform_device
+#include "pothos_zynq_dma_trace.h"
 
 long pothos_zynq_dma_ioctl_chan(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_setup_t *user_config)
 {
@@ -17,64 +24,184 @@ long pothos_zynq_dma_ioctl_chan(pothos_zynq_dma_user_t *user, const pothos_zynq_
     //check the sentinel
     if (setup_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
 
-    //set the engine pointer
-    if (setup_args.engine_no >= user->module->num_engines) return -EINVAL;
-    user->engine = user->module->engines + setup_args.engine_no;
+    //the engine is the one of the opened device node
+    if (setup_args.engine_no != user->engine->index) return -EINVAL;
 
-    //set the channel pointer
-    if (setup_args.direction == POTHOS_ZYNQ_DMA_MM2S) user->chan = &user->engine->mm2s_chan;
-    else if (setup_args.direction == POTHOS_ZYNQ_DMA_S2MM) user->chan = &user->engine->s2mm_chan;
+    //the file descriptor already owns or subscribes to a channel
+    if (user->chan != NULL) return -EBUSY;
+
+    //find the channel
+    pothos_zynq_dma_chan_t *chan = NULL;
+    if (setup_args.direction == POTHOS_ZYNQ_DMA_MM2S) chan = &user->engine->mm2s_chan;
+    else if (setup_args.direction == POTHOS_ZYNQ_DMA_S2MM) chan = &user->engine->s2mm_chan;
     else return -EINVAL;
 
     //check the claimed status
-    if (user->chan->claimed)
-    {
-        user->chan = NULL;
-        return -EBUSY;
-    }
-    user->chan->claimed = 1;
+    mutex_lock(&chan->users_lock);
+    const int claimed = chan->claimed;
+    chan->claimed = 1;
+    mutex_unlock(&chan->users_lock);
+    if (claimed) return -EBUSY;
+    user->chan = chan;
 
+    trace_pothos_zynq_dma_chan_setup(user->chan);
     return 0;
 }
 
-long pothos_zynq_dma_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+static long pothos_zynq_dma_ioctl_dispatch(pothos_zynq_dma_user_t *user, unsigned int cmd, unsigned long arg)
 {
-    pothos_zynq_dma_user_t *user = (pothos_zynq_dma_user_t *)filp->private_data;
-
     //associate the user data with a channel
     switch (cmd)
     {
     case POTHOS_ZYNQ_DMA_SETUP: return pothos_zynq_dma_ioctl_chan(user, (pothos_zynq_dma_setup_t *)arg);
+    case POTHOS_ZYNQ_DMA_SUBSCRIBE: return pothos_zynq_dma_ioctl_subscribe(user, (pothos_zynq_dma_subscribe_t *)arg);
     }
 
     //check user configuration for these
-    if (user->engine == NULL) return -ENODEV;
     if (user->chan == NULL) return -ENODEV;
+
+    //a subscriber only reads the ring of the owner
+    if (user->sub_slot >= 0) switch (cmd)
+    {
+    case POTHOS_ZYNQ_DMA_ATTACH: return pothos_zynq_dma_ioctl_attach(user, (pothos_zynq_dma_alloc_t *)arg);
+    case POTHOS_ZYNQ_DMA_WAIT_N: return pothos_zynq_dma_ioctl_wait_n(user, (pothos_zynq_dma_wait_n_t *)arg);
+    case POTHOS_ZYNQ_DMA_SYNC_CPU: return pothos_zynq_dma_ioctl_sync(user, (pothos_zynq_dma_sync_t *)arg, 0);
+    case POTHOS_ZYNQ_DMA_STATS: return pothos_zynq_dma_ioctl_stats(user, (pothos_zynq_dma_stats_t *)arg);
+    default: return -EPERM;
+    }
+
     switch (cmd)
     {
     case POTHOS_ZYNQ_DMA_ALLOC: return pothos_zynq_dma_ioctl_alloc(user, (pothos_zynq_dma_alloc_t *)arg);
-    case POTHOS_ZYNQ_DMA_FREE: return pothos_zynq_dma_ioctl_free(user);
+    case POTHOS_ZYNQ_DMA_FREE: return pothos_zynq_dma_ioctl_free(user, (size_t)arg);
     case POTHOS_ZYNQ_DMA_WAIT: return pothos_zynq_dma_ioctl_wait(user, (pothos_zynq_dma_wait_t *)arg);
+    case POTHOS_ZYNQ_DMA_WAIT_N: return pothos_zynq_dma_ioctl_wait_n(user, (pothos_zynq_dma_wait_n_t *)arg);
+    case POTHOS_ZYNQ_DMA_SYNC_CPU: return pothos_zynq_dma_ioctl_sync(user, (pothos_zynq_dma_sync_t *)arg, 0);
+    case POTHOS_ZYNQ_DMA_SYNC_DEVICE: return pothos_zynq_dma_ioctl_sync(user, (pothos_zynq_dma_sync_t *)arg, 1);
+    case POTHOS_ZYNQ_DMA_RING_RESET: return pothos_zynq_dma_ioctl_ring_reset(user, (pothos_zynq_dma_ring_t *)arg);
+    case POTHOS_ZYNQ_DMA_MODERATION: return pothos_zynq_dma_ioctl_moderation(user, (pothos_zynq_dma_moder_t *)arg);
+    case POTHOS_ZYNQ_DMA_STATS: return pothos_zynq_dma_ioctl_stats(user, (pothos_zynq_dma_stats_t *)arg);
+    case POTHOS_ZYNQ_DMA_UMEM_REG: return pothos_zynq_dma_ioctl_umem_reg(user, (pothos_zynq_dma_umem_t *)arg);
+    case POTHOS_ZYNQ_DMA_UMEM_UNREG: return pothos_zynq_dma_ioctl_umem_unreg(user, (size_t)arg);
+    case POTHOS_ZYNQ_DMA_UMEM_SYNC_CPU: return pothos_zynq_dma_ioctl_umem_sync(user, (pothos_zynq_dma_umem_sync_t *)arg, 0);
+    case POTHOS_ZYNQ_DMA_UMEM_SYNC_DEVICE: return pothos_zynq_dma_ioctl_umem_sync(user, (pothos_zynq_dma_umem_sync_t *)arg, 1);
+    case POTHOS_ZYNQ_DMA_EXPORT: return pothos_zynq_dma_ioctl_export(user, (pothos_zynq_dma_export_t *)arg);
+    case POTHOS_ZYNQ_DMA_IMPORT: return pothos_zynq_dma_ioctl_import(user, (pothos_zynq_dma_import_t *)arg);
+    case POTHOS_ZYNQ_DMA_PERSIST: return pothos_zynq_dma_ioctl_persist(user, (size_t)arg);
+    case POTHOS_ZYNQ_DMA_ATTACH: return pothos_zynq_dma_ioctl_attach(user, (pothos_zynq_dma_alloc_t *)arg);
+    case POTHOS_ZYNQ_DMA_KICK: return pothos_zynq_dma_ioctl_kick(user);
     }
 
     return -EINVAL;
 }
 
-int pothos_zynq_dma_mmap(struct file *filp, struct vm_area_struct *vma)
+long pothos_zynq_dma_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
     pothos_zynq_dma_user_t *user = (pothos_zynq_dma_user_t *)filp->private_data;
+    pothos_zynq_dma_engine_t *engine = user->engine;
+
+    //the engine cannot be removed during the call
+    down_read(&engine->remove_lock);
+    const long ret = engine->removed?-ENODEV:pothos_zynq_dma_ioctl_dispatch(user, cmd, arg);
+    up_read(&engine->remove_lock);
+    return ret;
+}
+
+static int pothos_zynq_dma_mmap_locked(pothos_zynq_dma_user_t *user, struct vm_area_struct *vma)
+{
     const size_t size = vma->vm_end - vma->vm_start;
     const size_t offset = vma->vm_pgoff << PAGE_SHIFT;
+    const pgprot_t cached_prot = vma->vm_page_prot;
     vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
 
-    //The user passes in the physical address as the offset:
-    #define try_map_buff(__b) if (offset != POTHOS_ZYNQ_DMA_REGS_OFF && offset == (__b).paddr) \
+    //cacheable buffers keep the default page protection,
+    //the user performs cache maintenance with the sync ioctls;
+    //write-combining buffers are bufferable but not cached,
+    //the user issues a store barrier before the tail descriptor write
+    pgprot_t buff_prot = vma->vm_page_prot;
+    if ((user->chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0) buff_prot = cached_prot;
+    if ((user->chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_WRITECOMBINE) != 0) buff_prot = pgprot_writecombine(cached_prot);
+
+    //The subscriber cursors are cacheable, each is written only by the subscriber of its slot
+    const pothos_zynq_dma_buff_t *subsbuff = &user->chan->allocs.subsbuff;
+    if (subsbuff->kaddr != NULL && offset >= subsbuff->paddr && offset < subsbuff->paddr + subsbuff->bytes)
+    {
+        if (offset + size > subsbuff->paddr + subsbuff->bytes) return -EINVAL;
+        if (user->sub_slot < 0 || offset != subsbuff->paddr + user->sub_slot*PAGE_SIZE || size > PAGE_SIZE)
+        {
+            if ((vma->vm_flags & VM_WRITE) != 0) return -EPERM;
+            vma->vm_flags &= ~VM_MAYWRITE;
+        }
+        vma->vm_page_prot = cached_prot;
+        return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+    }
+
+    //A subscriber maps the rest of the ring read-only and never the registers
+    if (user->sub_slot >= 0)
+    {
+        if (offset == POTHOS_ZYNQ_DMA_REGS_OFF) return -EPERM;
+        if ((vma->vm_flags & VM_WRITE) != 0) return -EPERM;
+        vma->vm_flags &= ~VM_MAYWRITE;
+    }
+
+    //The status page is cacheable and can only be mapped read-only
+    const pothos_zynq_dma_buff_t *statbuff = &user->chan->allocs.statbuff;
+    if (statbuff->kaddr != NULL && offset == statbuff->paddr)
+    {
+        if ((vma->vm_flags & VM_WRITE) != 0) return -EPERM;
+        if (size > PAGE_ALIGN(statbuff->bytes)) return -EINVAL;
+        vma->vm_flags &= ~VM_MAYWRITE;
+        vma->vm_page_prot = cached_prot;
+        return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+    }
+
+    //The completion timestamps are cacheable and can only be mapped read-only
+    const pothos_zynq_dma_buff_t *timebuff = &user->chan->allocs.timebuff;
+    if (timebuff->kaddr != NULL && offset == timebuff->paddr)
+    {
+        if ((vma->vm_flags & VM_WRITE) != 0) return -EPERM;
+        if (size > timebuff->bytes) return -EINVAL;
+        vma->vm_flags &= ~VM_MAYWRITE;
+        vma->vm_page_prot = cached_prot;
+        return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+    }
+
+    //The control page is cacheable and written by the user
+    const pothos_zynq_dma_buff_t *ctrlbuff = &user->chan->allocs.ctrlbuff;
+    if (ctrlbuff->kaddr != NULL && offset == ctrlbuff->paddr)
+    {
+        if (size > PAGE_ALIGN(ctrlbuff->bytes)) return -EINVAL;
+        vma->vm_page_prot = cached_prot;
         return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+    }
+
+    //The fill and completion queues are cacheable and written by the user
+    const pothos_zynq_dma_buff_t *fillbuff = &user->chan->allocs.fillbuff;
+    const pothos_zynq_dma_buff_t *compbuff = &user->chan->allocs.compbuff;
+    if ((fillbuff->kaddr != NULL && offset == fillbuff->paddr) || (compbuff->kaddr != NULL && offset == compbuff->paddr))
+    {
+        if (size > ((offset == fillbuff->paddr)?fillbuff->bytes:compbuff->bytes)) return -EINVAL;
+        vma->vm_page_prot = cached_prot;
+        return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+    }
+
+    //The user passes in the physical address as the offset:
+    //the slab is checked first as it shares an address with the SG table
+    #define try_map_buff(__b, __prot) if (offset != POTHOS_ZYNQ_DMA_REGS_OFF && offset == (__b).paddr) \
+        { vma->vm_page_prot = (__prot); return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot); }
+    if (user->chan->allocs.slab.kaddr != NULL)
+    {
+        try_map_buff(user->chan->allocs.slab, buff_prot);
+    }
     for (size_t i = 0; i < user->chan->allocs.num_buffs; i++)
     {
-        try_map_buff(user->chan->allocs.buffs[i]);
+        try_map_buff(user->chan->allocs.buffs[i], buff_prot);
+    }
+    //the kernel owns the SG table of a channel with queues
+    if (user->chan->fillq == NULL)
+    {
+        try_map_buff(user->chan->sgbuff, vma->vm_page_prot);
     }
-    try_map_buff(user->chan->sgbuff);
 
     //Use a register alias point to map the registers in to user-space...
     //as the kernel has already iomapped the registers at offset 0.
@@ -87,17 +214,73 @@ int pothos_zynq_dma_mmap(struct file *filp, struct vm_area_struct *vma)
     return -EINVAL;
 }
 
+int pothos_zynq_dma_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    pothos_zynq_dma_user_t *user = (pothos_zynq_dma_user_t *)filp->private_data;
+    pothos_zynq_dma_engine_t *engine = user->engine;
+
+    down_read(&engine->remove_lock);
+    const int ret = (engine->removed || user->chan == NULL)?-ENODEV:pothos_zynq_dma_mmap_locked(user, vma);
+    up_read(&engine->remove_lock);
+    return ret;
+}
+
+unsigned int pothos_zynq_dma_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    pothos_zynq_dma_user_t *user = (pothos_zynq_dma_user_t *)filp->private_data;
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    unsigned int mask = 0;
+
+    //poll requires interrupts to wake up on completions
+    if (chan == NULL) return POLLERR;
+    if (chan->irq_number == 0 || chan->irq_registered != 0) return POLLERR;
+    poll_wait(filp, &chan->irq_wait, wait);
+
+    //the removal of the engine or the close of the subscribed ring's owner wakes the poll
+    if (READ_ONCE(chan->removed) || READ_ONCE(chan->ownerless)) return POLLERR | POLLHUP;
+
+    //compare the completed count against the user's acquired count:
+    //S2MM completions are readable, MM2S completions are free to write
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    if (chan->status == NULL || chan->ctrl == NULL || chan->allocs.num_buffs < 2) mask = POLLERR;
+    else
+    {
+        //a subscriber publishes its acquired count on its cursor page
+        const u32 completed = READ_ONCE(chan->status->completed);
+        const u32 acquired = (user->sub_slot >= 0)?
+            READ_ONCE(pothos_zynq_dma_sub_cursor(chan, user->sub_slot)->acquired):
+            READ_ONCE(chan->ctrl->acquired);
+        if ((s32)(completed - acquired) > 0)
+        {
+            mask |= (chan->dma_dir == DMA_FROM_DEVICE)?(POLLIN | POLLRDNORM):(POLLOUT | POLLWRNORM);
+        }
+        //an error is only reported while it halts the channel:
+        //when the recovery is disabled or the reset failed
+        if (chan->failed || (ioread32(chan->register_stat) & XILINX_DMA_SR_ERR_ALL_MASK) != 0) mask |= POLLERR;
+    }
+    spin_unlock_irqrestore(&chan->lock, flags);
+
+    return mask;
+}
+
 int pothos_zynq_dma_open(struct inode *inode, struct file *filp)
 {
-    //find the base of the data structure by seeing where cdev is stored
-    pothos_zynq_dma_module_t *module = container_of(inode->i_cdev, pothos_zynq_dma_module_t, c_dev);
+    //the minor number of the device node is the engine index
+    pothos_zynq_dma_engine_t *engine = pothos_zynq_dma_engine_get(iminor(inode));
+    if (engine == NULL) return -ENODEV;
 
     //allocate user struct for this open file descriptor
     pothos_zynq_dma_user_t *user = kmalloc(sizeof(pothos_zynq_dma_user_t), GFP_KERNEL);
-    if (user == NULL) return -EACCES;
-    user->module = module;
-    user->engine = NULL;
+    if (user == NULL)
+    {
+        pothos_zynq_dma_engine_put(engine);
+        return -EACCES;
+    }
+    user->engine = engine;
     user->chan = NULL;
+    user->filp = filp;
+    user->sub_slot = -1;
 
     //now store it to private data for other methods
     filp->private_data = user;
@@ -108,11 +291,51 @@ int pothos_zynq_dma_open(struct inode *inode, struct file *filp)
 int pothos_zynq_dma_release(struct inode *inode, struct file *filp)
 {
     pothos_zynq_dma_user_t *user = (pothos_zynq_dma_user_t *)filp->private_data;
-    if (user->chan != NULL)
+    pothos_zynq_dma_engine_t *engine = user->engine;
+
+    //the allocations are freed even when the engine was removed
+    down_read(&engine->remove_lock);
+    if (user->chan != NULL && user->sub_slot >= 0) pothos_zynq_dma_unsubscribe(user);
+    else if (user->chan != NULL)
     {
-        pothos_zynq_dma_ioctl_free(user);
-        user->chan->claimed = 0;
+        pothos_zynq_dma_chan_t *chan = user->chan;
+        trace_pothos_zynq_dma_chan_release(chan);
+        mutex_lock(&chan->users_lock);
+
+        //a persistent ring keeps running for the next user of the channel,
+        //unless descriptors could point into the closing process's memory
+        for (size_t i = 0; i < POTHOS_ZYNQ_DMA_UMEM_MAX; i++)
+        {
+            if (chan->umems[i].table != NULL) chan->persistent = false;
+        }
+        if (engine->removed) chan->persistent = false;
+
+        //halt the engine before the ring is freed or the registered pages are unpinned,
+        //since its descriptors could point into either (the next owner starts it again)
+        long halted = 0;
+        if (!chan->persistent && !engine->removed)
+        {
+            mutex_lock(&chan->kick_lock);
+            halted = pothos_zynq_dma_chan_halt(chan);
+            mutex_unlock(&chan->kick_lock);
+        }
+
+        //the free is refused while subscribers map the ring: they are told
+        //that the owner is gone, and the last subscriber to close frees it instead
+        if (!chan->persistent && pothos_zynq_dma_chan_free(engine, chan) != 0)
+        {
+            WRITE_ONCE(chan->ownerless, true);
+            wake_up_interruptible_all(&chan->irq_wait);
+            dev_info(&engine->pdev->dev, "Owner closed, the ring stays allocated until its subscribers close.\n");
+        }
+        if (halted == 0) pothos_zynq_dma_umem_release_all(user);
+        else dev_warn(&engine->pdev->dev, "Channel did not halt, its registered memory stays pinned.\n");
+        chan->claimed = 0;
+        mutex_unlock(&chan->users_lock);
     }
+    up_read(&engine->remove_lock);
+
     kfree(user);
+    pothos_zynq_dma_engine_put(engine);
     return 0;
 }
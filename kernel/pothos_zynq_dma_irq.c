@@ -6,18 +6,466 @@
 #include <linux/wait.h> //wait_queue_head_t
 #include <linux/sched.h> //interruptible
 #include <linux/io.h> //iowrite32
+#include <linux/spinlock.h> //spin_lock
+#include <linux/compiler.h> //WRITE_ONCE
+#include <linux/ktime.h> //ktime_t
+#include <linux/module.h> //module_param
+#include <linux/delay.h> //usleep_range
+#include <linux/math64.h> //div_u64
+#include <linux/kernel.h> //min_t
+#include <linux/bitops.h> //__ffs
+#include "pothos_zynq_dma_trace.h"
 
+/***********************************************************************
+ * Poll moderation parameters
+ **********************************************************************/
+static unsigned int poll_budget = 64;
+module_param(poll_budget, uint, 0644);
+MODULE_PARM_DESC(poll_budget, "Completions per polling pass which start the next pass without sleeping");
+
+static unsigned int poll_interval_us = 20;
+module_param(poll_interval_us, uint, 0644);
+MODULE_PARM_DESC(poll_interval_us, "Sleep between polling passes which did not reach the budget");
+
+/***********************************************************************
+ * Error recovery parameters
+ **********************************************************************/
+static unsigned int recover_errors = 1;
+module_param(recover_errors, uint, 0644);
+MODULE_PARM_DESC(recover_errors, "Reset the engine and restart the rings in place after a DMA error");
+
+//the reset completes within a few clock cycles of the engine, bound it anyway
+#define POTHOS_ZYNQ_DMA_RESET_TIMEOUT_US 1000
+
+//the engine halts at the end of the current descriptor, bound it anyway
+#define POTHOS_ZYNQ_DMA_HALT_TIMEOUT_US 1000
+
+/***********************************************************************
+ * Completion tracking for the status page (called with the lock held)
+ **********************************************************************/
+static size_t pothos_zynq_dma_chan_publish(pothos_zynq_dma_chan_t *chan, const size_t num, const ktime_t now)
+{
+    pothos_zynq_dma_status_t *status = chan->status;
+    const size_t num_buffs = chan->allocs.num_buffs;
+
+    //publish the fields before the count that the user checks
+    chan->irq_index = (chan->irq_index + num) % num_buffs;
+    status->last_index = (chan->irq_index + num_buffs - 1) % num_buffs;
+    smp_wmb();
+    WRITE_ONCE(status->completed, status->completed + num);
+
+    //completions the user has not acquired yet, from the control page
+    chan->stat_completions += num;
+    chan->stat_last_complete = now;
+    if (chan->ctrl != NULL)
+    {
+        const s32 occupancy = (s32)(status->completed - READ_ONCE(chan->ctrl->acquired));
+        if (occupancy > (s32)chan->stat_occupancy_max) chan->stat_occupancy_max = min_t(u32, occupancy, num_buffs);
+    }
+    return num;
+}
+
+static size_t pothos_zynq_dma_chan_harvest_queue(pothos_zynq_dma_chan_t *chan)
+{
+    const size_t num = pothos_zynq_dma_queue_num_done(chan);
+    if (num == 0) return 0;
+    const ktime_t now = ktime_get();
+    pothos_zynq_dma_queue_post(chan, num, now);
+    return pothos_zynq_dma_chan_publish(chan, num, now);
+}
+
+static size_t pothos_zynq_dma_chan_harvest_to(pothos_zynq_dma_chan_t *chan, const u32 dmasr, const size_t cur)
+{
+    pothos_zynq_dma_status_t *status = chan->status;
+    const size_t num_buffs = chan->allocs.num_buffs;
+    chan->stat_errors |= dmasr & XILINX_DMA_SR_ERR_ALL_MASK;
+    if (status == NULL || chan->sgtable == NULL || num_buffs < 2) return 0;
+
+    status->errors |= dmasr & XILINX_DMA_SR_ERR_ALL_MASK;
+
+    //the kernel owns the SG table of a channel with queues:
+    //count the complete bits and post the completion entries
+    if (chan->compq != NULL) return pothos_zynq_dma_chan_harvest_queue(chan);
+
+    //the engine completes descriptors in order:
+    //all descriptors before the current descriptor are complete
+    if (cur >= num_buffs) return 0;
+
+    //the current descriptor was counted on a previous interrupt
+    if ((cur + 1) % num_buffs == chan->irq_index) return 0;
+
+    //count up to the current descriptor, and include it once written back
+    size_t num = (cur + num_buffs - chan->irq_index) % num_buffs;
+    if ((chan->sgtable[cur].status & (1 << 31)) != 0) num++;
+    if (num == 0) return 0;
+
+    //timestamp each descriptor with the time that it was counted;
+    //the user may have recycled a descriptor before this count:
+    //use the programmed length when the status was already cleared
+    const ktime_t now = ktime_get();
+    for (size_t i = 0, index = chan->irq_index; i < num; i++, index = (index + 1) % num_buffs)
+    {
+        const xilinx_dma_desc_t *desc = chan->sgtable + index;
+        const u32 desc_status = desc->status;
+        const u32 length = ((desc_status & (1 << 31)) != 0)?(desc_status & XILINX_DMA_BD_LEN_MASK):(desc->control & XILINX_DMA_BD_LEN_MASK);
+        chan->stat_bytes += length;
+        if (chan->times != NULL) chan->times[index] = ktime_to_ns(now);
+        if (chan->lengths != NULL) chan->lengths[index] = length;
+    }
+
+    return pothos_zynq_dma_chan_publish(chan, num, now);
+}
+
+static size_t pothos_zynq_dma_chan_harvest(pothos_zynq_dma_chan_t *chan, const u32 dmasr)
+{
+    const size_t cur = (ioread32(chan->register_curdesc) - chan->sgbuff.paddr)/sizeof(xilinx_dma_desc_t);
+    return pothos_zynq_dma_chan_harvest_to(chan, dmasr, cur);
+}
+
+/***********************************************************************
+ * In-place recovery from a DMA error (called with both locks held):
+ * an error halts its channel until a reset, and the reset applies to
+ * both channels of the engine. Each channel which was running restarts
+ * at the first descriptor which is not complete, with the descriptors
+ * that the user handed to the engine still queued. The descriptor in
+ * error, and the rest of its packet for MM2S, is handed back as
+ * completed with a zero length and the error bits that the engine
+ * wrote to its status.
+ **********************************************************************/
+static u32 pothos_zynq_dma_chan_stop(pothos_zynq_dma_chan_t *chan, u32 *dmasr, size_t *resume)
+{
+    const u32 cr = ioread32(chan->register_ctrl);
+    const size_t num_buffs = chan->allocs.num_buffs;
+    *dmasr = ioread32(chan->register_stat);
+    *resume = num_buffs;
+    if (chan->sgtable == NULL) return cr;
+    size_t index = (ioread32(chan->register_curdesc) - chan->sgbuff.paddr)/sizeof(xilinx_dma_desc_t);
+    if (index >= num_buffs) return cr;
+
+    //hand back the descriptor in error, a restart in the middle
+    //of an MM2S packet would send the rest without its start
+    if ((*dmasr & XILINX_DMA_SR_ERR_ALL_MASK) != 0)
+    {
+        for (size_t i = 0; i < num_buffs; i++)
+        {
+            xilinx_dma_desc_t *desc = chan->sgtable + index;
+            if ((desc->status & (1 << 31)) != 0) break;
+            desc->status = (1 << 31) | (desc->status & XILINX_DMA_BD_ERR_ALL_MASK);
+            if (chan->direction != POTHOS_ZYNQ_DMA_MM2S || (desc->control & XILINX_DMA_BD_EOP) != 0) break;
+            index = (index + 1) % num_buffs;
+        }
+    }
+
+    //count the completions before the reset, including the handed back descriptors
+    pothos_zynq_dma_chan_harvest_to(chan, *dmasr, index);
+    *resume = ((chan->sgtable[index].status & (1 << 31)) != 0)?((index + 1) % num_buffs):index;
+    return cr;
+}
+
+static int pothos_zynq_dma_chan_restart(pothos_zynq_dma_chan_t *chan, const u32 cr, const size_t resume, size_t *pending)
+{
+    //restore the interrupt enables and the moderation, which the reset cleared
+    iowrite32(cr & ~(XILINX_DMA_CR_RUNSTOP_MASK | XILINX_DMA_CR_RESET_MASK), chan->register_ctrl);
+    const size_t num_buffs = chan->allocs.num_buffs;
+    if (resume >= num_buffs) return -EFAULT;
+
+    //the user clears the status of each descriptor it releases:
+    //queue them again from the restart point up to the last one,
+    //but not past the released count that the user handed to the engine,
+    //since the user clears the descriptors that blocking subscribers hold back
+    //(the kernel loads the SG table of a channel with queues itself)
+    size_t limit = num_buffs;
+    if (chan->status != NULL && chan->ctrl != NULL && chan->fillq == NULL)
+    {
+        u32 released = READ_ONCE(chan->ctrl->released);
+        for (u32 mask = READ_ONCE(chan->sub_block_mask); mask != 0; mask &= mask - 1)
+        {
+            const u32 sub_released = READ_ONCE(pothos_zynq_dma_sub_cursor(chan, __ffs(mask))->released);
+            if ((s32)(sub_released - released) < 0) released = sub_released;
+        }
+        const s32 handed = (s32)(released + num_buffs - chan->status->completed);
+        limit = (handed <= 0)?0:min_t(size_t, handed, num_buffs);
+    }
+    *pending = 0;
+    while (*pending < limit && chan->sgtable[(resume + *pending) % num_buffs].status == 0) (*pending)++;
+
+    //the current descriptor is loaded while halted, the tail starts the engine
+    iowrite32(chan->sgbuff.paddr + resume*sizeof(xilinx_dma_desc_t), chan->register_curdesc);
+    iowrite32((cr | XILINX_DMA_CR_RUNSTOP_MASK) & ~XILINX_DMA_CR_RESET_MASK, chan->register_ctrl);
+    if (*pending == 0) return 0;
+    const size_t tail = (resume + *pending - 1) % num_buffs;
+    iowrite32(chan->sgbuff.paddr + tail*sizeof(xilinx_dma_desc_t), chan->register_taildesc);
+    return 0;
+}
+
+static void pothos_zynq_dma_engine_recover(pothos_zynq_dma_chan_t *chan)
+{
+    //lock in a fixed order: MM2S then S2MM
+    pothos_zynq_dma_chan_t *mm2s = (chan->direction == POTHOS_ZYNQ_DMA_MM2S)?chan:chan->peer;
+    pothos_zynq_dma_chan_t *chans[2] = {mm2s, mm2s->peer};
+    const ktime_t start = ktime_get();
+    unsigned long flags;
+    spin_lock_irqsave(&chans[0]->lock, flags);
+    spin_lock_nested(&chans[1]->lock, SINGLE_DEPTH_NESTING);
+
+    //the thread of the other channel may have recovered the engine already
+    if (chans[0]->recover || chans[1]->recover)
+    {
+        //stop tracking both channels where the engine halted
+        u32 cr[2], dmasr[2];
+        size_t resume[2];
+        bool running[2];
+        for (size_t i = 0; i < 2; i++)
+        {
+            chans[i]->recover = false;
+            cr[i] = pothos_zynq_dma_chan_stop(chans[i], &dmasr[i], &resume[i]);
+            running[i] = ((cr[i] & XILINX_DMA_CR_RUNSTOP_MASK) != 0 || (dmasr[i] & XILINX_DMA_SR_ERR_ALL_MASK) != 0);
+        }
+
+        //the reset clears the error and halts both channels
+        int ret = 0;
+        iowrite32(XILINX_DMA_CR_RESET_MASK, chans[0]->register_ctrl);
+        for (size_t t = 0; (ioread32(chans[0]->register_ctrl) & XILINX_DMA_CR_RESET_MASK) != 0; t++)
+        {
+            if (t == POTHOS_ZYNQ_DMA_RESET_TIMEOUT_US)
+            {
+                ret = -ETIMEDOUT;
+                break;
+            }
+            udelay(1);
+        }
+
+        //restart the channels which were running
+        for (size_t i = 0; i < 2; i++)
+        {
+            size_t pending = 0;
+            int chan_ret = ret;
+            if (chan_ret == 0 && !running[i]) iowrite32(cr[i] & ~XILINX_DMA_CR_RESET_MASK, chans[i]->register_ctrl);
+            else if (chan_ret == 0) chan_ret = pothos_zynq_dma_chan_restart(chans[i], cr[i], resume[i], &pending);
+            trace_pothos_zynq_dma_recover(chans[i], dmasr[i], resume[i], pending,
+                ktime_to_ns(ktime_sub(ktime_get(), start)), chan_ret);
+            if (!running[i]) continue;
+            chans[i]->failed = (chan_ret != 0);
+            if (chan_ret != 0) continue;
+            chans[i]->stat_restarts++;
+            if (chans[i]->status != NULL) WRITE_ONCE(chans[i]->status->restarts, chans[i]->status->restarts + 1);
+        }
+    }
+
+    spin_unlock(&chans[1]->lock);
+    spin_unlock_irqrestore(&chans[0]->lock, flags);
+
+    //the handed back descriptors are completions
+    wake_up_interruptible(&chans[0]->irq_wait);
+    wake_up_interruptible(&chans[1]->irq_wait);
+}
+
+/***********************************************************************
+ * Halt a single channel without the reset of the engine, which would
+ * also stop the other channel: the descriptors stay as the engine left
+ * them, and nothing is transferred until the ring is started again.
+ **********************************************************************/
+long pothos_zynq_dma_chan_halt(pothos_zynq_dma_chan_t *chan)
+{
+    iowrite32(ioread32(chan->register_ctrl) & ~XILINX_DMA_CR_RUNSTOP_MASK, chan->register_ctrl);
+    for (size_t t = 0; (ioread32(chan->register_stat) & XILINX_DMA_SR_HALTED_MASK) == 0; t++)
+    {
+        if (t == POTHOS_ZYNQ_DMA_HALT_TIMEOUT_US) return -ETIMEDOUT;
+        udelay(1);
+    }
+    chan->queue_started = false;
+    return 0;
+}
+
+long pothos_zynq_dma_ioctl_ring_reset(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_ring_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_ring_t ring_args;
+    if (copy_from_user(&ring_args, user_config, sizeof(pothos_zynq_dma_ring_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (ring_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //the kernel loads the SG table of a channel with queues from the first descriptor
+    const bool queues = (chan->fillq != NULL);
+    if (queues) ring_args.sgindex = 0;
+
+    //check that the SG index is in range
+    if (ring_args.sgindex >= chan->allocs.num_buffs) return -ECHRNG;
+
+    //check that the status page is allocated
+    if (chan->status == NULL) return -EADDRNOTAVAIL;
+
+    //the engine of a channel with queues halts before the SG table reloads
+    if (queues) mutex_lock(&chan->kick_lock);
+    const long ret = queues?pothos_zynq_dma_chan_halt(chan):0;
+    if (ret != 0)
+    {
+        mutex_unlock(&chan->kick_lock);
+        return ret;
+    }
+
+    //reset the tracking and the status page to the new baseline,
+    //which would move the sequence out from under the subscribers
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    if (chan->sub_mask != 0)
+    {
+        spin_unlock_irqrestore(&chan->lock, flags);
+        if (queues) mutex_unlock(&chan->kick_lock);
+        return -EBUSY;
+    }
+    if (queues) pothos_zynq_dma_queue_seed(chan, ring_args.completed);
+    chan->ring_ready = true;
+    chan->irq_index = ring_args.sgindex;
+    chan->status->last_index = (ring_args.sgindex + chan->allocs.num_buffs - 1) % chan->allocs.num_buffs;
+    chan->status->errors = 0;
+    chan->status->irq_count = 0;
+    chan->status->poll_count = 0;
+    chan->status->poll_entries = 0;
+    chan->status->irq_mode_us = 0;
+    chan->status->poll_mode_us = 0;
+    chan->status->restarts = 0;
+    chan->irq_mode_ns = 0;
+    chan->poll_mode_ns = 0;
+    chan->mode_start = ktime_get();
+    chan->failed = false;
+
+    //error interrupts start the recovery
+    iowrite32(ioread32(chan->register_ctrl) | XILINX_DMA_XR_IRQ_ERROR_MASK, chan->register_ctrl);
+    smp_wmb();
+    WRITE_ONCE(chan->status->completed, ring_args.completed);
+    spin_unlock_irqrestore(&chan->lock, flags);
+    if (queues) mutex_unlock(&chan->kick_lock);
+
+    return 0;
+}
+
+/***********************************************************************
+ * Wait timeout conversion
+ **********************************************************************/
+static ktime_t pothos_zynq_dma_timeout(const long timeout_us)
+{
+    //waits sleep on an hrtimer: a jiffies timeout rounds the
+    //microseconds up to the scheduler tick (10 ms at HZ=100)
+    if (timeout_us <= 0) return ktime_set(0, 0);
+    return ns_to_ktime((u64)timeout_us*NSEC_PER_USEC);
+}
+
+/***********************************************************************
+ * Switch between interrupts and polling (called with the lock held)
+ **********************************************************************/
+static void pothos_zynq_dma_chan_set_polling(pothos_zynq_dma_chan_t *chan, const bool polling)
+{
+    //the completion interrupts are masked in DMACR while polling,
+    //a completion after the last ack raises the interrupt once unmasked
+    u32 cr = ioread32(chan->register_ctrl);
+    cr &= ~(XILINX_DMA_XR_IRQ_IOC_MASK | XILINX_DMA_XR_IRQ_DELAY_MASK);
+    if (!polling) cr |= XILINX_DMA_XR_IRQ_IOC_MASK;
+    if (!polling && chan->moder_delay_us != 0) cr |= XILINX_DMA_XR_IRQ_DELAY_MASK;
+    iowrite32(cr, chan->register_ctrl);
+
+    //account the time spent in the mode that just ended
+    const ktime_t now = ktime_get();
+    const u64 elapsed_ns = ktime_to_ns(ktime_sub(now, chan->mode_start));
+    if (chan->polling) chan->poll_mode_ns += elapsed_ns;
+    else chan->irq_mode_ns += elapsed_ns;
+    chan->polling = polling;
+    chan->mode_start = now;
+
+    if (chan->status == NULL) return;
+    if (polling) chan->status->poll_entries++;
+    chan->status->irq_mode_us = div_u64(chan->irq_mode_ns, NSEC_PER_USEC);
+    chan->status->poll_mode_us = div_u64(chan->poll_mode_ns, NSEC_PER_USEC);
+}
+
+/***********************************************************************
+ * Interrupt handler
+ **********************************************************************/
 irqreturn_t pothos_zynq_dma_irq_handler(int irq, void *data)
 {
     pothos_zynq_dma_chan_t *chan = (pothos_zynq_dma_chan_t *)data;
+
+    //the line may be shared: check that this channel interrupted
+    const u32 dmasr = ioread32(chan->register_stat);
+    if ((dmasr & XILINX_DMA_XR_IRQ_ALL_MASK) == 0) return IRQ_NONE;
     chan->irq_count++;
 
     //ack the interrupts
     iowrite32(XILINX_DMA_XR_IRQ_ALL_MASK, chan->register_stat);
 
+    //update the status page and the moderation with the completions
+    spin_lock(&chan->lock);
+    if (chan->status != NULL) chan->status->irq_count++;
+    const size_t index = chan->irq_index;
+    const size_t num = pothos_zynq_dma_chan_harvest(chan, dmasr);
+    trace_pothos_zynq_dma_irq(chan, dmasr, index, num);
+    pothos_zynq_dma_moder_update(chan, 1, num);
+
+    //under poll moderation, mask the interrupt after a completion
+    //and hand off to the interrupt thread until the ring drains
+    const bool poll = (chan->moder_mode == POTHOS_ZYNQ_DMA_MODER_POLL && !chan->polling && num != 0);
+    if (poll) pothos_zynq_dma_chan_set_polling(chan, true);
+
+    //a DMA error halts the channel: the interrupt thread resets the engine
+    const bool error = ((dmasr & XILINX_DMA_SR_ERR_ALL_MASK) != 0);
+    if (error) chan->stat_error_irqs++;
+    if (error && recover_errors != 0) chan->recover = true;
+    spin_unlock(&chan->lock);
+
     //wake up any contexts which are blocking on the wait queue
     wake_up_interruptible(&chan->irq_wait);
 
+    return (poll || (error && recover_errors != 0))?IRQ_WAKE_THREAD:IRQ_HANDLED;
+}
+
+/***********************************************************************
+ * Interrupt thread: error recovery, and polling with the interrupt masked
+ **********************************************************************/
+irqreturn_t pothos_zynq_dma_irq_thread(int irq, void *data)
+{
+    pothos_zynq_dma_chan_t *chan = (pothos_zynq_dma_chan_t *)data;
+    size_t num = 0;
+
+    //recover from a DMA error, then poll when the handler masked the interrupt
+    if (READ_ONCE(chan->recover)) pothos_zynq_dma_engine_recover(chan);
+    if (!READ_ONCE(chan->polling)) return IRQ_HANDLED;
+
+    //the completions are counted by position in the ring: a pass must
+    //come around before the engine can lap the last counted descriptor
+    size_t budget = chan->allocs.num_buffs/2;
+    if (poll_budget != 0 && poll_budget < budget) budget = poll_budget;
+    if (budget < 1) budget = 1;
+
+    while (true)
+    {
+        //poll again right away when the last pass reached the budget,
+        //otherwise give the engine time to complete more descriptors
+        if (num >= budget) cond_resched();
+        else usleep_range(poll_interval_us, 2*poll_interval_us + 1);
+
+        //ack the completions since the last pass, then harvest them
+        unsigned long flags;
+        spin_lock_irqsave(&chan->lock, flags);
+        const u32 dmasr = ioread32(chan->register_stat);
+        iowrite32(dmasr & (XILINX_DMA_XR_IRQ_IOC_MASK | XILINX_DMA_XR_IRQ_DELAY_MASK), chan->register_stat);
+        const size_t index = chan->irq_index;
+        num = pothos_zynq_dma_chan_harvest(chan, dmasr);
+        trace_pothos_zynq_dma_irq_poll(chan, dmasr, index, num);
+        pothos_zynq_dma_moder_update(chan, 0, num);
+        if (chan->status != NULL) chan->status->poll_count++;
+
+        //unmask when the ring drains, or when poll moderation was turned off
+        const bool done = (num == 0 || chan->moder_mode != POTHOS_ZYNQ_DMA_MODER_POLL);
+        if (done) pothos_zynq_dma_chan_set_polling(chan, false);
+        spin_unlock_irqrestore(&chan->lock, flags);
+
+        if (num != 0) wake_up_interruptible(&chan->irq_wait);
+        if (done) break;
+    }
+
     return IRQ_HANDLED;
 }
 
@@ -36,14 +484,95 @@ long pothos_zynq_dma_ioctl_wait(pothos_zynq_dma_user_t *user, const pothos_zynq_
     //check that the SG index is in range
     if (wait_args.sgindex >= user->chan->allocs.num_buffs) return -ECHRNG;
 
-    //check that the SG table is set
+    //check that the SG table is set, and that the user manages it
     if (user->chan->sgtable == NULL) return -EADDRNOTAVAIL;
+    if (user->chan->fillq != NULL) return -EINVAL;
 
     //offset to the scatter/gather entry (last buff is sg)
     xilinx_dma_desc_t *desc = user->chan->sgtable + wait_args.sgindex;
 
     //wait on the condition
-    const unsigned long timeout = usecs_to_jiffies(wait_args.timeout_us);
-    wait_event_interruptible_timeout(user->chan->irq_wait, ((desc->status & (1 << 31)) != 0), timeout);
+    trace_pothos_zynq_dma_wait_begin(user->chan, wait_args.sgindex, 1, wait_args.timeout_us);
+    const ktime_t timeout = pothos_zynq_dma_timeout(wait_args.timeout_us);
+    const long ret = wait_event_interruptible_hrtimeout(user->chan->irq_wait, ((desc->status & (1 << 31)) != 0 || READ_ONCE(user->chan->removed)), timeout);
+    trace_pothos_zynq_dma_wait_end(user->chan, wait_args.sgindex, ((desc->status & (1 << 31)) != 0)?1:0, ret);
+    atomic_long_inc(&user->chan->stat_wait_calls);
+    if (ret == -ETIME) atomic_long_inc(&user->chan->stat_wait_timeouts);
+    if (READ_ONCE(user->chan->removed)) return -ENODEV;
     return 0;
 }
+
+/***********************************************************************
+ * Wait for a number of completions
+ **********************************************************************/
+static size_t pothos_zynq_dma_user_num_done(pothos_zynq_dma_user_t *user, size_t index, const size_t max_num)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //the user of a channel with queues waits on the completion entries
+    //that it has not acquired, the index is a completion queue position;
+    //a subscriber waits on the completions after the acquired count on its cursor,
+    //the descriptor status belongs to the owner
+    if (chan->fillq != NULL || user->sub_slot >= 0)
+    {
+        const u32 acquired = (user->sub_slot >= 0)?
+            READ_ONCE(pothos_zynq_dma_sub_cursor(chan, user->sub_slot)->acquired):
+            READ_ONCE(chan->ctrl->acquired);
+        const s32 ready = (s32)(READ_ONCE(chan->status->completed) - acquired);
+        return (ready <= 0)?0:min_t(size_t, ready, max_num);
+    }
+
+    //the engine completes descriptors in order: count until the first incomplete
+    size_t num = 0;
+    while (num < max_num && (chan->sgtable[index].status & (1 << 31)) != 0)
+    {
+        num++;
+        if (++index == chan->allocs.num_buffs) index = 0;
+    }
+    return num;
+}
+
+long pothos_zynq_dma_ioctl_wait_n(pothos_zynq_dma_user_t *user, pothos_zynq_dma_wait_n_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_wait_n_t wait_args;
+    if (copy_from_user(&wait_args, user_config, sizeof(pothos_zynq_dma_wait_n_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (wait_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //check that interrupts are configured
+    if (chan->irq_number == 0 || chan->irq_registered != 0) return -ENODEV;
+
+    //check that the SG index is in range
+    if (wait_args.sgindex >= chan->allocs.num_buffs) return -ECHRNG;
+
+    //check the completion thresholds
+    if (wait_args.min_num == 0 || wait_args.min_num > wait_args.max_num) return -EINVAL;
+    if (wait_args.max_num > chan->allocs.num_buffs) return -EINVAL;
+
+    //check that the SG table is set
+    if (chan->sgtable == NULL) return -EADDRNOTAVAIL;
+
+    //wait on the condition
+    trace_pothos_zynq_dma_wait_begin(chan, wait_args.sgindex, wait_args.min_num, wait_args.timeout_us);
+    const ktime_t timeout = pothos_zynq_dma_timeout(wait_args.timeout_us);
+    const long ret = wait_event_interruptible_hrtimeout(chan->irq_wait,
+        (pothos_zynq_dma_user_num_done(user, wait_args.sgindex, wait_args.min_num) == wait_args.min_num ||
+        READ_ONCE(chan->removed) || READ_ONCE(chan->ownerless)), timeout);
+
+    //report the number completed, which may be more than requested
+    wait_args.num_completed = pothos_zynq_dma_user_num_done(user, wait_args.sgindex, wait_args.max_num);
+    trace_pothos_zynq_dma_wait_end(chan, wait_args.sgindex, wait_args.num_completed, ret);
+    if (copy_to_user(&user_config->num_completed, &wait_args.num_completed, sizeof(size_t)) != 0) return -EACCES;
+
+    atomic_long_inc(&chan->stat_wait_calls);
+    if (ret == -ERESTARTSYS) return ret; //interrupted by a signal
+    if (READ_ONCE(chan->removed)) return -ENODEV; //the engine was removed during the wait
+    if (wait_args.num_completed < wait_args.min_num && READ_ONCE(chan->ownerless)) return -ENODEV; //the owner of the subscribed ring closed
+    if (wait_args.num_completed < wait_args.min_num) atomic_long_inc(&chan->stat_wait_timeouts);
+    if (wait_args.num_completed < wait_args.min_num) return -ETIMEDOUT;
+    return wait_args.num_completed;
+}
@@ -0,0 +1,164 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/module.h> //module_param
+#include <linux/uaccess.h> //copy_to/from_user
+#include <linux/io.h> //iowrite32
+#include <linux/spinlock.h> //spin_lock
+#include <linux/ktime.h> //ktime_get
+#include <linux/math64.h> //div64_u64
+#include <linux/kernel.h> //DIV_ROUND_UP
+
+/***********************************************************************
+ * Moderation parameters
+ **********************************************************************/
+static unsigned int sg_clock_mhz = 100;
+module_param(sg_clock_mhz, uint, 0644);
+MODULE_PARM_DESC(sg_clock_mhz, "AXI DMA scatter/gather clock in MHz (sets the delay timer resolution)");
+
+static unsigned int moder_irq_rate = 20000;
+module_param(moder_irq_rate, uint, 0644);
+MODULE_PARM_DESC(moder_irq_rate, "Target interrupts per second per channel for adaptive moderation");
+
+//! The length of a moderation window in nanoseconds
+#define POTHOS_ZYNQ_DMA_MODER_WINDOW_NS 1000000
+
+//! The longest delay timer in microseconds for the scatter/gather clock
+static u32 pothos_zynq_dma_moder_delay_max_us(void)
+{
+    return (XILINX_DMA_DELAY_MAX*125)/((sg_clock_mhz == 0)?1:sg_clock_mhz);
+}
+
+/***********************************************************************
+ * Program the coalesce and delay counters into the control register
+ **********************************************************************/
+static void pothos_zynq_dma_moder_apply(pothos_zynq_dma_chan_t *chan, u32 coalesce, u32 delay_us)
+{
+    //the delay timer counts in units of 125 scatter/gather clock cycles
+    const u32 clock_mhz = (sg_clock_mhz == 0)?1:sg_clock_mhz;
+    if (delay_us > pothos_zynq_dma_moder_delay_max_us()) delay_us = pothos_zynq_dma_moder_delay_max_us();
+    u32 delay = DIV_ROUND_UP(delay_us*clock_mhz, 125);
+    if (coalesce < 1) coalesce = 1;
+    if (coalesce > XILINX_DMA_COALESCE_MAX) coalesce = XILINX_DMA_COALESCE_MAX;
+    if (delay > XILINX_DMA_DELAY_MAX) delay = XILINX_DMA_DELAY_MAX;
+
+    //the delay interrupt flushes a partial batch when the stream pauses
+    u32 cr = ioread32(chan->register_ctrl);
+    cr &= ~(XILINX_DMA_XR_COALESCE_MASK | XILINX_DMA_XR_DELAY_MASK | XILINX_DMA_XR_IRQ_DELAY_MASK);
+    cr |= (coalesce << XILINX_DMA_COALESCE_SHIFT) | (delay << XILINX_DMA_DELAY_SHIFT);
+    if (delay != 0) cr |= XILINX_DMA_XR_IRQ_DELAY_MASK;
+    iowrite32(cr, chan->register_ctrl);
+
+    chan->moder_coalesce = coalesce;
+    chan->moder_delay_us = (delay*125)/clock_mhz;
+    if (chan->status == NULL) return;
+    chan->status->coalesce = chan->moder_coalesce;
+    chan->status->delay_us = chan->moder_delay_us;
+}
+
+/***********************************************************************
+ * Adaptive moderation: once per window, compare the completion rate
+ * against the target interrupt rate and step the coalesce count
+ * halfway toward the count that would meet the target.
+ **********************************************************************/
+static void pothos_zynq_dma_moder_adapt(pothos_zynq_dma_chan_t *chan, const u64 completion_rate)
+{
+    //keep at least two interrupts per ring so the user can double buffer
+    u32 max_coalesce = chan->allocs.num_buffs/2;
+    if (max_coalesce < 1) max_coalesce = 1;
+    if (max_coalesce > XILINX_DMA_COALESCE_MAX) max_coalesce = XILINX_DMA_COALESCE_MAX;
+
+    u64 target = DIV_ROUND_UP_ULL(completion_rate, (moder_irq_rate == 0)?1:moder_irq_rate);
+    if (target < 1) target = 1;
+    if (target > max_coalesce) target = max_coalesce;
+
+    u32 coalesce = chan->moder_coalesce;
+    if (target > coalesce) coalesce += (target - coalesce + 1)/2;
+    if (target < coalesce) coalesce -= (coalesce - target + 1)/2;
+
+    //the delay timer bounds the latency of a partial batch
+    //to twice the time to fill a batch at the observed rate
+    u64 delay_us = 0;
+    if (coalesce > 1 && completion_rate != 0) delay_us = div64_u64(2000000ULL*coalesce, completion_rate);
+    if (coalesce > 1 && delay_us == 0) delay_us = 1;
+    if (delay_us > pothos_zynq_dma_moder_delay_max_us()) delay_us = pothos_zynq_dma_moder_delay_max_us();
+
+    if (coalesce != chan->moder_coalesce || delay_us != chan->moder_delay_us)
+    {
+        pothos_zynq_dma_moder_apply(chan, coalesce, (u32)delay_us);
+    }
+}
+
+void pothos_zynq_dma_moder_update(pothos_zynq_dma_chan_t *chan, const size_t num_irqs, const size_t num)
+{
+    chan->moder_irqs += num_irqs;
+    chan->moder_completions += num;
+
+    const ktime_t now = ktime_get();
+    const u64 elapsed_ns = ktime_to_ns(ktime_sub(now, chan->moder_start));
+    if (elapsed_ns < POTHOS_ZYNQ_DMA_MODER_WINDOW_NS) return;
+
+    //rates over the window that just ended
+    const u64 irqs = chan->moder_irqs;
+    const u64 completions = chan->moder_completions;
+    const u64 irq_rate = div64_u64(irqs*NSEC_PER_SEC, elapsed_ns);
+    const u64 completion_rate = div64_u64(completions*NSEC_PER_SEC, elapsed_ns);
+
+    //a batch of n completions spread over the window waits (n-1)/(2*rate)
+    //on average for its interrupt: (completions - irqs)*elapsed/(2*completions*irqs);
+    //the poll thread harvests without interrupts, so there is no wait to estimate
+    u64 latency_ns = 0;
+    if (irqs != 0 && completions > irqs) latency_ns = div64_u64((completions - irqs)*elapsed_ns, 2*completions*irqs);
+
+    if (chan->status != NULL)
+    {
+        chan->status->irq_rate = (u32)irq_rate;
+        chan->status->completion_rate = (u32)completion_rate;
+        chan->status->latency_us = (u32)div64_u64(latency_ns, NSEC_PER_USEC);
+    }
+
+    if (chan->moder_mode == POTHOS_ZYNQ_DMA_MODER_ADAPTIVE) pothos_zynq_dma_moder_adapt(chan, completion_rate);
+
+    chan->moder_start = now;
+    chan->moder_irqs = 0;
+    chan->moder_completions = 0;
+}
+
+/***********************************************************************
+ * Moderation configuration from the user
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_moderation(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_moder_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_moder_t moder_args;
+    if (copy_from_user(&moder_args, user_config, sizeof(pothos_zynq_dma_moder_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (moder_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //check the mode and the manual settings
+    if (moder_args.mode > POTHOS_ZYNQ_DMA_MODER_POLL) return -EINVAL;
+    if (moder_args.mode == POTHOS_ZYNQ_DMA_MODER_MANUAL)
+    {
+        if (moder_args.coalesce < 1 || moder_args.coalesce > XILINX_DMA_COALESCE_MAX) return -EINVAL;
+        if (moder_args.delay_us > pothos_zynq_dma_moder_delay_max_us()) return -ERANGE;
+    }
+
+    //restart the window and program the initial counters:
+    //adaptive moderation starts from one interrupt per completion,
+    //and poll moderation interrupts on the first completion of a burst
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    chan->moder_mode = moder_args.mode;
+    chan->moder_start = ktime_get();
+    chan->moder_irqs = 0;
+    chan->moder_completions = 0;
+    if (moder_args.mode == POTHOS_ZYNQ_DMA_MODER_MANUAL) pothos_zynq_dma_moder_apply(chan, moder_args.coalesce, moder_args.delay_us);
+    else pothos_zynq_dma_moder_apply(chan, 1, 0);
+    spin_unlock_irqrestore(&chan->lock, flags);
+
+    return 0;
+}
@@ -10,13 +10,22 @@
 #include <linux/of_irq.h>
 #include <linux/slab.h> //kalloc
 #include <linux/io.h> //ioremap
+#include <linux/cdev.h> //cdev_alloc
+#include <linux/idr.h> //idr_alloc
+#include <linux/compiler.h> //WRITE_ONCE
+
+//instantiate the tracepoints in this object
+#define CREATE_TRACE_POINTS
+#include "pothos_zynq_dma_trace.h"
 
 /***********************************************************************
  * Module data structures
  **********************************************************************/
 static struct file_operations pothos_zynq_dma_fops = {
+    owner: THIS_MODULE,
     unlocked_ioctl: pothos_zynq_dma_ioctl,
     mmap: pothos_zynq_dma_mmap,
+    poll: pothos_zynq_dma_poll,
     open: pothos_zynq_dma_open,
     release: pothos_zynq_dma_release
 };
@@ -28,19 +37,82 @@ static pothos_zynq_dma_module_t module_data;
  **********************************************************************/
 static void pothos_zynq_dma_chan_clear(pothos_zynq_dma_chan_t *chan)
 {
+    chan->engine_no = 0;
+    chan->direction = 0;
     chan->allocs.num_buffs = 0;
+    chan->allocs.flags = 0;
     chan->allocs.buffs = NULL;
+    memset(&chan->allocs.slab, 0, sizeof(pothos_zynq_dma_buff_t));
     chan->sgbuff.paddr = 0;
     chan->sgbuff.kaddr = NULL;
     chan->sgbuff.uaddr = NULL;
     chan->sgtable = NULL;
+    chan->dma_dir = DMA_NONE;
     chan->register_ctrl = NULL;
     chan->register_stat = NULL;
+    chan->register_curdesc = NULL;
+    chan->register_taildesc = NULL;
     chan->irq_number = 0;
     init_waitqueue_head(&chan->irq_wait);
     chan->irq_count = 0;
     chan->irq_registered = 0;
+    spin_lock_init(&chan->lock);
+    chan->status = NULL;
+    chan->ctrl = NULL;
+    chan->times = NULL;
+    chan->lengths = NULL;
+    chan->moder_mode = POTHOS_ZYNQ_DMA_MODER_OFF;
+    chan->moder_coalesce = 1;
+    chan->moder_delay_us = 0;
+    chan->moder_start = ktime_set(0, 0);
+    chan->moder_irqs = 0;
+    chan->moder_completions = 0;
+    chan->peer = NULL;
+    chan->recover = false;
+    chan->failed = false;
+    chan->polling = false;
+    chan->mode_start = ktime_set(0, 0);
+    chan->irq_mode_ns = 0;
+    chan->poll_mode_ns = 0;
+    chan->stat_bytes = 0;
+    chan->stat_completions = 0;
+    chan->stat_occupancy_max = 0;
+    chan->stat_errors = 0;
+    chan->stat_error_irqs = 0;
+    chan->stat_restarts = 0;
+    chan->stat_last_complete = ktime_set(0, 0);
+    atomic_long_set(&chan->stat_wait_calls, 0);
+    atomic_long_set(&chan->stat_wait_timeouts, 0);
+    chan->pool_bytes = 0;
+    memset(chan->umems, 0, sizeof(chan->umems));
+    atomic_set(&chan->exports, 0);
+    chan->irq_index = 0;
+    memset(&chan->allocs.statbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    memset(&chan->allocs.ctrlbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    memset(&chan->allocs.timebuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    memset(&chan->allocs.subsbuff, 0, sizeof(pothos_zynq_dma_buff_t));
     chan->claimed = 0;
+    chan->persistent = false;
+    chan->ownerless = false;
+    chan->removed = false;
+    mutex_init(&chan->users_lock);
+    chan->sub_mask = 0;
+    chan->sub_block_mask = 0;
+    chan->ring_ready = false;
+    memset(&chan->allocs.fillbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    memset(&chan->allocs.compbuff, 0, sizeof(pothos_zynq_dma_buff_t));
+    chan->dev = NULL;
+    chan->fillq = NULL;
+    chan->compq = NULL;
+    chan->desc_handles = NULL;
+    mutex_init(&chan->kick_lock);
+    chan->fill_index = 0;
+    chan->fill_consumer = 0;
+    chan->queue_tail = 0;
+    chan->queue_started = false;
+    chan->queue_pending = 0;
+    chan->comp_index = 0;
+    chan->comp_producer = 0;
 }
 
 /***********************************************************************
@@ -49,7 +121,8 @@ static void pothos_zynq_dma_chan_clear(pothos_zynq_dma_chan_t *chan)
 static void pothos_zynq_dma_chan_register_irq(struct platform_device *pdev, pothos_zynq_dma_chan_t *chan)
 {
     if (chan->irq_number == 0) return;
-    chan->irq_registered = devm_request_irq(&pdev->dev, chan->irq_number, pothos_zynq_dma_irq_handler, IRQF_SHARED, "xilinx-dma-controller", chan);
+    chan->irq_registered = devm_request_threaded_irq(&pdev->dev, chan->irq_number,
+        pothos_zynq_dma_irq_handler, pothos_zynq_dma_irq_thread, IRQF_SHARED, "xilinx-dma-controller", chan);
 }
 
 static void pothos_zynq_dma_chan_unregister_irq(struct platform_device *pdev, pothos_zynq_dma_chan_t *chan)
@@ -62,7 +135,7 @@ static void pothos_zynq_dma_chan_unregister_irq(struct platform_device *pdev, po
 /***********************************************************************
  * Per-engine initializer
  **********************************************************************/
-static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine)
+static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine, const size_t engine_no)
 {
     struct platform_device *pdev = engine->pdev;
     struct device_node *node = pdev->dev.of_node;
@@ -71,6 +144,9 @@ static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine)
     engine->regs_phys_addr = 0;
     engine->regs_phys_size = 0;
     engine->regs_virt_addr = NULL;
+    engine->pool = NULL;
+    memset(&engine->pool_region, 0, sizeof(pothos_zynq_dma_buff_t));
+    engine->pool_remapped = false;
 
     //extract the register space
     struct resource *res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -101,6 +177,26 @@ static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine)
     engine->mm2s_chan.register_stat = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_MM2S_DMASR_OFFSET);
     engine->s2mm_chan.register_ctrl = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_S2MM_DMACR_OFFSET);
     engine->s2mm_chan.register_stat = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_S2MM_DMASR_OFFSET);
+    engine->mm2s_chan.register_curdesc = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_MM2S_CURDESC_OFFSET);
+    engine->s2mm_chan.register_curdesc = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_S2MM_CURDESC_OFFSET);
+    engine->mm2s_chan.register_taildesc = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_MM2S_TAILDESC_OFFSET);
+    engine->s2mm_chan.register_taildesc = (void *)((size_t)engine->regs_virt_addr + XILINX_DMA_S2MM_TAILDESC_OFFSET);
+
+    //channel identity for tracing
+    engine->mm2s_chan.engine_no = engine_no;
+    engine->s2mm_chan.engine_no = engine_no;
+    engine->mm2s_chan.direction = POTHOS_ZYNQ_DMA_MM2S;
+    engine->s2mm_chan.direction = POTHOS_ZYNQ_DMA_S2MM;
+
+    //a reset after an error restarts both directions
+    engine->mm2s_chan.peer = &engine->s2mm_chan;
+    engine->s2mm_chan.peer = &engine->mm2s_chan;
+
+    //streaming directions for cacheable buffers
+    engine->mm2s_chan.dma_dir = DMA_TO_DEVICE;
+    engine->s2mm_chan.dma_dir = DMA_FROM_DEVICE;
+    engine->mm2s_chan.dev = &pdev->dev;
+    engine->s2mm_chan.dev = &pdev->dev;
 
     //determine interrupt numbers
     engine->mm2s_chan.irq_number = irq_of_parse_and_map(node, 0);
@@ -111,6 +207,8 @@ static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine)
     {
         dev_err(&pdev->dev, "Error getting IRQ resources from devicetree.\n");
         dev_err(&pdev->dev, "Example 'interrupts = <0 30 4>, <0 29 4>;'\n");
+        engine->mm2s_chan.irq_number = 0;
+        engine->s2mm_chan.irq_number = 0;
         return -1;
     }
 
@@ -118,75 +216,226 @@ static int pothos_zynq_dma_engine_init(pothos_zynq_dma_engine_t *engine)
     pothos_zynq_dma_chan_register_irq(pdev, &engine->mm2s_chan);
     pothos_zynq_dma_chan_register_irq(pdev, &engine->s2mm_chan);
 
+    //claim the optional reserved-memory pool for the rings
+    pothos_zynq_dma_pool_init(engine);
+
     return 0;
 }
 
 /***********************************************************************
- * Per-engine cleanup
+ * Per-engine cleanup on removal:
+ * stop the engine and release the hardware, but keep the allocations
+ * of open files, which are freed when the last file is closed
  **********************************************************************/
 static void pothos_zynq_dma_engine_exit(pothos_zynq_dma_engine_t *engine)
 {
     struct platform_device *pdev = engine->pdev;
 
+    //halt both channels, the bitstream behind the registers may be going away
+    if (engine->regs_virt_addr != NULL)
+    {
+        iowrite32(ioread32(engine->mm2s_chan.register_ctrl) & ~XILINX_DMA_CR_RUNSTOP_MASK, engine->mm2s_chan.register_ctrl);
+        iowrite32(ioread32(engine->s2mm_chan.register_ctrl) & ~XILINX_DMA_CR_RUNSTOP_MASK, engine->s2mm_chan.register_ctrl);
+    }
+
     //unregister interrupt handles
     dev_info(&pdev->dev, "MM2S IRQ[%d] total = %llu\n", engine->mm2s_chan.irq_number, engine->mm2s_chan.irq_count);
     dev_info(&pdev->dev, "S2MM IRQ[%d] total = %llu\n", engine->s2mm_chan.irq_number, engine->s2mm_chan.irq_count);
     pothos_zynq_dma_chan_unregister_irq(pdev, &engine->mm2s_chan);
     pothos_zynq_dma_chan_unregister_irq(pdev, &engine->s2mm_chan);
+    engine->mm2s_chan.irq_number = 0;
+    engine->s2mm_chan.irq_number = 0;
 
     //unmap registers
     if (engine->regs_virt_addr != NULL) iounmap(engine->regs_virt_addr);
+    engine->regs_virt_addr = NULL;
 }
 
 /***********************************************************************
- * Module entry point
+ * Engine references: the device holds one and each open file holds one
  **********************************************************************/
-static int pothos_zynq_dma_module_init(void)
+static void pothos_zynq_dma_engine_free(struct kref *ref)
 {
-    //initialize module data
-    module_data.engines = NULL;
-    module_data.num_engines = 0;
+    pothos_zynq_dma_engine_t *engine = container_of(ref, pothos_zynq_dma_engine_t, ref);
 
-    //locate the platform device
-    struct device_node *node = NULL;
-    for_each_compatible_node(node, NULL, "pothos,xlnx,axi-dma")
-    {
-        struct platform_device *pdev = of_find_device_by_node(node);
-        if (pdev == NULL) continue;
-        module_data.num_engines++;
-        module_data.engines = krealloc(module_data.engines, sizeof(pothos_zynq_dma_engine_t)*module_data.num_engines, GFP_KERNEL);
-        module_data.engines[module_data.num_engines-1].pdev = pdev;
-    }
+    //the pool is released after the last allocation from it is freed
+    pothos_zynq_dma_pool_exit(engine);
+    put_device(&engine->pdev->dev);
+    kfree(engine);
+}
 
-    //initialize each platform device
-    for (size_t i = 0; i < module_data.num_engines; i++)
+pothos_zynq_dma_engine_t *pothos_zynq_dma_engine_get(const unsigned int index)
+{
+    mutex_lock(&module_data.lock);
+    pothos_zynq_dma_engine_t *engine = idr_find(&module_data.engines, index);
+    if (engine != NULL) kref_get(&engine->ref);
+    mutex_unlock(&module_data.lock);
+    return engine;
+}
+
+void pothos_zynq_dma_engine_put(pothos_zynq_dma_engine_t *engine)
+{
+    kref_put(&engine->ref, pothos_zynq_dma_engine_free);
+}
+
+/***********************************************************************
+ * Platform device probe: one device node per engine
+ **********************************************************************/
+static int pothos_zynq_dma_probe(struct platform_device *pdev)
+{
+    pothos_zynq_dma_engine_t *engine = kzalloc(sizeof(pothos_zynq_dma_engine_t), GFP_KERNEL);
+    if (engine == NULL) return -ENOMEM;
+    engine->pdev = pdev;
+    get_device(&pdev->dev);
+    kref_init(&engine->ref);
+    init_rwsem(&engine->remove_lock);
+    engine->removed = false;
+
+    //reserve the lowest free index, so an engine replaced by an overlay gets its node back;
+    //the entry stays NULL so that open cannot find the engine until the node exists
+    mutex_lock(&module_data.lock);
+    int index = idr_alloc(&module_data.engines, NULL, 0, POTHOS_ZYNQ_DMA_MAX_ENGINES, GFP_KERNEL);
+    mutex_unlock(&module_data.lock);
+    if (index < 0)
     {
-        if (pothos_zynq_dma_engine_init(module_data.engines+i) != 0) return -1;
+        dev_err(&pdev->dev, "Error allocating an engine index = %d.\n", index);
+        pothos_zynq_dma_engine_put(engine);
+        return index;
     }
+    engine->index = index;
+    const dev_t devt = MKDEV(MAJOR(module_data.dev_num), index);
+
+    //initialize the hardware
+    int rc = pothos_zynq_dma_engine_init(engine, index);
+    if (rc != 0) goto fail_init;
 
     //register the character device
-    if (alloc_chrdev_region(&module_data.dev_num, 0, 1, MODULE_NAME) < 0)
+    rc = -ENOMEM;
+    engine->c_dev = cdev_alloc();
+    if (engine->c_dev == NULL) goto fail_init;
+    engine->c_dev->ops = &pothos_zynq_dma_fops;
+    engine->c_dev->owner = THIS_MODULE;
+    rc = cdev_add(engine->c_dev, devt, 1);
+    if (rc != 0)
     {
-        return -1;
+        kobject_put(&engine->c_dev->kobj);
+        goto fail_init;
     }
-    if ((module_data.cl = class_create(THIS_MODULE, MODULE_NAME)) == NULL)
+    struct device *dev = device_create(module_data.cl, &pdev->dev, devt, NULL, MODULE_NAME "%d", index);
+    if (IS_ERR(dev))
     {
-        unregister_chrdev_region(module_data.dev_num, 1);
-        return -1;
+        rc = PTR_ERR(dev);
+        goto fail_cdev;
+    }
+
+    //statistics are optional, debugfs may not be available
+    pothos_zynq_dma_debugfs_add(&module_data, engine);
+
+    //publish the engine to open
+    platform_set_drvdata(pdev, engine);
+    mutex_lock(&module_data.lock);
+    idr_replace(&module_data.engines, engine, index);
+    mutex_unlock(&module_data.lock);
+    dev_info(&pdev->dev, "Engine available at /dev/" MODULE_NAME "%d\n", index);
+    return 0;
+
+fail_cdev:
+    cdev_del(engine->c_dev);
+fail_init:
+    pothos_zynq_dma_engine_exit(engine);
+    mutex_lock(&module_data.lock);
+    idr_remove(&module_data.engines, index);
+    mutex_unlock(&module_data.lock);
+    pothos_zynq_dma_engine_put(engine);
+    return (rc < 0)?rc:-ENODEV;
+}
+
+/***********************************************************************
+ * Platform device removal: module unload, unbind, or overlay removal.
+ * Open files of this engine fail with -ENODEV until they are closed,
+ * the other engines are not disturbed.
+ **********************************************************************/
+static int pothos_zynq_dma_remove(struct platform_device *pdev)
+{
+    pothos_zynq_dma_engine_t *engine = platform_get_drvdata(pdev);
+
+    //new opens fail, and the index is free for the next probe
+    mutex_lock(&module_data.lock);
+    idr_remove(&module_data.engines, engine->index);
+    mutex_unlock(&module_data.lock);
+    device_destroy(module_data.cl, MKDEV(MAJOR(module_data.dev_num), engine->index));
+    cdev_del(engine->c_dev);
+    pothos_zynq_dma_debugfs_remove(engine);
+
+    //wake the waiters, then wait for the file operations in progress
+    WRITE_ONCE(engine->mm2s_chan.removed, true);
+    WRITE_ONCE(engine->s2mm_chan.removed, true);
+    wake_up_interruptible_all(&engine->mm2s_chan.irq_wait);
+    wake_up_interruptible_all(&engine->s2mm_chan.irq_wait);
+    down_write(&engine->remove_lock);
+    engine->removed = true;
+    pothos_zynq_dma_engine_exit(engine);
+
+    //persistent rings without a user are freed here, the claimed ones on close
+    if (engine->mm2s_chan.persistent && !engine->mm2s_chan.claimed) pothos_zynq_dma_chan_free(engine, &engine->mm2s_chan);
+    if (engine->s2mm_chan.persistent && !engine->s2mm_chan.claimed) pothos_zynq_dma_chan_free(engine, &engine->s2mm_chan);
+    engine->mm2s_chan.persistent = false;
+    engine->s2mm_chan.persistent = false;
+    up_write(&engine->remove_lock);
+
+    dev_info(&pdev->dev, "Engine removed from /dev/" MODULE_NAME "%zu\n", engine->index);
+    pothos_zynq_dma_engine_put(engine);
+    return 0;
+}
+
+static const struct of_device_id pothos_zynq_dma_of_match[] = {
+    { compatible: "pothos,xlnx,axi-dma" },
+    {}
+};
+MODULE_DEVICE_TABLE(of, pothos_zynq_dma_of_match);
+
+static struct platform_driver pothos_zynq_dma_driver = {
+    probe: pothos_zynq_dma_probe,
+    remove: pothos_zynq_dma_remove,
+    driver: {
+        name: MODULE_NAME,
+        of_match_table: pothos_zynq_dma_of_match
     }
-    if (device_create(module_data.cl, NULL, module_data.dev_num, NULL, MODULE_NAME) == NULL)
+};
+
+/***********************************************************************
+ * Module entry point
+ **********************************************************************/
+static int pothos_zynq_dma_module_init(void)
+{
+    //initialize module data
+    idr_init(&module_data.engines);
+    mutex_init(&module_data.lock);
+    module_data.debugfs_root = NULL;
+
+    //reserve a device number for each engine
+    if (alloc_chrdev_region(&module_data.dev_num, 0, POTHOS_ZYNQ_DMA_MAX_ENGINES, MODULE_NAME) < 0)
     {
-        class_destroy(module_data.cl);
-        unregister_chrdev_region(module_data.dev_num, 1);
         return -1;
     }
-    cdev_init(&module_data.c_dev, &pothos_zynq_dma_fops);
-    if (cdev_add(&module_data.c_dev, module_data.dev_num, 1) == -1)
+    module_data.cl = class_create(THIS_MODULE, MODULE_NAME);
+    if (IS_ERR(module_data.cl))
+    {
+        unregister_chrdev_region(module_data.dev_num, POTHOS_ZYNQ_DMA_MAX_ENGINES);
+        return PTR_ERR(module_data.cl);
+    }
+
+    //statistics are optional, debugfs may not be available
+    pothos_zynq_dma_debugfs_init(&module_data);
+
+    //engines present now are probed here, overlays probe the engines they add
+    const int rc = platform_driver_register(&pothos_zynq_dma_driver);
+    if (rc != 0)
     {
-        device_destroy(module_data.cl, module_data.dev_num);
+        debugfs_remove_recursive(module_data.debugfs_root);
         class_destroy(module_data.cl);
-        unregister_chrdev_region(module_data.dev_num, 1);
-        return -1;
+        unregister_chrdev_region(module_data.dev_num, POTHOS_ZYNQ_DMA_MAX_ENGINES);
+        return rc;
     }
     return 0;
 }
@@ -196,19 +445,16 @@ static int pothos_zynq_dma_module_init(void)
  **********************************************************************/
 static void pothos_zynq_dma_module_exit(void)
 {
-    //remove the character device
-    cdev_del(&module_data.c_dev);
-    device_destroy(module_data.cl, module_data.dev_num);
-    class_destroy(module_data.cl);
-    unregister_chrdev_region(module_data.dev_num, 1);
+    //remove each dma engine, open files keep the module loaded
+    platform_driver_unregister(&pothos_zynq_dma_driver);
 
-    //cleanup each dma engine
-    for (size_t i = 0; i < module_data.num_engines; i++)
-    {
-        pothos_zynq_dma_engine_exit(module_data.engines + i);
-    }
+    //remove the statistics directory
+    debugfs_remove_recursive(module_data.debugfs_root);
 
-    kfree(module_data.engines);
+    //remove the character device numbers
+    class_destroy(module_data.cl);
+    unregister_chrdev_region(module_data.dev_num, POTHOS_ZYNQ_DMA_MAX_ENGINES);
+    idr_destroy(&module_data.engines);
 }
 
 /***********************************************************************
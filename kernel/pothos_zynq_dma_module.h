@@ -6,14 +6,50 @@
 #include <linux/wait.h> //wait_queue_head_t
 #include <linux/cdev.h> //character device
 #include <linux/interrupt.h> //irq types
+#include <linux/dma-direction.h> //dma_data_direction
+#include <linux/spinlock.h> //spinlock_t
+#include <linux/poll.h> //poll_table_struct
+#include <linux/ktime.h> //ktime_t
+#include <linux/atomic.h> //atomic_long_t
+#include <linux/debugfs.h> //struct dentry
+#include <linux/genalloc.h> //struct gen_pool
+#include <linux/scatterlist.h> //struct sg_table
+#include <linux/dma-buf.h> //struct dma_buf
+#include <linux/kref.h> //struct kref
+#include <linux/rwsem.h> //struct rw_semaphore
+#include <linux/idr.h> //struct idr
+#include <linux/mutex.h> //struct mutex
 
 #define MODULE_NAME "pothos_zynq_dma"
 
+//! The number of device nodes reserved for engines (/dev/pothos_zynq_dma0 and up)
+#define POTHOS_ZYNQ_DMA_MAX_ENGINES 32
+
 /*!
- * Data for a single DMA channel (either direction)
+ * A range of user memory pinned and mapped for DMA,
+ * or an imported dma-buf which is mapped by its exporter
  */
 typedef struct
 {
+    struct page **pages; //!< the pinned pages
+    size_t num_pages; //!< the number of pinned pages
+    size_t bytes; //!< the length of the user's range in bytes
+    struct sg_table sgt; //!< the pages from the offset of the user's range
+    struct dma_buf *dmabuf; //!< the imported buffer
+    struct dma_buf_attachment *attach; //!< the attachment of the imported buffer
+    struct sg_table *table; //!< the mapped table (NULL when the slot is free)
+    int nents; //!< the number of mapped entries in the table
+} pothos_zynq_dma_umem_region_t;
+
+/*!
+ * Data for a single DMA channel (either direction)
+ */
+typedef struct pothos_zynq_dma_chan
+{
+    //channel identity for tracing
+    size_t engine_no; //!< index of the engine in the module
+    size_t direction; //!< POTHOS_ZYNQ_DMA_S2MM or POTHOS_ZYNQ_DMA_MM2S
+
     //dma buffer allocations
     pothos_zynq_dma_alloc_t allocs;
 
@@ -23,9 +59,14 @@ typedef struct
     //scatter gather table
     xilinx_dma_desc_t *sgtable;
 
+    //streaming direction for cacheable buffers
+    enum dma_data_direction dma_dir;
+
     //memory mapped registers
     void __iomem *register_ctrl;
     void __iomem *register_stat;
+    void __iomem *register_curdesc;
+    void __iomem *register_taildesc;
 
     //interrupt configuration
     unsigned int irq_number;
@@ -33,9 +74,85 @@ typedef struct
     unsigned long long irq_count;
     int irq_registered;
 
+    //completion tracking for the status page
+    spinlock_t lock; //!< protects the tracking from the interrupt handler
+    pothos_zynq_dma_status_t *status; //!< kernel address of the status page
+    pothos_zynq_dma_ctrl_t *ctrl; //!< kernel address of the control page
+    pothos_zynq_dma_time_t *times; //!< kernel address of the completion timestamps
+    u32 *lengths; //!< kernel address of the completed lengths, after the timestamps
+    size_t irq_index; //!< the next descriptor to count as completed
+
+    //interrupt moderation (protected by the lock)
+    size_t moder_mode; //!< POTHOS_ZYNQ_DMA_MODER_*
+    u32 moder_coalesce; //!< the programmed completions per interrupt
+    u32 moder_delay_us; //!< the programmed delay timer in microseconds
+    ktime_t moder_start; //!< the start time of the current window
+    u32 moder_irqs; //!< interrupts in the current window
+    u32 moder_completions; //!< completions in the current window
+
+    //error recovery: a reset of the engine restarts both channels
+    struct pothos_zynq_dma_chan *peer; //!< the other direction of the engine
+    bool recover; //!< an error interrupt awaits recovery in the interrupt thread (protected by the lock)
+    bool failed; //!< the reset did not complete, the channel stays halted (protected by the lock)
+
+    //interrupt masking under poll moderation (protected by the lock)
+    bool polling; //!< the interrupt is masked and the thread is polling
+    ktime_t mode_start; //!< the time of the last switch between interrupts and polling
+    u64 irq_mode_ns; //!< time spent with the interrupt unmasked
+    u64 poll_mode_ns; //!< time spent with the interrupt masked and polling
+
+    //lifetime statistics for debugfs and the stats IOCTL
+    u64 stat_bytes; //!< bytes transferred by completed descriptors (protected by the lock)
+    u64 stat_completions; //!< descriptors completed (protected by the lock)
+    u32 stat_occupancy_max; //!< high-water mark of completions not acquired (protected by the lock)
+    u32 stat_errors; //!< sticky DMASR error bits (protected by the lock)
+    u64 stat_error_irqs; //!< error interrupts (protected by the lock)
+    u64 stat_restarts; //!< in-place ring restarts (protected by the lock)
+    ktime_t stat_last_complete; //!< the time of the last completion (protected by the lock)
+    atomic_long_t stat_wait_calls; //!< wait IOCTL calls
+    atomic_long_t stat_wait_timeouts; //!< wait IOCTL calls which timed out
+    size_t pool_bytes; //!< bytes held from the engine's pool by alloc and free
+
+    //registered user memory by handle
+    pothos_zynq_dma_umem_region_t umems[POTHOS_ZYNQ_DMA_UMEM_MAX];
+
+    //dma-buf exports which hold the allocation
+    atomic_t exports;
+
     //claim flag for safety
     int claimed;
 
+    //the allocation and the running ring outlive the claim,
+    //the next user of the channel attaches to them (protected by the remove lock)
+    bool persistent;
+
+    //the owner closed while subscribers mapped its ring: the engine is halted,
+    //the subscribers get a hangup, and the next owner cannot allocate until the last one closes
+    bool ownerless;
+
+    //the engine was removed, waiters return early
+    bool removed;
+
+    //read-only subscribers to an S2MM ring: the status page publishes the masks
+    struct mutex users_lock; //!< serializes the claim and the subscriptions against the release
+    u32 sub_mask; //!< the subscriber slots in use (protected by the lock)
+    u32 sub_block_mask; //!< the slots with the block policy (protected by the lock)
+    bool ring_ready; //!< the owner reset the ring since the allocation or the free check, subscribers may start (protected by the lock)
+
+    //kernel-managed SG table: the user exchanges handles through the queues
+    struct device *dev; //!< the device for cache maintenance in the interrupt handler
+    pothos_zynq_dma_queue_t *fillq; //!< kernel address of the fill queue (NULL for a user-managed SG table)
+    pothos_zynq_dma_queue_t *compq; //!< kernel address of the completion queue
+    u32 *desc_handles; //!< the handle loaded into each descriptor
+    struct mutex kick_lock; //!< serializes the kicks against the ring reset and the free
+    size_t fill_index; //!< the next fill entry to consume (protected by the kick lock)
+    u32 fill_consumer; //!< fill entries consumed (protected by the kick lock)
+    size_t queue_tail; //!< the next descriptor to load (protected by the kick lock)
+    bool queue_started; //!< the engine runs the SG table (protected by the kick lock)
+    size_t queue_pending; //!< descriptors loaded and not completed (protected by the lock)
+    size_t comp_index; //!< the next completion entry to post (protected by the lock)
+    u32 comp_producer; //!< completion entries posted (protected by the lock)
+
 } pothos_zynq_dma_chan_t;
 
 /*!
@@ -46,11 +163,28 @@ typedef struct
     //the platform device from probe
     struct platform_device *pdev;
 
+    //device node registration
+    size_t index; //!< the N in /dev/pothos_zynq_dmaN
+    struct cdev *c_dev; //!< the character device for this engine
+    struct dentry *debugfs_dir; //!< the statistics directory for this engine
+
+    //lifetime across removal: open files hold a reference,
+    //the remove lock is held for read over each file operation
+    //and held for write while the removed engine is stopped
+    struct kref ref;
+    struct rw_semaphore remove_lock;
+    bool removed; //!< the device was removed, file operations fail with -ENODEV
+
     //dma engine register space
     phys_addr_t regs_phys_addr; //!< hardware address of the registers from device tree
     size_t regs_phys_size; //!< size in bytes of the registers from device tree
     void __iomem *regs_virt_addr; //!< virtual mapping of register space from ioremap
 
+    //optional pool from a reserved-memory region, NULL for the system allocator
+    struct gen_pool *pool; //!< page granular allocator over the region
+    pothos_zynq_dma_buff_t pool_region; //!< the coherent mapping of the region
+    bool pool_remapped; //!< a no-map region mapped in full rather than claimed from the coherent pool
+
     //channel data - both directions
     pothos_zynq_dma_chan_t mm2s_chan;
     pothos_zynq_dma_chan_t s2mm_chan;
@@ -61,15 +195,17 @@ typedef struct
  */
 typedef struct
 {
-    // available engines in this system
-    pothos_zynq_dma_engine_t *engines;
-    size_t num_engines;
+    //probed engines by device node index (protected by the lock)
+    struct idr engines;
+    struct mutex lock;
 
-    //devfs registration
+    //devfs registration, one minor per engine
     dev_t dev_num;
-    struct cdev c_dev;
     struct class *cl;
 
+    //debugfs statistics directory
+    struct dentry *debugfs_root;
+
 } pothos_zynq_dma_module_t;
 
 /*!
@@ -78,20 +214,27 @@ typedef struct
  */
 typedef struct
 {
-    pothos_zynq_dma_module_t *module;
-    pothos_zynq_dma_engine_t *engine;
+    pothos_zynq_dma_engine_t *engine; //!< the engine of the opened node (referenced)
     pothos_zynq_dma_chan_t *chan;
+    struct file *filp; //!< the open file, referenced by dma-buf exports
+    int sub_slot; //!< the subscriber slot, -1 for the owner of the channel
 } pothos_zynq_dma_user_t;
 
 //! Interrupt handler for either direction
 irqreturn_t pothos_zynq_dma_irq_handler(int irq, void *data);
 
+//! Interrupt thread which polls for completions with the interrupt masked
+irqreturn_t pothos_zynq_dma_irq_thread(int irq, void *data);
+
 //! IOCTL access for user to control allocations
 long pothos_zynq_dma_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 
 //! Map DMA and device registers into userspace
 int pothos_zynq_dma_mmap(struct file *filp, struct vm_area_struct *vma);
 
+//! Poll the channel for completions against the user's acquired count
+unsigned int pothos_zynq_dma_poll(struct file *filp, struct poll_table_struct *wait);
+
 //! The user calls open on the device node
 int pothos_zynq_dma_open(struct inode *inode, struct file *filp);
 
@@ -104,8 +247,97 @@ long pothos_zynq_dma_ioctl_chan(pothos_zynq_dma_user_t *user, const pothos_zynq_
 //! Allocate DMA buffers from IOCTL configuration struct
 long pothos_zynq_dma_ioctl_alloc(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config);
 
+//! Claim the engine's reserved-memory region for DMA buffers (when configured in device tree)
+void pothos_zynq_dma_pool_init(pothos_zynq_dma_engine_t *engine);
+
+//! Release the engine's reserved-memory region
+void pothos_zynq_dma_pool_exit(pothos_zynq_dma_engine_t *engine);
+
 //! Free DMA buffers allocated from buffs alloc
-long pothos_zynq_dma_ioctl_free(pothos_zynq_dma_user_t *user);
+long pothos_zynq_dma_ioctl_free(pothos_zynq_dma_user_t *user, const size_t check);
+
+//! Free the allocations of a channel without a user (persistent rings on removal)
+long pothos_zynq_dma_chan_free(pothos_zynq_dma_engine_t *engine, pothos_zynq_dma_chan_t *chan);
+
+//! Keep the allocation and the running ring when the channel is released
+long pothos_zynq_dma_ioctl_persist(pothos_zynq_dma_user_t *user, const size_t enable);
+
+//! Describe the allocation of a persistent ring from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_attach(pothos_zynq_dma_user_t *user, pothos_zynq_dma_alloc_t *user_config);
+
+//! Subscribe read-only to the S2MM ring of another user from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_subscribe(pothos_zynq_dma_user_t *user, pothos_zynq_dma_subscribe_t *user_config);
+
+//! Give up the subscriber slot on close, the last subscriber frees a ring without an owner
+void pothos_zynq_dma_unsubscribe(pothos_zynq_dma_user_t *user);
+
+//! The kernel address of the cursor page of a subscriber slot
+pothos_zynq_dma_cursor_t *pothos_zynq_dma_sub_cursor(pothos_zynq_dma_chan_t *chan, const size_t slot);
+
+//! Cache maintenance on a range of DMA buffers from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_sync(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_sync_t *user_config, const int for_device);
+
+//! Reset the completion tracking from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_ring_reset(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_ring_t *user_config);
+
+//! Configure interrupt moderation from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_moderation(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_moder_t *user_config);
+
+//! Account for interrupts and completions in the moderation window (called with the lock held)
+void pothos_zynq_dma_moder_update(pothos_zynq_dma_chan_t *chan, const size_t num_irqs, const size_t num);
+
+//! Read the channel statistics into the IOCTL configuration struct
+long pothos_zynq_dma_ioctl_stats(pothos_zynq_dma_user_t *user, pothos_zynq_dma_stats_t *user_config);
+
+//! Create the debugfs statistics directory for the module
+void pothos_zynq_dma_debugfs_init(pothos_zynq_dma_module_t *module);
+
+//! Create the debugfs statistics files for an engine and each direction
+void pothos_zynq_dma_debugfs_add(pothos_zynq_dma_module_t *module, pothos_zynq_dma_engine_t *engine);
+
+//! Remove the debugfs statistics files of an engine
+void pothos_zynq_dma_debugfs_remove(pothos_zynq_dma_engine_t *engine);
+
+//! Find the engine of a device node and take a reference (NULL when removed)
+pothos_zynq_dma_engine_t *pothos_zynq_dma_engine_get(const unsigned int index);
+
+//! Drop a reference taken on open, the last frees the engine
+void pothos_zynq_dma_engine_put(pothos_zynq_dma_engine_t *engine);
+
+//! Halt the engine of a channel at the end of the current descriptor (with the kick lock held for queues)
+long pothos_zynq_dma_chan_halt(pothos_zynq_dma_chan_t *chan);
+
+//! Unmap and unpin every registered region, with the engine halted
+void pothos_zynq_dma_umem_release_all(pothos_zynq_dma_user_t *user);
+
+//! Pin and map user memory from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_umem_reg(pothos_zynq_dma_user_t *user, pothos_zynq_dma_umem_t *user_config);
+
+//! Unmap and unpin a registered region by handle
+long pothos_zynq_dma_ioctl_umem_unreg(pothos_zynq_dma_user_t *user, const size_t handle);
+
+//! Cache maintenance on a range of registered user memory from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_umem_sync(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_umem_sync_t *user_config, const int for_device);
+
+//! Import a dma-buf as a registered region from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_import(pothos_zynq_dma_user_t *user, pothos_zynq_dma_import_t *user_config);
+
+//! Export a DMA buffer as a dma-buf from IOCTL configuration struct
+long pothos_zynq_dma_ioctl_export(pothos_zynq_dma_user_t *user, pothos_zynq_dma_export_t *user_config);
+
+//! Load the fill queue into the SG table and start the engine
+long pothos_zynq_dma_ioctl_kick(pothos_zynq_dma_user_t *user);
+
+
+//! Reload the SG table and seed the queues from the completed count (called with both locks held)
+void pothos_zynq_dma_queue_seed(pothos_zynq_dma_chan_t *chan, const u32 completed);
+
+//! Count the completed descriptors of a channel with queues (called with the lock held)
+size_t pothos_zynq_dma_queue_num_done(pothos_zynq_dma_chan_t *chan);
+
+//! Post completion entries for the completed descriptors (called with the lock held)
+void pothos_zynq_dma_queue_post(pothos_zynq_dma_chan_t *chan, const size_t num, const ktime_t now);
 
 //! Wait on DMA completion from IOCTL configuration struct
 long pothos_zynq_dma_ioctl_wait(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_wait_t *user_config);
+long pothos_zynq_dma_ioctl_wait_n(pothos_zynq_dma_user_t *user, pothos_zynq_dma_wait_n_t *user_config);
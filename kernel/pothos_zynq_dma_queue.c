@@ -0,0 +1,216 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/io.h> //iowrite32
+#include <linux/dma-mapping.h> //dma_sync_single_for_cpu/device
+#include <linux/spinlock.h> //spin_lock_irqsave
+#include <linux/compiler.h> //READ_ONCE
+#include <linux/mutex.h> //mutex_lock
+#include <linux/string.h> //memcpy
+#include <linux/kernel.h> //min_t
+#include "pothos_zynq_dma_trace.h"
+
+static pothos_zynq_dma_queue_entry_t *pothos_zynq_dma_queue_entries(pothos_zynq_dma_queue_t *queue)
+{
+    return (pothos_zynq_dma_queue_entry_t *)(queue + 1);
+}
+
+/***********************************************************************
+ * Reload: the ring reset of a channel with queues halts the engine,
+ * links the SG table with every descriptor free, and seeds the
+ * completion queue with the handles that the user should start with.
+ * The queue counts continue the sequence of the control page.
+ **********************************************************************/
+void pothos_zynq_dma_queue_seed(pothos_zynq_dma_chan_t *chan, const u32 completed)
+{
+    const size_t num_buffs = chan->allocs.num_buffs;
+
+    //a free descriptor is marked complete, the kick clears the status of each one it loads
+    for (size_t i = 0; i < num_buffs; i++)
+    {
+        xilinx_dma_desc_t *desc = chan->sgtable + i;
+        memset(desc, 0, sizeof(xilinx_dma_desc_t));
+        desc->next_desc = chan->sgbuff.paddr + ((i + 1) % num_buffs)*sizeof(xilinx_dma_desc_t);
+        desc->status = (1 << 31);
+        chan->desc_handles[i] = 0;
+    }
+    chan->queue_tail = 0;
+    chan->queue_pending = 0;
+
+    //the fill queue starts at the released count of the control page
+    chan->fill_index = 0;
+    chan->fill_consumer = READ_ONCE(chan->ctrl->released);
+    WRITE_ONCE(chan->fillq->producer, chan->fill_consumer);
+    WRITE_ONCE(chan->fillq->consumer, chan->fill_consumer);
+
+    //the completed count ahead of the acquired count is handed out as handles from 0
+    const u32 acquired = READ_ONCE(chan->ctrl->acquired);
+    const s32 ahead = (s32)(completed - acquired);
+    const size_t seed = (ahead <= 0)?0:min_t(size_t, ahead, num_buffs);
+    pothos_zynq_dma_queue_entry_t *entries = pothos_zynq_dma_queue_entries(chan->compq);
+    memset(entries, 0, num_buffs*sizeof(pothos_zynq_dma_queue_entry_t));
+    for (size_t i = 0; i < seed; i++) entries[i].handle = i;
+    chan->comp_index = seed % num_buffs;
+    chan->comp_producer = completed;
+    WRITE_ONCE(chan->compq->consumer, acquired);
+    WRITE_ONCE(chan->compq->producer, completed);
+
+    //the kick starts the engine, which interrupts on each completion
+    if (!chan->polling) iowrite32(ioread32(chan->register_ctrl) | XILINX_DMA_XR_IRQ_IOC_MASK, chan->register_ctrl);
+}
+
+/***********************************************************************
+ * Completions (called with the lock held): the kernel loaded the
+ * descriptors, so the complete bits are trusted up to the pending number,
+ * and each completion posts the handle that was loaded into it.
+ **********************************************************************/
+size_t pothos_zynq_dma_queue_num_done(pothos_zynq_dma_chan_t *chan)
+{
+    const size_t num_buffs = chan->allocs.num_buffs;
+    size_t num = 0;
+    size_t index = chan->irq_index;
+    while (num < chan->queue_pending && (chan->sgtable[index].status & (1 << 31)) != 0)
+    {
+        num++;
+        if (++index == num_buffs) index = 0;
+    }
+    return num;
+}
+
+void pothos_zynq_dma_queue_post(pothos_zynq_dma_chan_t *chan, const size_t num, const ktime_t now)
+{
+    const size_t num_buffs = chan->allocs.num_buffs;
+    const bool cacheable = ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0);
+    pothos_zynq_dma_queue_entry_t *entries = pothos_zynq_dma_queue_entries(chan->compq);
+    for (size_t i = 0, index = chan->irq_index; i < num; i++, index = (index + 1) % num_buffs)
+    {
+        const xilinx_dma_desc_t *desc = chan->sgtable + index;
+        const u32 handle = chan->desc_handles[index];
+        const u32 length = desc->status & XILINX_DMA_BD_LEN_MASK;
+        pothos_zynq_dma_queue_entry_t *entry = entries + chan->comp_index;
+        entry->handle = handle;
+        entry->length = length;
+        entry->status = desc->status & XILINX_DMA_BD_ERR_ALL_MASK;
+        entry->app[0] = desc->app_0;
+        entry->app[1] = desc->app_1;
+        entry->app[2] = desc->app_2;
+        entry->app[3] = desc->app_3;
+        entry->app[4] = desc->app_4;
+        if (++chan->comp_index == num_buffs) chan->comp_index = 0;
+        chan->stat_bytes += length;
+        if (chan->times != NULL) chan->times[handle] = ktime_to_ns(now);
+        if (chan->lengths != NULL) chan->lengths[handle] = length;
+
+        //the user never syncs the buffer from a completion entry:
+        //invalidate the received bytes before the entry is published
+        if (cacheable && length != 0) dma_sync_single_for_cpu(chan->dev, chan->allocs.buffs[handle].paddr, length, chan->dma_dir);
+    }
+
+    //publish the entries before the count that the user checks
+    chan->queue_pending -= num;
+    chan->comp_producer += num;
+    smp_wmb();
+    WRITE_ONCE(chan->compq->producer, chan->comp_producer);
+}
+
+/***********************************************************************
+ * Kick: load the fill entries into the free descriptors and ring the
+ * doorbell once for the batch. The entries are copied before they are
+ * checked, since the user can rewrite them at any time, and only the
+ * positions kept by the kernel index the queue and the SG table.
+ **********************************************************************/
+static long pothos_zynq_dma_queue_kick(pothos_zynq_dma_chan_t *chan, size_t *avail)
+{
+    pothos_zynq_dma_queue_t *fillq = chan->fillq;
+    const size_t num_buffs = chan->allocs.num_buffs;
+    const bool mm2s = (chan->direction == POTHOS_ZYNQ_DMA_MM2S);
+    const bool cacheable = ((chan->allocs.flags & POTHOS_ZYNQ_DMA_ALLOC_CACHEABLE) != 0);
+
+    //the published entries, up to the descriptors which are free:
+    //the interrupt handler only lowers the pending number
+    *avail = (u32)(READ_ONCE(fillq->producer) - chan->fill_consumer);
+    smp_rmb();
+    const size_t num = min_t(size_t, *avail, num_buffs - READ_ONCE(chan->queue_pending));
+    const pothos_zynq_dma_queue_entry_t *entries = pothos_zynq_dma_queue_entries(fillq);
+
+    //fill in the descriptors after the last one loaded,
+    //which stay marked complete until the pending number includes them
+    long ret = 0;
+    size_t loaded = 0;
+    for (; loaded < num; loaded++)
+    {
+        pothos_zynq_dma_queue_entry_t entry;
+        memcpy(&entry, entries + chan->fill_index, sizeof(pothos_zynq_dma_queue_entry_t));
+        if (entry.handle >= num_buffs)
+        {
+            ret = -EINVAL;
+            break;
+        }
+
+        //the engine fills the whole buffer for S2MM, MM2S sends the length of the entry
+        const pothos_zynq_dma_buff_t *buff = chan->allocs.buffs + entry.handle;
+        u32 length = min_t(size_t, buff->bytes, XILINX_DMA_BD_LEN_MASK);
+        if (mm2s && (entry.length == 0 || entry.length > length))
+        {
+            ret = -EINVAL;
+            break;
+        }
+        if (mm2s) length = entry.length;
+
+        const size_t index = (chan->queue_tail + loaded) % num_buffs;
+        xilinx_dma_desc_t *desc = chan->sgtable + index;
+        desc->buf_addr = buff->paddr;
+        desc->control = length | (mm2s?(XILINX_DMA_BD_SOP | XILINX_DMA_BD_EOP):0);
+        desc->app_0 = mm2s?entry.app[0]:0;
+        desc->app_1 = mm2s?entry.app[1]:0;
+        desc->app_2 = mm2s?entry.app[2]:0;
+        desc->app_3 = mm2s?entry.app[3]:0;
+        desc->app_4 = mm2s?entry.app[4]:0;
+        chan->desc_handles[index] = entry.handle;
+        if (cacheable) dma_sync_single_for_device(chan->dev, buff->paddr, length, chan->dma_dir);
+        if (++chan->fill_index == num_buffs) chan->fill_index = 0;
+    }
+
+    //hand the descriptors to the engine under the lock, the writes to the
+    //uncached SG table are ordered before the doorbell by the register write
+    if (loaded != 0)
+    {
+        unsigned long flags;
+        spin_lock_irqsave(&chan->lock, flags);
+        const size_t first = chan->queue_tail;
+        for (size_t i = 0; i < loaded; i++) chan->sgtable[(first + i) % num_buffs].status = 0;
+        chan->queue_pending += loaded;
+        chan->queue_tail = (first + loaded) % num_buffs;
+
+        //the first kick since the ring reset starts the engine at the first descriptor loaded
+        if (!chan->queue_started)
+        {
+            iowrite32(chan->sgbuff.paddr + first*sizeof(xilinx_dma_desc_t), chan->register_curdesc);
+            iowrite32(ioread32(chan->register_ctrl) | XILINX_DMA_CR_RUNSTOP_MASK, chan->register_ctrl);
+            chan->queue_started = true;
+        }
+        const size_t tail = (chan->queue_tail + num_buffs - 1) % num_buffs;
+        iowrite32(chan->sgbuff.paddr + tail*sizeof(xilinx_dma_desc_t), chan->register_taildesc);
+        spin_unlock_irqrestore(&chan->lock, flags);
+    }
+
+    //the entries are read before the user can reuse them
+    chan->fill_consumer += loaded;
+    smp_store_release(&fillq->consumer, chan->fill_consumer);
+    return (ret != 0)?ret:(long)loaded;
+}
+
+long pothos_zynq_dma_ioctl_kick(pothos_zynq_dma_user_t *user)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+
+    //the ring reset loads the SG table and seeds the queues first
+    mutex_lock(&chan->kick_lock);
+    size_t avail = 0;
+    long ret = -EADDRNOTAVAIL;
+    if (chan->fillq != NULL && chan->ring_ready) ret = pothos_zynq_dma_queue_kick(chan, &avail);
+    trace_pothos_zynq_dma_kick(chan, avail, chan->queue_tail, ret);
+    mutex_unlock(&chan->kick_lock);
+    return ret;
+}
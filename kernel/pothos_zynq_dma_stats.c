@@ -0,0 +1,164 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/module.h> //THIS_MODULE
+#include <linux/uaccess.h> //copy_to/from_user
+#include <linux/spinlock.h> //spin_lock
+#include <linux/compiler.h> //READ_ONCE
+#include <linux/ktime.h> //ktime_get
+#include <linux/math64.h> //div_u64
+#include <linux/seq_file.h> //seq_printf
+#include <linux/debugfs.h> //debugfs_create_dir
+#include <linux/genalloc.h> //gen_pool_avail
+
+/***********************************************************************
+ * Snapshot of the channel statistics
+ **********************************************************************/
+static void pothos_zynq_dma_chan_stats(pothos_zynq_dma_chan_t *chan, pothos_zynq_dma_stats_t *stats)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    stats->bytes = chan->stat_bytes;
+    stats->completions = chan->stat_completions;
+    stats->irq_count = chan->irq_count;
+    stats->occupancy_max = chan->stat_occupancy_max;
+    stats->errors = chan->stat_errors;
+    stats->idle_us = 0;
+    stats->pool_bytes = chan->pool_bytes;
+    stats->error_irqs = chan->stat_error_irqs;
+    stats->restarts = chan->stat_restarts;
+    if (chan->stat_completions != 0)
+    {
+        stats->idle_us = div_u64(ktime_to_ns(ktime_sub(ktime_get(), chan->stat_last_complete)), NSEC_PER_USEC);
+    }
+    spin_unlock_irqrestore(&chan->lock, flags);
+
+    stats->wait_calls = atomic_long_read(&chan->stat_wait_calls);
+    stats->wait_timeouts = atomic_long_read(&chan->stat_wait_timeouts);
+}
+
+long pothos_zynq_dma_ioctl_stats(pothos_zynq_dma_user_t *user, pothos_zynq_dma_stats_t *user_config)
+{
+    //convert the args into kernel memory
+    pothos_zynq_dma_stats_t stats_args;
+    if (copy_from_user(&stats_args, user_config, sizeof(pothos_zynq_dma_stats_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (stats_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //copy the snapshot back to the user
+    pothos_zynq_dma_chan_stats(user->chan, &stats_args);
+    if (copy_to_user(user_config, &stats_args, sizeof(pothos_zynq_dma_stats_t)) != 0) return -EACCES;
+
+    return 0;
+}
+
+/***********************************************************************
+ * debugfs: pothos_zynq_dma/<engine>/{mm2s,s2mm}
+ **********************************************************************/
+static int pothos_zynq_dma_stats_show(struct seq_file *s, void *unused)
+{
+    pothos_zynq_dma_chan_t *chan = (pothos_zynq_dma_chan_t *)s->private;
+    pothos_zynq_dma_stats_t stats;
+    pothos_zynq_dma_chan_stats(chan, &stats);
+
+    seq_printf(s, "bytes: %llu\n", stats.bytes);
+    seq_printf(s, "completions: %llu\n", stats.completions);
+    seq_printf(s, "irq_count: %llu\n", stats.irq_count);
+    seq_printf(s, "wait_calls: %llu\n", stats.wait_calls);
+    seq_printf(s, "wait_timeouts: %llu\n", stats.wait_timeouts);
+    seq_printf(s, "occupancy_max: %u\n", stats.occupancy_max);
+    seq_printf(s, "errors: 0x%x\n", stats.errors);
+    seq_printf(s, "idle_us: %llu\n", stats.idle_us);
+    seq_printf(s, "pool_bytes: %llu\n", stats.pool_bytes);
+    seq_printf(s, "error_irqs: %llu\n", stats.error_irqs);
+    seq_printf(s, "restarts: %llu\n", stats.restarts);
+    seq_printf(s, "persistent: %d\n", chan->persistent?1:0);
+    seq_printf(s, "ownerless: %d\n", chan->ownerless?1:0);
+
+    //the cursor pages stay allocated while their slots are in use
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    for (size_t slot = 0; slot < POTHOS_ZYNQ_DMA_SUBS_MAX; slot++)
+    {
+        if ((chan->sub_mask & (1u << slot)) == 0 || chan->status == NULL) continue;
+        const pothos_zynq_dma_cursor_t *cursor = pothos_zynq_dma_sub_cursor(chan, slot);
+        seq_printf(s, "subscriber%zu: policy=%s lag=%d delivered=%u dropped=%u overruns=%u\n", slot,
+            ((chan->sub_block_mask & (1u << slot)) != 0)?"block":"drop",
+            (s32)(READ_ONCE(chan->status->completed) - READ_ONCE(cursor->released)),
+            READ_ONCE(cursor->delivered), READ_ONCE(cursor->dropped), READ_ONCE(cursor->overruns));
+    }
+    spin_unlock_irqrestore(&chan->lock, flags);
+    return 0;
+}
+
+static int pothos_zynq_dma_stats_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, pothos_zynq_dma_stats_show, inode->i_private);
+}
+
+/***********************************************************************
+ * debugfs: pothos_zynq_dma/<engine>/pool
+ **********************************************************************/
+static int pothos_zynq_dma_pool_show(struct seq_file *s, void *unused)
+{
+    pothos_zynq_dma_engine_t *engine = (pothos_zynq_dma_engine_t *)s->private;
+    pothos_zynq_dma_stats_t mm2s, s2mm;
+    pothos_zynq_dma_chan_stats(&engine->mm2s_chan, &mm2s);
+    pothos_zynq_dma_chan_stats(&engine->s2mm_chan, &s2mm);
+
+    seq_printf(s, "size: %zu\n", engine->pool_region.bytes);
+    seq_printf(s, "avail: %zu\n", (engine->pool == NULL)?0:gen_pool_avail(engine->pool));
+    seq_printf(s, "mm2s: %llu\n", mm2s.pool_bytes);
+    seq_printf(s, "s2mm: %llu\n", s2mm.pool_bytes);
+    return 0;
+}
+
+static int pothos_zynq_dma_pool_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, pothos_zynq_dma_pool_show, inode->i_private);
+}
+
+static const struct file_operations pothos_zynq_dma_pool_fops = {
+    owner: THIS_MODULE,
+    open: pothos_zynq_dma_pool_open,
+    read: seq_read,
+    llseek: seq_lseek,
+    release: single_release
+};
+
+static const struct file_operations pothos_zynq_dma_stats_fops = {
+    owner: THIS_MODULE,
+    open: pothos_zynq_dma_stats_open,
+    read: seq_read,
+    llseek: seq_lseek,
+    release: single_release
+};
+
+void pothos_zynq_dma_debugfs_init(pothos_zynq_dma_module_t *module)
+{
+    module->debugfs_root = debugfs_create_dir(MODULE_NAME, NULL);
+    if (IS_ERR_OR_NULL(module->debugfs_root)) module->debugfs_root = NULL;
+}
+
+void pothos_zynq_dma_debugfs_add(pothos_zynq_dma_module_t *module, pothos_zynq_dma_engine_t *engine)
+{
+    engine->debugfs_dir = NULL;
+    if (module->debugfs_root == NULL) return;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%zu", engine->index);
+    struct dentry *dir = debugfs_create_dir(name, module->debugfs_root);
+    if (IS_ERR_OR_NULL(dir)) return;
+    engine->debugfs_dir = dir;
+    debugfs_create_file("mm2s", 0444, dir, &engine->mm2s_chan, &pothos_zynq_dma_stats_fops);
+    debugfs_create_file("s2mm", 0444, dir, &engine->s2mm_chan, &pothos_zynq_dma_stats_fops);
+    if (engine->pool != NULL) debugfs_create_file("pool", 0444, dir, engine, &pothos_zynq_dma_pool_fops);
+}
+
+void pothos_zynq_dma_debugfs_remove(pothos_zynq_dma_engine_t *engine)
+{
+    debugfs_remove_recursive(engine->debugfs_dir);
+    engine->debugfs_dir = NULL;
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/uaccess.h> //copy_to/from_user
+#include <linux/spinlock.h> //spin_lock_irqsave
+#include <linux/compiler.h> //READ_ONCE
+#include <linux/mutex.h> //mutex_lock
+#include <linux/bitops.h> //ffz
+#include <linux/string.h> //memset
+#include "pothos_zynq_dma_trace.h"
+
+//! Every subscriber slot in use
+#define POTHOS_ZYNQ_DMA_SUBS_FULL ((u32)((1ULL << POTHOS_ZYNQ_DMA_SUBS_MAX) - 1))
+
+pothos_zynq_dma_cursor_t *pothos_zynq_dma_sub_cursor(pothos_zynq_dma_chan_t *chan, const size_t slot)
+{
+    return (pothos_zynq_dma_cursor_t *)((char *)chan->allocs.subsbuff.kaddr + slot*PAGE_SIZE);
+}
+
+/***********************************************************************
+ * Publish the subscriber slots on the status page (called with the lock held)
+ **********************************************************************/
+static void pothos_zynq_dma_sub_publish(pothos_zynq_dma_chan_t *chan)
+{
+    if (chan->status == NULL) return;
+    WRITE_ONCE(chan->status->sub_mask, chan->sub_mask);
+    WRITE_ONCE(chan->status->sub_block_mask, chan->sub_block_mask);
+}
+
+/***********************************************************************
+ * Subscribe to the ring of the owner of the S2MM channel:
+ * the subscriber never claims the channel, it reads the completions
+ * in the same sequence as the owner and publishes its progress on its
+ * cursor page, which holds back the owner's releases under the block policy.
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_subscribe(pothos_zynq_dma_user_t *user, pothos_zynq_dma_subscribe_t *user_config)
+{
+    pothos_zynq_dma_engine_t *engine = user->engine;
+
+    //copy the buffer into kernel space
+    pothos_zynq_dma_subscribe_t sub_args;
+    if (copy_from_user(&sub_args, user_config, sizeof(pothos_zynq_dma_subscribe_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (sub_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //the engine is the one of the opened device node, and only received streams have subscribers
+    if (sub_args.engine_no != engine->index) return -EINVAL;
+    if (sub_args.direction != POTHOS_ZYNQ_DMA_S2MM) return -EINVAL;
+    if (sub_args.policy != POTHOS_ZYNQ_DMA_LAG_BLOCK && sub_args.policy != POTHOS_ZYNQ_DMA_LAG_DROP) return -EINVAL;
+
+    //the file descriptor either owns the channel or subscribes to it
+    if (user->chan != NULL) return -EBUSY;
+    pothos_zynq_dma_chan_t *chan = &engine->s2mm_chan;
+    const bool block = (sub_args.policy == POTHOS_ZYNQ_DMA_LAG_BLOCK);
+
+    mutex_lock(&chan->users_lock);
+    long ret = 0;
+    size_t slot = 0;
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+
+    //the owner has allocated the ring, reset its completion tracking, and is still open
+    if (!chan->ring_ready || chan->ownerless || chan->status == NULL || chan->allocs.subsbuff.kaddr == NULL) ret = -EADDRNOTAVAIL;
+    else if (chan->fillq != NULL) ret = -EOPNOTSUPP; //completions of a ring with queues are handed out once
+    else if (chan->sub_mask == POTHOS_ZYNQ_DMA_SUBS_FULL) ret = -EBUSY;
+    else
+    {
+        //start at the next completion, or after the last one that the owner
+        //handed back to the engine when it acquired ahead of the status page
+        const size_t num_buffs = chan->allocs.num_buffs;
+        u32 start = READ_ONCE(chan->status->completed);
+        size_t sgindex = chan->irq_index;
+        if (chan->ctrl != NULL)
+        {
+            const s32 ahead = (s32)(READ_ONCE(chan->ctrl->released) - start);
+            if (ahead > 0 && (size_t)ahead < num_buffs)
+            {
+                start += ahead;
+                sgindex = (sgindex + ahead) % num_buffs;
+            }
+        }
+
+        //the cursor is in place before the owner observes the slot
+        slot = ffz(chan->sub_mask);
+        pothos_zynq_dma_cursor_t *cursor = pothos_zynq_dma_sub_cursor(chan, slot);
+        memset(cursor, 0, sizeof(pothos_zynq_dma_cursor_t));
+        cursor->released = start;
+        cursor->acquired = start;
+        smp_wmb();
+        chan->sub_mask |= (1u << slot);
+        if (block) chan->sub_block_mask |= (1u << slot);
+        pothos_zynq_dma_sub_publish(chan);
+
+        sub_args.slot = slot;
+        sub_args.ring.sentinel = POTHOS_ZYNQ_DMA_SENTINEL;
+        sub_args.ring.completed = start;
+        sub_args.ring.sgindex = sgindex;
+    }
+    spin_unlock_irqrestore(&chan->lock, flags);
+    if (ret == 0)
+    {
+        user->chan = chan;
+        user->sub_slot = slot;
+    }
+    mutex_unlock(&chan->users_lock);
+    if (ret != 0) return ret;
+
+    trace_pothos_zynq_dma_subscribe(chan, slot, block);
+
+    //the slot is given up on close when the copy fails
+    if (copy_to_user(user_config, &sub_args, sizeof(pothos_zynq_dma_subscribe_t)) != 0) return -EACCES;
+    return 0;
+}
+
+void pothos_zynq_dma_unsubscribe(pothos_zynq_dma_user_t *user)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    const u32 bit = 1u << user->sub_slot;
+
+    //the owner stops checking the cursor once the slot is clear
+    mutex_lock(&chan->users_lock);
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    const bool block = (chan->sub_block_mask & bit) != 0;
+    chan->sub_mask &= ~bit;
+    chan->sub_block_mask &= ~bit;
+    pothos_zynq_dma_sub_publish(chan);
+    spin_unlock_irqrestore(&chan->lock, flags);
+    trace_pothos_zynq_dma_unsubscribe(chan, user->sub_slot, block);
+
+    //the ring outlived its owner for the subscribers, the last one frees it
+    if (chan->sub_mask == 0 && !chan->claimed && !chan->persistent) pothos_zynq_dma_chan_free(user->engine, chan);
+    mutex_unlock(&chan->users_lock);
+
+    user->chan = NULL;
+    user->sub_slot = -1;
+}
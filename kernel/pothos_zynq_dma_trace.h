@@ -0,0 +1,281 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+/***********************************************************************
+ * Tracepoints for the DMA channel lifecycle, for ftrace and perf:
+ *   trace-cmd record -e pothos_zynq_dma
+ *   perf trace -e 'pothos_zynq_dma:*'
+ * The interrupt, wait begin, and wait end events of a descriptor
+ * split its latency into the interrupt, the wake-up, and userspace.
+ **********************************************************************/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pothos_zynq_dma
+
+#if !defined(_POTHOS_ZYNQ_DMA_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _POTHOS_ZYNQ_DMA_TRACE_H
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/tracepoint.h>
+#include <linux/sched.h> //current
+
+#define pothos_zynq_dma_trace_dir(direction) __print_symbolic(direction, \
+    {POTHOS_ZYNQ_DMA_S2MM, "s2mm"}, {POTHOS_ZYNQ_DMA_MM2S, "mm2s"})
+
+/***********************************************************************
+ * Channel setup, teardown, and reattachment to a persistent ring by a user
+ **********************************************************************/
+DECLARE_EVENT_CLASS(pothos_zynq_dma_chan_class,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan),
+    TP_ARGS(chan),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(pid_t, tgid)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->tgid = current->tgid;
+    ),
+    TP_printk("engine=%u dir=%s tgid=%d", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->tgid)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_chan_class, pothos_zynq_dma_chan_setup,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan),
+    TP_ARGS(chan)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_chan_class, pothos_zynq_dma_chan_release,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan),
+    TP_ARGS(chan)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_chan_class, pothos_zynq_dma_chan_attach,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan),
+    TP_ARGS(chan)
+);
+
+/***********************************************************************
+ * Read-only subscribers to an S2MM ring, by slot and lag policy
+ **********************************************************************/
+DECLARE_EVENT_CLASS(pothos_zynq_dma_sub_class,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t slot, bool block),
+    TP_ARGS(chan, slot, block),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, slot)
+        __field(bool, block)
+        __field(pid_t, tgid)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->slot = slot;
+        __entry->block = block;
+        __entry->tgid = current->tgid;
+    ),
+    TP_printk("engine=%u slot=%u policy=%s tgid=%d", __entry->engine_no,
+        __entry->slot, __entry->block?"block":"drop", __entry->tgid)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_sub_class, pothos_zynq_dma_subscribe,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t slot, bool block),
+    TP_ARGS(chan, slot, block)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_sub_class, pothos_zynq_dma_unsubscribe,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t slot, bool block),
+    TP_ARGS(chan, slot, block)
+);
+
+/***********************************************************************
+ * Interrupts and polling passes, with the completions they counted
+ **********************************************************************/
+DECLARE_EVENT_CLASS(pothos_zynq_dma_irq_class,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, u32 dmasr, size_t index, size_t num),
+    TP_ARGS(chan, dmasr, index, num),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, dmasr)
+        __field(u32, index)
+        __field(u32, num)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->dmasr = dmasr;
+        __entry->index = index;
+        __entry->num = num;
+    ),
+    TP_printk("engine=%u dir=%s dmasr=0x%08x sgindex=%u completed=%u", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->dmasr, __entry->index, __entry->num)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_irq_class, pothos_zynq_dma_irq,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, u32 dmasr, size_t index, size_t num),
+    TP_ARGS(chan, dmasr, index, num)
+);
+
+DEFINE_EVENT(pothos_zynq_dma_irq_class, pothos_zynq_dma_irq_poll,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, u32 dmasr, size_t index, size_t num),
+    TP_ARGS(chan, dmasr, index, num)
+);
+
+/***********************************************************************
+ * In-place recovery from a DMA error, with the restart point of the channel
+ **********************************************************************/
+TRACE_EVENT(pothos_zynq_dma_recover,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, u32 dmasr, size_t index, size_t pending, u64 duration_ns, int ret),
+    TP_ARGS(chan, dmasr, index, pending, duration_ns, ret),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, dmasr)
+        __field(u32, index)
+        __field(u32, pending)
+        __field(u64, duration_ns)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->dmasr = dmasr;
+        __entry->index = index;
+        __entry->pending = pending;
+        __entry->duration_ns = duration_ns;
+        __entry->ret = ret;
+    ),
+    TP_printk("engine=%u dir=%s dmasr=0x%08x sgindex=%u pending=%u duration_ns=%llu ret=%d", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->dmasr, __entry->index, __entry->pending,
+        __entry->duration_ns, __entry->ret)
+);
+
+/***********************************************************************
+ * Wait calls: begin with the request, end with the outcome
+ **********************************************************************/
+TRACE_EVENT(pothos_zynq_dma_wait_begin,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t sgindex, size_t min_num, long timeout_us),
+    TP_ARGS(chan, sgindex, min_num, timeout_us),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, sgindex)
+        __field(u32, min_num)
+        __field(long, timeout_us)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->sgindex = sgindex;
+        __entry->min_num = min_num;
+        __entry->timeout_us = timeout_us;
+    ),
+    TP_printk("engine=%u dir=%s sgindex=%u min=%u timeout_us=%ld", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->sgindex, __entry->min_num, __entry->timeout_us)
+);
+
+TRACE_EVENT(pothos_zynq_dma_wait_end,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t sgindex, size_t num, long ret),
+    TP_ARGS(chan, sgindex, num, ret),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, sgindex)
+        __field(u32, num)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->sgindex = sgindex;
+        __entry->num = num;
+        __entry->ret = ret;
+    ),
+    TP_printk("engine=%u dir=%s sgindex=%u completed=%u ret=%ld", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->sgindex, __entry->num, __entry->ret)
+);
+
+/***********************************************************************
+ * Kicks of the fill queue: the entries waiting, the descriptors loaded
+ **********************************************************************/
+TRACE_EVENT(pothos_zynq_dma_kick,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t avail, size_t tail, long ret),
+    TP_ARGS(chan, avail, tail, ret),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, avail)
+        __field(u32, tail)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->avail = avail;
+        __entry->tail = tail;
+        __entry->ret = ret;
+    ),
+    TP_printk("engine=%u dir=%s avail=%u sgindex=%u ret=%ld", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->avail, __entry->tail, __entry->ret)
+);
+
+/***********************************************************************
+ * Buffer allocation and free, with the total size and duration
+ **********************************************************************/
+TRACE_EVENT(pothos_zynq_dma_alloc,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t num_buffs, size_t bytes, u64 duration_ns, long ret),
+    TP_ARGS(chan, num_buffs, bytes, duration_ns, ret),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, num_buffs)
+        __field(u32, flags)
+        __field(size_t, bytes)
+        __field(u64, duration_ns)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->num_buffs = num_buffs;
+        __entry->flags = chan->allocs.flags;
+        __entry->bytes = bytes;
+        __entry->duration_ns = duration_ns;
+        __entry->ret = ret;
+    ),
+    TP_printk("engine=%u dir=%s num_buffs=%u flags=0x%x bytes=%zu duration_ns=%llu ret=%ld", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->num_buffs, __entry->flags,
+        __entry->bytes, __entry->duration_ns, __entry->ret)
+);
+
+TRACE_EVENT(pothos_zynq_dma_free,
+    TP_PROTO(const pothos_zynq_dma_chan_t *chan, size_t num_buffs, size_t bytes, u64 duration_ns),
+    TP_ARGS(chan, num_buffs, bytes, duration_ns),
+    TP_STRUCT__entry(
+        __field(u32, engine_no)
+        __field(u32, direction)
+        __field(u32, num_buffs)
+        __field(size_t, bytes)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->engine_no = chan->engine_no;
+        __entry->direction = chan->direction;
+        __entry->num_buffs = num_buffs;
+        __entry->bytes = bytes;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("engine=%u dir=%s num_buffs=%u bytes=%zu duration_ns=%llu", __entry->engine_no,
+        pothos_zynq_dma_trace_dir(__entry->direction), __entry->num_buffs, __entry->bytes, __entry->duration_ns)
+);
+
+#endif /* _POTHOS_ZYNQ_DMA_TRACE_H */
+
+//the trace header is found in the module source directory
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pothos_zynq_dma_trace
+#include <trace/define_trace.h>
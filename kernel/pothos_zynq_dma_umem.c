@@ -0,0 +1,341 @@
+// Copyright (c) 2014-2014 Josh Blum
+// SPDX-License-Identifier: BSL-1.0
+
+#include "pothos_zynq_dma_module.h"
+#include <linux/uaccess.h> //copy_to/from_user
+#include <linux/mm.h> //get_user_pages_fast
+#include <linux/vmalloc.h> //vmalloc
+#include <linux/scatterlist.h> //sg_alloc_table_from_pages
+#include <linux/dma-mapping.h> //dma_map_sg
+#include <linux/platform_device.h> //struct platform_device
+#include <linux/dma-buf.h> //dma_buf_get
+#include <linux/reservation.h> //reservation_object_wait_timeout_rcu
+#include <linux/err.h> //IS_ERR
+#include <linux/spinlock.h> //spin_lock_irqsave
+
+//! The longest segment, page aligned so that the next segment starts aligned
+#define POTHOS_ZYNQ_DMA_SEG_MAX (XILINX_DMA_BD_LEN_MASK & PAGE_MASK)
+
+//! The longest wait for the exclusive fence of an imported buffer
+#define POTHOS_ZYNQ_DMA_FENCE_TIMEOUT_MS 1000
+
+//! The first free slot for a region, or POTHOS_ZYNQ_DMA_UMEM_MAX when full
+static size_t pothos_zynq_dma_umem_slot(pothos_zynq_dma_chan_t *chan)
+{
+    size_t handle = 0;
+    while (handle < POTHOS_ZYNQ_DMA_UMEM_MAX && chan->umems[handle].table != NULL) handle++;
+    return handle;
+}
+
+/***********************************************************************
+ * Release the mapping and the pinned pages of a region
+ **********************************************************************/
+static void pothos_zynq_dma_umem_release(pothos_zynq_dma_user_t *user, pothos_zynq_dma_umem_region_t *umem)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    struct platform_device *pdev = user->engine->pdev;
+
+    //the exporter owns the mapping of an imported buffer
+    if (umem->dmabuf != NULL)
+    {
+        if (umem->table != NULL) dma_buf_unmap_attachment(umem->attach, umem->table, chan->dma_dir);
+        if (umem->attach != NULL) dma_buf_detach(umem->dmabuf, umem->attach);
+        dma_buf_put(umem->dmabuf);
+        memset(umem, 0, sizeof(pothos_zynq_dma_umem_region_t));
+        return;
+    }
+
+    if (umem->nents != 0) dma_unmap_sg(&pdev->dev, umem->sgt.sgl, umem->sgt.orig_nents, chan->dma_dir);
+    if (umem->sgt.sgl != NULL) sg_free_table(&umem->sgt);
+
+    //the engine wrote into the pages for S2MM
+    for (size_t i = 0; i < umem->num_pages; i++)
+    {
+        if (umem->pages[i] == NULL) break; //pinning stopped short
+        if (chan->dma_dir == DMA_FROM_DEVICE) set_page_dirty_lock(umem->pages[i]);
+        put_page(umem->pages[i]);
+    }
+    vfree(umem->pages);
+    memset(umem, 0, sizeof(pothos_zynq_dma_umem_region_t));
+}
+
+/***********************************************************************
+ * Copy out the mapped entries as descriptor sized segments:
+ * adjacent entries are merged and long entries are split
+ **********************************************************************/
+static long pothos_zynq_dma_umem_segs(pothos_zynq_dma_umem_region_t *umem, const size_t max_segs, pothos_zynq_dma_seg_t *user_segs, size_t *num_segs)
+{
+    pothos_zynq_dma_seg_t seg = {0, 0};
+    struct scatterlist *sg;
+    int i;
+    *num_segs = 0;
+    for_each_sg(umem->table->sgl, sg, umem->nents, i)
+    {
+        size_t paddr = sg_dma_address(sg);
+        size_t bytes = sg_dma_len(sg);
+        while (bytes != 0)
+        {
+            //extend the current segment when contiguous
+            if (seg.bytes != 0 && seg.paddr + seg.bytes == paddr && seg.bytes < POTHOS_ZYNQ_DMA_SEG_MAX)
+            {
+                const size_t n = min_t(size_t, bytes, POTHOS_ZYNQ_DMA_SEG_MAX - seg.bytes);
+                seg.bytes += n;
+                paddr += n;
+                bytes -= n;
+                continue;
+            }
+
+            //otherwise emit the current segment and start another
+            if (seg.bytes != 0)
+            {
+                if (*num_segs == max_segs) return -ENOSPC;
+                if (copy_to_user(user_segs + *num_segs, &seg, sizeof(pothos_zynq_dma_seg_t)) != 0) return -EACCES;
+                (*num_segs)++;
+            }
+            seg.paddr = paddr;
+            seg.bytes = min_t(size_t, bytes, POTHOS_ZYNQ_DMA_SEG_MAX);
+            paddr += seg.bytes;
+            bytes -= seg.bytes;
+        }
+    }
+
+    if (seg.bytes == 0) return 0;
+    if (*num_segs == max_segs) return -ENOSPC;
+    if (copy_to_user(user_segs + *num_segs, &seg, sizeof(pothos_zynq_dma_seg_t)) != 0) return -EACCES;
+    (*num_segs)++;
+    return 0;
+}
+
+/***********************************************************************
+ * Register user memory: pin, build the table, and map for the channel
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_umem_reg(pothos_zynq_dma_user_t *user, pothos_zynq_dma_umem_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    struct platform_device *pdev = user->engine->pdev;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_umem_t umem_args;
+    if (copy_from_user(&umem_args, user_config, sizeof(pothos_zynq_dma_umem_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (umem_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+    if (umem_args.bytes == 0) return -EINVAL;
+
+    //find a free slot
+    const size_t handle = pothos_zynq_dma_umem_slot(chan);
+    if (handle == POTHOS_ZYNQ_DMA_UMEM_MAX) return -EMFILE;
+    pothos_zynq_dma_umem_region_t *umem = chan->umems + handle;
+
+    //the pages which span the range
+    const unsigned long start = (unsigned long)umem_args.uaddr;
+    const size_t offset = offset_in_page(start);
+    umem->bytes = umem_args.bytes;
+    umem->num_pages = PAGE_ALIGN(offset + umem_args.bytes) >> PAGE_SHIFT;
+    umem->pages = vzalloc(umem->num_pages*sizeof(struct page *));
+    if (umem->pages == NULL)
+    {
+        memset(umem, 0, sizeof(pothos_zynq_dma_umem_region_t));
+        return -ENOMEM;
+    }
+
+    //pin the pages, the engine writes into them for S2MM
+    long ret = get_user_pages_fast(start & PAGE_MASK, umem->num_pages, (chan->dma_dir == DMA_FROM_DEVICE)?1:0, umem->pages);
+    if (ret != (long)umem->num_pages)
+    {
+        if (ret >= 0) ret = -EFAULT;
+        goto fail;
+    }
+
+    //describe and map the range, contiguous pages share an entry
+    ret = sg_alloc_table_from_pages(&umem->sgt, umem->pages, umem->num_pages, offset, umem_args.bytes, GFP_KERNEL);
+    if (ret != 0) goto fail;
+    umem->nents = dma_map_sg(&pdev->dev, umem->sgt.sgl, umem->sgt.orig_nents, chan->dma_dir);
+    if (umem->nents == 0)
+    {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    umem->table = &umem->sgt;
+
+    //the user fills the descriptors from the segments
+    size_t num_segs = 0;
+    ret = pothos_zynq_dma_umem_segs(umem, umem_args.num_segs, umem_args.segs, &num_segs);
+    if (ret != 0) goto fail;
+
+    umem_args.handle = handle;
+    umem_args.num_segs = num_segs;
+    if (copy_to_user(user_config, &umem_args, sizeof(pothos_zynq_dma_umem_t)) != 0)
+    {
+        ret = -EACCES;
+        goto fail;
+    }
+    return 0;
+
+    fail:
+        pothos_zynq_dma_umem_release(user, umem);
+        return ret;
+}
+
+/***********************************************************************
+ * Import a dma-buf: attach the engine and let the exporter map it
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_import(pothos_zynq_dma_user_t *user, pothos_zynq_dma_import_t *user_config)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    struct platform_device *pdev = user->engine->pdev;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_import_t import_args;
+    if (copy_from_user(&import_args, user_config, sizeof(pothos_zynq_dma_import_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (import_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //find a free slot
+    const size_t handle = pothos_zynq_dma_umem_slot(chan);
+    if (handle == POTHOS_ZYNQ_DMA_UMEM_MAX) return -EMFILE;
+    pothos_zynq_dma_umem_region_t *umem = chan->umems + handle;
+
+    //take a reference on the buffer and attach the engine
+    long ret = 0;
+    umem->dmabuf = dma_buf_get(import_args.fd);
+    if (IS_ERR(umem->dmabuf))
+    {
+        ret = PTR_ERR(umem->dmabuf);
+        memset(umem, 0, sizeof(pothos_zynq_dma_umem_region_t));
+        return ret;
+    }
+    umem->bytes = umem->dmabuf->size;
+    umem->attach = dma_buf_attach(umem->dmabuf, &pdev->dev);
+    if (IS_ERR(umem->attach))
+    {
+        ret = PTR_ERR(umem->attach);
+        umem->attach = NULL;
+        goto fail;
+    }
+    struct sg_table *table = dma_buf_map_attachment(umem->attach, chan->dma_dir);
+    if (IS_ERR(table))
+    {
+        ret = PTR_ERR(table);
+        goto fail;
+    }
+    umem->table = table;
+    umem->nents = table->nents;
+
+    //the user fills the descriptors from the segments
+    size_t num_segs = 0;
+    ret = pothos_zynq_dma_umem_segs(umem, import_args.num_segs, import_args.segs, &num_segs);
+    if (ret != 0) goto fail;
+
+    import_args.bytes = umem->bytes;
+    import_args.handle = handle;
+    import_args.num_segs = num_segs;
+    if (copy_to_user(user_config, &import_args, sizeof(pothos_zynq_dma_import_t)) != 0)
+    {
+        ret = -EACCES;
+        goto fail;
+    }
+    return 0;
+
+    fail:
+        pothos_zynq_dma_umem_release(user, umem);
+        return ret;
+}
+
+void pothos_zynq_dma_umem_release_all(pothos_zynq_dma_user_t *user)
+{
+    for (size_t i = 0; i < POTHOS_ZYNQ_DMA_UMEM_MAX; i++)
+    {
+        pothos_zynq_dma_umem_region_t *umem = user->chan->umems + i;
+        if (umem->table != NULL) pothos_zynq_dma_umem_release(user, umem);
+    }
+}
+
+//! Does a descriptor which the engine has not completed point into the region?
+static bool pothos_zynq_dma_umem_in_flight(pothos_zynq_dma_chan_t *chan, pothos_zynq_dma_umem_region_t *umem)
+{
+    bool found = false;
+    unsigned long flags;
+    spin_lock_irqsave(&chan->lock, flags);
+    for (size_t i = 0; chan->sgtable != NULL && i < chan->allocs.num_buffs && !found; i++)
+    {
+        const xilinx_dma_desc_t *desc = chan->sgtable + i;
+        if ((desc->status & (1 << 31)) != 0) continue;
+        struct scatterlist *sg;
+        int j;
+        for_each_sg(umem->table->sgl, sg, umem->nents, j)
+        {
+            if (desc->buf_addr >= sg_dma_address(sg) && desc->buf_addr < sg_dma_address(sg) + sg_dma_len(sg)) found = true;
+        }
+    }
+    spin_unlock_irqrestore(&chan->lock, flags);
+    return found;
+}
+
+long pothos_zynq_dma_ioctl_umem_unreg(pothos_zynq_dma_user_t *user, const size_t handle)
+{
+    if (handle >= POTHOS_ZYNQ_DMA_UMEM_MAX) return -ECHRNG;
+    pothos_zynq_dma_umem_region_t *umem = user->chan->umems + handle;
+    if (umem->table == NULL) return -EADDRNOTAVAIL;
+
+    //the released descriptors between the tail and the head may still transfer
+    if (pothos_zynq_dma_umem_in_flight(user->chan, umem)) return -EBUSY;
+    pothos_zynq_dma_umem_release(user, umem);
+    return 0;
+}
+
+/***********************************************************************
+ * Cache maintenance on the mapped entries which overlap a range
+ **********************************************************************/
+long pothos_zynq_dma_ioctl_umem_sync(pothos_zynq_dma_user_t *user, const pothos_zynq_dma_umem_sync_t *user_config, const int for_device)
+{
+    pothos_zynq_dma_chan_t *chan = user->chan;
+    struct platform_device *pdev = user->engine->pdev;
+
+    //convert the args into kernel memory
+    pothos_zynq_dma_umem_sync_t sync_args;
+    if (copy_from_user(&sync_args, user_config, sizeof(pothos_zynq_dma_umem_sync_t)) != 0) return -EACCES;
+
+    //check the sentinel
+    if (sync_args.sentinel != POTHOS_ZYNQ_DMA_SENTINEL) return -EINVAL;
+
+    //check that the range is registered
+    if (sync_args.handle >= POTHOS_ZYNQ_DMA_UMEM_MAX) return -ECHRNG;
+    pothos_zynq_dma_umem_region_t *umem = chan->umems + sync_args.handle;
+    if (umem->table == NULL) return -EADDRNOTAVAIL;
+    if (sync_args.offset > umem->bytes || sync_args.bytes > umem->bytes - sync_args.offset) return -ERANGE;
+
+    //the exporter maintains the caches of an imported buffer,
+    //the engine may read once the producer's exclusive fence signals
+    if (umem->dmabuf != NULL)
+    {
+        if (!for_device) return 0;
+        const long ret = reservation_object_wait_timeout_rcu(umem->dmabuf->resv, false, true, msecs_to_jiffies(POTHOS_ZYNQ_DMA_FENCE_TIMEOUT_MS));
+        if (ret < 0) return ret;
+        return (ret == 0)?-ETIME:0;
+    }
+
+    //transfer ownership of the overlapping part of each entry
+    const size_t first = sync_args.offset;
+    const size_t last = sync_args.offset + sync_args.bytes;
+    size_t pos = 0;
+    struct scatterlist *sg;
+    int i;
+    for_each_sg(umem->table->sgl, sg, umem->nents, i)
+    {
+        const size_t len = sg_dma_len(sg);
+        const size_t begin = max(pos, first);
+        const size_t end = min(pos + len, last);
+        if (begin < end)
+        {
+            const dma_addr_t paddr = sg_dma_address(sg) + (begin - pos);
+            if (for_device) dma_sync_single_for_device(&pdev->dev, paddr, end - begin, chan->dma_dir);
+            else dma_sync_single_for_cpu(&pdev->dev, paddr, end - begin, chan->dma_dir);
+        }
+        pos += len;
+        if (pos >= last) break;
+    }
+
+    return 0;
+}